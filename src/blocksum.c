@@ -0,0 +1,288 @@
+/* Checksums and zero tests of archive blocks.
+
+   Copyright 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU tar.
+
+   GNU tar is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU tar is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* tar_checksum looks at every byte of every header it reads, and the
+   sparse file code at every byte of every block of a sparse file.
+   This module does both with vector instructions where the processor
+   has them: SSE2, and AVX2 if the processor supports it, on x86, and
+   NEON on AArch64.  Elsewhere it works a word at a time.  The
+   implementation is chosen the first time one of the functions is
+   called.
+
+   The signed sum of a block, which tar_checksum needs as well, is
+   derived from the unsigned one: each byte with the high bit set
+   counts 256 less as a signed char than as an unsigned one.  */
+
+#include <system.h>
+#include "common.h"
+
+#if ((defined __x86_64__ || defined __i386__) && defined __SSE2__ \
+     && (4 < __GNUC__ + (9 <= __GNUC_MINOR__) || defined __clang__))
+# define BLOCKSUM_X86 1
+# include <immintrin.h>
+#elif defined __aarch64__ && defined __ARM_NEON
+# define BLOCKSUM_NEON 1
+# include <arm_neon.h>
+#endif
+
+/* Sum the BLOCKSIZE bytes at P as unsigned chars, storing the result
+   in *SUM, and count those with the high bit set, storing the result
+   in *HIGH.  */
+typedef void (*block_sums_fn) (char const *p, int *sum, int *high);
+
+/* Return true if the SIZE bytes at P are all zero.  */
+typedef bool (*zero_fn) (char const *p, size_t size);
+
+static void block_sums_init (char const *, int *, int *);
+static bool zero_init (char const *, size_t);
+
+static block_sums_fn block_sums_impl = block_sums_init;
+static zero_fn zero_impl = zero_init;
+
+/* Portable implementation.  The bytes of each 64-bit word are added
+   into four 16-bit lanes, which cannot overflow over a block.  */
+
+#define LANES_8 UINT64_C (0x0101010101010101)
+#define LANES_16 UINT64_C (0x00ff00ff00ff00ff)
+#define LANES_32 UINT64_C (0x0000ffff0000ffff)
+
+static uint_least64_t
+load64 (char const *p)
+{
+  uint_least64_t w;
+  memcpy (&w, p, sizeof w);
+  return w;
+}
+
+/* Add up the four 16-bit lanes of W.  */
+static int
+fold16 (uint_least64_t w)
+{
+  w = (w & LANES_32) + ((w >> 16) & LANES_32);
+  return (w & 0xffffffff) + (w >> 32);
+}
+
+static void
+block_sums_generic (char const *p, int *sum, int *high)
+{
+  uint_least64_t s = 0, h = 0;
+
+  for (size_t i = 0; i < BLOCKSIZE; i += 8)
+    {
+      uint_least64_t w = load64 (p + i);
+      s += (w & LANES_16) + ((w >> 8) & LANES_16);
+      h += (w >> 7) & LANES_8;
+    }
+  *sum = fold16 (s);
+  *high = fold16 ((h & LANES_16) + ((h >> 8) & LANES_16));
+}
+
+static bool
+zero_generic (char const *p, size_t size)
+{
+  for (; 8 <= size; p += 8, size -= 8)
+    if (load64 (p))
+      return false;
+  while (size--)
+    if (*p++)
+      return false;
+  return true;
+}
+
+#ifdef BLOCKSUM_X86
+/* psadbw against zero sums groups of eight bytes into 64-bit lanes;
+   shifting each byte right by 7 beforehand counts the high bits.  */
+
+static void
+block_sums_sse2 (char const *p, int *sum, int *high)
+{
+  __m128i const zero = _mm_setzero_si128 ();
+  __m128i const ones = _mm_set1_epi8 (1);
+  __m128i s = zero, h = zero;
+
+  for (size_t i = 0; i < BLOCKSIZE; i += 16)
+    {
+      __m128i v = _mm_loadu_si128 ((__m128i const *) (p + i));
+      s = _mm_add_epi64 (s, _mm_sad_epu8 (v, zero));
+      h = _mm_add_epi64 (h,
+			 _mm_sad_epu8 (_mm_and_si128 (_mm_srli_epi16 (v, 7), ones),
+				       zero));
+    }
+  s = _mm_add_epi64 (s, _mm_srli_si128 (s, 8));
+  h = _mm_add_epi64 (h, _mm_srli_si128 (h, 8));
+  *sum = _mm_cvtsi128_si32 (s);
+  *high = _mm_cvtsi128_si32 (h);
+}
+
+static bool
+zero_sse2 (char const *p, size_t size)
+{
+  __m128i const zero = _mm_setzero_si128 ();
+
+  for (; 64 <= size; p += 64, size -= 64)
+    {
+      __m128i v = _mm_or_si128
+	(_mm_or_si128 (_mm_loadu_si128 ((__m128i const *) p),
+		       _mm_loadu_si128 ((__m128i const *) (p + 16))),
+	 _mm_or_si128 (_mm_loadu_si128 ((__m128i const *) (p + 32)),
+		       _mm_loadu_si128 ((__m128i const *) (p + 48))));
+      if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (v, zero)) != 0xffff)
+	return false;
+    }
+  return zero_generic (p, size);
+}
+
+__attribute__ ((__target__ ("avx2"))) static void
+block_sums_avx2 (char const *p, int *sum, int *high)
+{
+  __m256i const zero = _mm256_setzero_si256 ();
+  __m256i const ones = _mm256_set1_epi8 (1);
+  __m256i s = zero, h = zero;
+  __m128i s2, h2;
+
+  for (size_t i = 0; i < BLOCKSIZE; i += 32)
+    {
+      __m256i v = _mm256_loadu_si256 ((__m256i const *) (p + i));
+      s = _mm256_add_epi64 (s, _mm256_sad_epu8 (v, zero));
+      h = _mm256_add_epi64 (h,
+			    _mm256_sad_epu8 (_mm256_and_si256
+					     (_mm256_srli_epi16 (v, 7), ones),
+					     zero));
+    }
+  s2 = _mm_add_epi64 (_mm256_castsi256_si128 (s),
+		      _mm256_extracti128_si256 (s, 1));
+  h2 = _mm_add_epi64 (_mm256_castsi256_si128 (h),
+		      _mm256_extracti128_si256 (h, 1));
+  s2 = _mm_add_epi64 (s2, _mm_srli_si128 (s2, 8));
+  h2 = _mm_add_epi64 (h2, _mm_srli_si128 (h2, 8));
+  *sum = _mm_cvtsi128_si32 (s2);
+  *high = _mm_cvtsi128_si32 (h2);
+}
+
+__attribute__ ((__target__ ("avx2"))) static bool
+zero_avx2 (char const *p, size_t size)
+{
+  for (; 128 <= size; p += 128, size -= 128)
+    {
+      __m256i v = _mm256_or_si256
+	(_mm256_or_si256 (_mm256_loadu_si256 ((__m256i const *) p),
+			  _mm256_loadu_si256 ((__m256i const *) (p + 32))),
+	 _mm256_or_si256 (_mm256_loadu_si256 ((__m256i const *) (p + 64)),
+			  _mm256_loadu_si256 ((__m256i const *) (p + 96))));
+      if (!_mm256_testz_si256 (v, v))
+	return false;
+    }
+  return zero_generic (p, size);
+}
+#endif
+
+#ifdef BLOCKSUM_NEON
+/* NEON is part of the AArch64 base architecture, so there is nothing
+   to choose from at run time.  Pairwise widening additions into
+   16-bit lanes cannot overflow over a block.  */
+
+static void
+block_sums_neon (char const *p, int *sum, int *high)
+{
+  uint16x8_t s = vdupq_n_u16 (0), h = vdupq_n_u16 (0);
+
+  for (size_t i = 0; i < BLOCKSIZE; i += 16)
+    {
+      uint8x16_t v = vld1q_u8 ((uint8_t const *) (p + i));
+      s = vpadalq_u8 (s, v);
+      h = vpadalq_u8 (h, vshrq_n_u8 (v, 7));
+    }
+  *sum = vaddlvq_u16 (s);
+  *high = vaddlvq_u16 (h);
+}
+
+static bool
+zero_neon (char const *p, size_t size)
+{
+  for (; 64 <= size; p += 64, size -= 64)
+    {
+      uint8x16_t v = vorrq_u8
+	(vorrq_u8 (vld1q_u8 ((uint8_t const *) p),
+		   vld1q_u8 ((uint8_t const *) (p + 16))),
+	 vorrq_u8 (vld1q_u8 ((uint8_t const *) (p + 32)),
+		   vld1q_u8 ((uint8_t const *) (p + 48))));
+      if (vmaxvq_u8 (v))
+	return false;
+    }
+  return zero_generic (p, size);
+}
+#endif
+
+/* Choose the implementations for this processor.  */
+static void
+blocksum_select (void)
+{
+#if defined BLOCKSUM_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    {
+      block_sums_impl = block_sums_avx2;
+      zero_impl = zero_avx2;
+    }
+  else
+    {
+      block_sums_impl = block_sums_sse2;
+      zero_impl = zero_sse2;
+    }
+#elif defined BLOCKSUM_NEON
+  block_sums_impl = block_sums_neon;
+  zero_impl = zero_neon;
+#else
+  block_sums_impl = block_sums_generic;
+  zero_impl = zero_generic;
+#endif
+}
+
+static void
+block_sums_init (char const *p, int *sum, int *high)
+{
+  blocksum_select ();
+  block_sums_impl (p, sum, high);
+}
+
+static bool
+zero_init (char const *p, size_t size)
+{
+  blocksum_select ();
+  return zero_impl (p, size);
+}
+
+/* Sum the bytes of the block P, storing the sum as unsigned chars in
+   *UNSIGNED_SUM and the sum as signed chars in *SIGNED_SUM.  */
+void
+block_sums (char const *p, int *unsigned_sum, int *signed_sum)
+{
+  int sum, high;
+
+  block_sums_impl (p, &sum, &high);
+  *unsigned_sum = sum;
+  *signed_sum = sum - 256 * high;
+}
+
+/* Return true if the SIZE bytes at BUFFER are all zero.  */
+bool
+zero_block_p (char const *buffer, size_t size)
+{
+  return zero_impl (buffer, size);
+}
@@ -21,6 +21,8 @@
 
 #include <system.h>
 
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 
 #include <c-ctype.h>
@@ -71,6 +73,12 @@ static void backspace_output (void);
 /* PID of child program, if compress_option or remote archive access.  */
 static pid_t child_pid;
 
+/* Built-in codec replacing the compression program, if any.  */
+static struct codec *archive_codec;
+
+static size_t archive_read_raw (char *buf, size_t size);
+static off_t archive_seek_raw (off_t offset, int whence);
+
 /* Error recovery stuff  */
 static int read_error_count;
 
@@ -427,6 +435,71 @@ check_compressed_archive (bool *pshort)
   return ct_none;
 }
 
+/* Open the archive for access in MODE with a built-in codec instead of
+   running the compression program, if requested and possible.  Set
+   *BACKED_UP if a backup of the archive was made.  Return true if the
+   archive was opened.  */
+static bool
+open_codec_archive (enum access_mode mode, bool *backed_up)
+{
+  char const *program;
+  int state;
+  bool pad = false;
+  off_t (*seeker) (off_t, int) = NULL;
+  struct stat st;
+
+  if (!builtin_compression_option)
+    return false;
+  program = first_decompress_program (&state);
+  if (!codec_available (program, mode))
+    return false;
+
+  if (strcmp (archive_name_array[0], "-") == 0)
+    archive = mode == ACCESS_READ ? STDIN_FILENO : STDOUT_FILENO;
+  else if (mode == ACCESS_READ)
+    {
+      archive = rmtopen (archive_name_array[0], O_RDONLY | O_BINARY,
+                         MODE_RW, rsh_command_option);
+      if (archive < 0)
+        open_fatal (archive_name_array[0]);
+    }
+  else
+    {
+      if (backup_option)
+        {
+          maybe_backup_file (archive_name_array[0], 1);
+          *backed_up = true;
+        }
+      archive = rmtcreat (archive_name_array[0], MODE_RW,
+                          rsh_command_option);
+      if (archive < 0)
+        {
+          int saved_errno = errno;
+
+          if (backup_option)
+            undo_last_backup ();
+          errno = saved_errno;
+          open_fatal (archive_name_array[0]);
+        }
+
+      /* As when the compressor output is reblocked by a grandchild
+         tar, pad the last record unless the archive is a regular
+         file.  */
+      pad = (_isrmt (archive)
+             || fstat (archive, &st) != 0 || !S_ISREG (st.st_mode));
+    }
+
+  /* The index of a seekable archive can only be used if the archive
+     is a local file.  */
+  if (mode == ACCESS_READ && !_isrmt (archive)
+      && fstat (archive, &st) == 0 && S_ISREG (st.st_mode))
+    seeker = archive_seek_raw;
+
+  archive_codec = codec_open (program, mode, archive, pad,
+                              archive_read_raw, seeker);
+  return true;
+}
+
 /* Open an archive named archive_name_array[0]. Detect if it is
    a compressed archive of known type and use corresponding decompression
    program if so */
@@ -474,7 +547,8 @@ open_compressed_archive (void)
                           check_compressed_archive */
 
       /* Open compressed archive */
-      child_pid = sys_child_open_for_uncompress ();
+      if (!open_codec_archive (ACCESS_READ, NULL))
+        child_pid = sys_child_open_for_uncompress ();
       read_full_records = true;
     }
 
@@ -575,7 +649,17 @@ static char const *const default_total_format[] = {
 void
 print_total_stats (void)
 {
+  uintmax_t hits, reopens;
+
   format_total_stats (stderr, default_total_format, '\n', '\n');
+
+  chdir_cache_stats (&hits, &reopens);
+  if (hits || reopens)
+    {
+      char buf[2][UINTMAX_STRSIZE_BOUND];
+      fprintf (stderr, _("Directory descriptor cache: %s hits, %s reopens\n"),
+	       umaxtostr (hits, buf[0]), umaxtostr (reopens, buf[1]));
+    }
 }
 
 /* Compute and return the block ordinal at current_block.  */
@@ -585,6 +669,15 @@ current_block_ordinal (void)
   return record_start_block + (current_block - record_start);
 }
 
+/* Note that an archive member starts at current_block, so that a
+   seekable compressed archive can be decompressed from there.  */
+void
+mark_member_start (void)
+{
+  if (archive_codec)
+    codec_mark (archive_codec, current_block_ordinal () * BLOCKSIZE);
+}
+
 /* If the EOF flag is set, reset it, as well as current_block, etc.  */
 void
 reset_eof (void)
@@ -695,12 +788,14 @@ get_archive_status (enum access_mode wanted_access, bool backed_up_flag)
     }
 
   seekable_archive
-    = (! (multi_volume_option || use_compress_program_option)
-       && (seek_option < 0
-	   ? (_isrmt (archive)
-	      || S_ISREG (archive_stat.st_mode)
-	      || S_ISBLK (archive_stat.st_mode))
-	   : seek_option));
+    = (archive_codec
+       ? seek_option != 0 && codec_seekable (archive_codec)
+       : (! (multi_volume_option || use_compress_program_option)
+          && (seek_option < 0
+              ? (_isrmt (archive)
+                 || S_ISREG (archive_stat.st_mode)
+                 || S_ISBLK (archive_stat.st_mode))
+              : seek_option)));
 
   if (wanted_access != ACCESS_READ)
     sys_detect_dev_null_output ();
@@ -739,13 +834,15 @@ _open_archive (enum access_mode wanted_access)
       switch (wanted_access)
         {
         case ACCESS_READ:
-          child_pid = sys_child_open_for_uncompress ();
+          if (!open_codec_archive (ACCESS_READ, NULL))
+            child_pid = sys_child_open_for_uncompress ();
           read_full_records = true;
           record_end = record_start; /* set up for 1st record = # 0 */
           break;
 
         case ACCESS_WRITE:
-          child_pid = sys_child_open_for_compress ();
+          if (!open_codec_archive (ACCESS_WRITE, &backed_up_flag))
+            child_pid = sys_child_open_for_compress ();
           break;
 
         case ACCESS_UPDATE:
@@ -865,6 +962,8 @@ _flush_write (void)
     }
   else if (dev_null_output)
     status = record_size;
+  else if (archive_codec)
+    status = codec_write (archive_codec, record_start->buffer, record_size);
   else
     status = sys_write_archive_buffer ();
 
@@ -941,6 +1040,271 @@ archive_is_dev (void)
   return S_ISBLK (st.st_mode) || S_ISCHR (st.st_mode);
 }
 
+
+/* Read-ahead.  With --read-ahead, a separate thread reads records from
+   the archive into a ring of buffers, ahead of the main thread, which
+   copies them from there instead of reading the archive itself.  Each
+   buffer holds the outcome of one read, so that the main thread sees
+   exactly the same sequence of short reads, end of file and errors as
+   it would see by reading the archive.
+
+   The thread stops after reporting the end of file or an error, so that
+   the main thread can retry, give up or switch volumes as usual; it is
+   restarted when the main thread needs more data.  It is also stopped
+   before the archive is seeked or closed.  To be able to stop it while
+   it waits for input from a pipe, it polls the archive together with
+   a wakeup pipe before each read.  */
+
+struct read_ahead_chunk
+{
+  char *buffer;                 /* data read */
+  size_t status;                /* result of rmtread */
+  int errnum;                   /* errno after a failed read */
+};
+
+static pthread_mutex_t read_ahead_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t read_ahead_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t read_ahead_thread;
+static bool read_ahead_enabled;  /* read-ahead is used for this archive */
+static bool read_ahead_running;  /* the thread was started */
+static bool read_ahead_done;     /* the thread has finished */
+static bool read_ahead_stopping; /* the thread must stop */
+static int read_ahead_wakeup[2]; /* pipe to interrupt polling */
+
+static struct read_ahead_chunk *read_ahead_ring;
+static void **read_ahead_memory; /* allocated memory */
+static size_t read_ahead_size;   /* number of chunks in the ring */
+static size_t read_ahead_head;   /* next chunk to consume */
+static size_t read_ahead_count;  /* number of chunks read */
+static size_t read_ahead_offset; /* bytes consumed from the head chunk */
+
+/* Wait until the archive can be read.  Return false if the thread has
+   to stop instead.  */
+static bool
+read_ahead_poll (int fd)
+{
+  struct pollfd pfd[2];
+
+  pfd[0].fd = fd;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = read_ahead_wakeup[0];
+  pfd[1].events = POLLIN;
+  while (poll (pfd, 2, -1) < 0)
+    if (errno != EINTR)
+      /* Let the read itself block, or report the problem.  */
+      return true;
+  return ! (pfd[1].revents & POLLIN);
+}
+
+static void *
+read_ahead_loop (void *arg)
+{
+  int fd = *(int *) arg;
+
+  pthread_mutex_lock (&read_ahead_lock);
+  for (;;)
+    {
+      struct read_ahead_chunk *chunk;
+      size_t status;
+      int e;
+
+      while (read_ahead_count == read_ahead_size && !read_ahead_stopping)
+	pthread_cond_wait (&read_ahead_cond, &read_ahead_lock);
+      if (read_ahead_stopping)
+	break;
+      chunk = &read_ahead_ring[(read_ahead_head + read_ahead_count)
+			       % read_ahead_size];
+      pthread_mutex_unlock (&read_ahead_lock);
+
+      if (! read_ahead_poll (fd))
+	{
+	  pthread_mutex_lock (&read_ahead_lock);
+	  break;
+	}
+      status = rmtread (fd, chunk->buffer, record_size);
+      e = errno;
+
+      pthread_mutex_lock (&read_ahead_lock);
+      chunk->status = status;
+      chunk->errnum = e;
+      read_ahead_count++;
+      pthread_cond_broadcast (&read_ahead_cond);
+      if (status == 0 || status == SAFE_READ_ERROR)
+	break;
+    }
+  read_ahead_done = true;
+  pthread_cond_broadcast (&read_ahead_cond);
+  pthread_mutex_unlock (&read_ahead_lock);
+  return NULL;
+}
+
+/* Start the read-ahead thread.  Return true if successful.  */
+static bool
+read_ahead_start (void)
+{
+  static int fd;
+
+  if (!read_ahead_ring)
+    {
+      size_t i;
+
+      if (pipe (read_ahead_wakeup) != 0)
+	{
+	  read_ahead_enabled = false;
+	  return false;
+	}
+      read_ahead_size = read_ahead_option;
+      read_ahead_ring = xcalloc (read_ahead_size, sizeof *read_ahead_ring);
+      read_ahead_memory = xcalloc (read_ahead_size,
+				   sizeof *read_ahead_memory);
+      for (i = 0; i < read_ahead_size; i++)
+	read_ahead_ring[i].buffer =
+	  page_aligned_alloc (&read_ahead_memory[i], record_size);
+    }
+
+  fd = archive;
+  read_ahead_done = read_ahead_stopping = false;
+  read_ahead_running = pthread_create (&read_ahead_thread, NULL,
+				       read_ahead_loop, &fd) == 0;
+  if (!read_ahead_running)
+    read_ahead_enabled = false;
+  return read_ahead_running;
+}
+
+/* Stop the read-ahead thread, if it is running, and return the number
+   of bytes it has read from the archive that were not consumed yet.  */
+static size_t
+read_ahead_stop (void)
+{
+  size_t i, pending;
+
+  if (read_ahead_running)
+    {
+      char c;
+
+      pthread_mutex_lock (&read_ahead_lock);
+      read_ahead_stopping = true;
+      pthread_cond_broadcast (&read_ahead_cond);
+      pthread_mutex_unlock (&read_ahead_lock);
+      if (write (read_ahead_wakeup[1], "", 1) != 1)
+	abort ();
+      pthread_join (read_ahead_thread, NULL);
+      if (read (read_ahead_wakeup[0], &c, 1) != 1)
+	abort ();
+      read_ahead_running = false;
+    }
+
+  pending = 0;
+  for (i = 0; i < read_ahead_count; i++)
+    {
+      size_t status = read_ahead_ring[(read_ahead_head + i)
+				      % read_ahead_size].status;
+      if (status != SAFE_READ_ERROR)
+	pending += status;
+    }
+  return pending - read_ahead_offset;
+}
+
+/* Forget about the data read ahead.  The thread must be stopped.  */
+static void
+read_ahead_discard (void)
+{
+  read_ahead_head = read_ahead_count = read_ahead_offset = 0;
+}
+
+/* Stop reading ahead and free the resources used for it.  */
+static void
+read_ahead_finish (void)
+{
+  size_t i;
+
+  read_ahead_stop ();
+  read_ahead_discard ();
+  read_ahead_enabled = false;
+  if (read_ahead_ring)
+    {
+      for (i = 0; i < read_ahead_size; i++)
+	free (read_ahead_memory[i]);
+      free (read_ahead_memory);
+      free (read_ahead_ring);
+      read_ahead_ring = NULL;
+      close (read_ahead_wakeup[0]);
+      close (read_ahead_wakeup[1]);
+    }
+}
+
+/* Read at most SIZE bytes from the archive file into BUF, like
+   rmtread.  */
+static size_t
+archive_read_raw (char *buf, size_t size)
+{
+  struct read_ahead_chunk *chunk;
+  size_t status;
+
+  if (!read_ahead_enabled)
+    return rmtread (archive, buf, size);
+
+  pthread_mutex_lock (&read_ahead_lock);
+  if (read_ahead_count == 0 && (!read_ahead_running || read_ahead_done))
+    {
+      pthread_mutex_unlock (&read_ahead_lock);
+      read_ahead_stop ();
+      if (!read_ahead_start ())
+	return rmtread (archive, buf, size);
+      pthread_mutex_lock (&read_ahead_lock);
+    }
+  while (read_ahead_count == 0)
+    pthread_cond_wait (&read_ahead_cond, &read_ahead_lock);
+  chunk = &read_ahead_ring[read_ahead_head];
+  pthread_mutex_unlock (&read_ahead_lock);
+
+  /* The thread does not touch the chunks that were read but not yet
+     consumed.  */
+  if (chunk->status == SAFE_READ_ERROR)
+    {
+      status = SAFE_READ_ERROR;
+      errno = chunk->errnum;
+    }
+  else
+    {
+      status = chunk->status - read_ahead_offset;
+      if (size < status)
+	status = size;
+      memcpy (buf, chunk->buffer + read_ahead_offset, status);
+      read_ahead_offset += status;
+      if (read_ahead_offset < chunk->status)
+	return status;
+    }
+
+  pthread_mutex_lock (&read_ahead_lock);
+  read_ahead_head = (read_ahead_head + 1) % read_ahead_size;
+  read_ahead_count--;
+  read_ahead_offset = 0;
+  pthread_cond_broadcast (&read_ahead_cond);
+  pthread_mutex_unlock (&read_ahead_lock);
+  return status;
+}
+
+/* Reposition the archive file for reading like rmtlseek, discarding
+   the data read ahead.  */
+static off_t
+archive_seek_raw (off_t offset, int whence)
+{
+  read_ahead_stop ();
+  read_ahead_discard ();
+  return rmtlseek (archive, offset, whence);
+}
+
+/* Read at most SIZE bytes from the archive into BUF, like rmtread,
+   decompressing them if a built-in codec is in use.  */
+static size_t
+archive_read (char *buf, size_t size)
+{
+  return (archive_codec
+	  ? codec_read (archive_codec, buf, size)
+	  : archive_read_raw (buf, size));
+}
+
 static void
 short_read (size_t status)
 {
@@ -967,7 +1331,7 @@ short_read (size_t status)
          || (left && status && read_full_records))
     {
       if (status)
-        while ((status = rmtread (archive, more, left)) == SAFE_READ_ERROR)
+        while ((status = archive_read (more, left)) == SAFE_READ_ERROR)
           archive_read_error ();
 
       if (status == 0)
@@ -1072,6 +1436,7 @@ seek_archive (off_t size)
   off_t start = current_block_ordinal ();
   off_t offset;
   off_t nrec, nblk;
+  off_t ahead;
 
   /* If low level I/O is already at EOF, do not try to seek further.  */
   if (record_end < record_start + blocking_factor)
@@ -1083,16 +1448,33 @@ seek_archive (off_t size)
   if (size <= skipped)
     return 0;
 
-  /* Compute number of records to skip */
-  nrec = (size - skipped) / record_size;
-  if (nrec == 0)
-    return 0;
-  offset = rmtlseek (archive, nrec * record_size, SEEK_CUR);
-  if (offset < 0)
-    return offset;
+  if (archive_codec)
+    {
+      /* Decompression can restart at member headers, which need not
+         start a record, so skip whole blocks rather than records.  */
+      offset = codec_seek (archive_codec,
+                           ((size - skipped + BLOCKSIZE - 1)
+                            / BLOCKSIZE * BLOCKSIZE));
+    }
+  else
+    {
+      /* Compute number of records to skip */
+      nrec = (size - skipped) / record_size;
+      if (nrec == 0)
+        return 0;
 
-  if (offset % record_size)
-    FATAL_ERROR ((0, 0, _("rmtlseek not stopped at a record boundary")));
+      /* The archive position is past the data read ahead, if any.  */
+      ahead = read_ahead_stop ();
+      offset = rmtlseek (archive, nrec * (off_t) record_size - ahead,
+                         SEEK_CUR);
+      if (offset < 0)
+        return offset;
+      read_ahead_discard ();
+
+      if (offset % record_size)
+        FATAL_ERROR ((0, 0,
+                      _("rmtlseek not stopped at a record boundary")));
+    }
 
   /* Convert to number of records */
   offset /= BLOCKSIZE;
@@ -1107,6 +1489,457 @@ seek_archive (off_t size)
   return nblk;
 }
 
+/* Copy the next SIZE bytes of member data from the archive to the
+   file descriptor FD within the kernel, with copy_file_range or, if FD
+   is a pipe, with splice, so that the data do not pass through the
+   record buffer.  This is done only for uncompressed single-volume
+   archives in local regular files, once the current record has been
+   used up, and only whole records are copied; the caller copies the
+   rest of the data as usual.  A checkpoint is run for each record
+   consumed, as if it had been read.
+
+   Return the number of bytes of data consumed from the archive.  If
+   writing to FD failed in a way that the usual copy cannot recover
+   from, set *FAILED and errno; the data consumed may then not all have
+   been written.  */
+off_t
+copy_archive_data (int fd, off_t size, bool *failed)
+{
+#if HAVE_COPY_FILE_RANGE || HAVE_SPLICE
+  static bool unsupported;
+  struct stat st;
+  bool pipe_output;
+  off_t start, total, done, keep;
+  size_t ahead;
+
+  *failed = false;
+  if (size < record_size || current_block != record_end
+      || record_end < record_start + blocking_factor
+      || unsupported || access_mode != ACCESS_READ || archive_codec
+      || multi_volume_option || write_archive_to_stdout || !seekable_archive
+      || _isrmt (archive) || !S_ISREG (archive_stat.st_mode)
+      || fstat (fd, &st) != 0)
+    return 0;
+
+  pipe_output = S_ISFIFO (st.st_mode);
+# if !HAVE_SPLICE
+  if (pipe_output)
+    return 0;
+# endif
+# if !HAVE_COPY_FILE_RANGE
+  if (!pipe_output)
+    return 0;
+# endif
+  if (!pipe_output && !S_ISREG (st.st_mode))
+    return 0;
+
+  /* The archive position is past the data read ahead, if any.  */
+  ahead = read_ahead_stop ();
+  start = rmtlseek (archive, 0, SEEK_CUR);
+  if (start < 0)
+    return 0;
+  start -= ahead;
+
+  /* Leave a truncated last record to the usual code, which reports
+     it.  */
+  total = min (size, archive_stat.st_size - start);
+  total -= total % record_size;
+  for (done = 0; done < total; )
+    {
+      /* Stop at each checkpoint, so that the checkpoint actions happen
+	 when they would if the records were read one by one.  */
+      size_t chunk = min (checkpoint_distance (), (1 << 30) / record_size);
+      off_t mark = done;
+      off_t end = done + min ((off_t) chunk * record_size, total - done);
+
+      while (done < end)
+	{
+	  off_t in = start + done;
+	  ssize_t n;
+
+# if HAVE_SPLICE
+	  if (pipe_output)
+	    n = splice (archive, &in, fd, NULL, end - done, SPLICE_F_MOVE);
+	  else
+# endif
+# if HAVE_COPY_FILE_RANGE
+	    n = copy_file_range (archive, &in, fd, NULL, end - done, 0);
+# else
+	    abort ();
+# endif
+	  if (n <= 0)
+	    {
+	      if (n < 0 && errno == ENOSYS)
+		unsupported = true;
+	      break;
+	    }
+	  done += n;
+	}
+
+      for (; mark + record_size <= done; mark += record_size)
+	checkpoint_run (false);
+      if (done < end)
+	break;
+    }
+
+  /* Leave the copy at a record boundary, so that the caller can go on
+     reading records.  */
+  keep = done - done % record_size;
+  if (keep < done)
+    {
+      int e = errno;
+      if (pipe_output || lseek (fd, keep - done, SEEK_CUR) < 0)
+	{
+	  *failed = true;
+	  keep = done + record_size - done % record_size;
+	  checkpoint_run (false);
+	}
+      errno = e;
+    }
+  if (keep == 0)
+    return 0;
+
+  if (rmtlseek (archive, start + keep, SEEK_SET) != start + keep)
+    {
+      seek_error_details (*archive_name_cursor, start + keep);
+      fatal_exit ();
+    }
+  read_ahead_discard ();
+
+  records_read += keep / record_size;
+  record_start_block += keep / BLOCKSIZE;
+  return keep;
+#else
+  *failed = false;
+  return 0;
+#endif
+}
+
+
+/* Asynchronous writing.  With --async-write, full records are written
+   to the archive by a separate thread, while the main thread goes on
+   filling the next one.  The records live in a ring of buffers, which
+   the main thread fills in turn and hands over to the writer thread.
+   Write errors are reported by the main thread, the next time it hands
+   over a record or when the archive is closed.
+
+   This is not used for multi-volume archives, as switching volumes
+   depends on the outcome of each write, nor for remote archives.  */
+
+static pthread_mutex_t async_write_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_write_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t async_write_thread;
+static bool async_write_running;
+
+static void **async_write_buffer;  /* allocated memory */
+static union block **async_write_ring; /* page-aligned records */
+static size_t async_write_size;    /* number of records in the ring */
+static size_t async_write_fill;    /* record being filled */
+static size_t async_write_next;    /* next record to write */
+static size_t async_write_queued;  /* number of records to write */
+static size_t async_write_done;    /* records written, not yet counted */
+static ssize_t async_write_status; /* status of a failed write */
+static int async_write_errno;      /* errno of a failed write */
+static bool async_write_stop;      /* exit when all records are written */
+
+static void *
+async_write_loop (MAYBE_UNUSED void *arg)
+{
+  pthread_mutex_lock (&async_write_lock);
+  for (;;)
+    {
+      union block *record;
+      bool failed;
+      ssize_t status;
+      int e;
+
+      while (async_write_queued == 0 && !async_write_stop)
+	pthread_cond_wait (&async_write_cond, &async_write_lock);
+      if (async_write_queued == 0)
+	break;
+
+      record = async_write_ring[async_write_next];
+      failed = async_write_status != record_size;
+      pthread_mutex_unlock (&async_write_lock);
+
+      /* Once a write failed, discard the remaining records: the main
+	 thread is about to give up anyway.  */
+      status = (failed ? 0
+		: archive_codec
+		? codec_write (archive_codec, record->buffer, record_size)
+		: rmtwrite (archive, record->buffer, record_size));
+      e = errno;
+
+      pthread_mutex_lock (&async_write_lock);
+      if (failed)
+	;
+      else if (status != record_size)
+	{
+	  async_write_status = status;
+	  async_write_errno = e;
+	}
+      else
+	async_write_done++;
+      async_write_next = (async_write_next + 1) % async_write_size;
+      async_write_queued--;
+      pthread_cond_broadcast (&async_write_cond);
+    }
+  pthread_mutex_unlock (&async_write_lock);
+  return NULL;
+}
+
+/* Account for the records written since the last call, and return the
+   status of the first failed write, or record_size if none failed.
+   The lock must be held, unless the writer thread is gone.  */
+static ssize_t
+async_write_reap (void)
+{
+  records_written += async_write_done;
+  bytes_written += (tarlong) async_write_done * record_size;
+  async_write_done = 0;
+  return async_write_status;
+}
+
+/* Hand over the current record to the writer thread, and make the next
+   free buffer of the ring the current record.  */
+static void
+async_flush_write (MAYBE_UNUSED size_t level)
+{
+  ssize_t status;
+
+  checkpoint_run (true);
+
+  pthread_mutex_lock (&async_write_lock);
+  async_write_queued++;
+  pthread_cond_broadcast (&async_write_cond);
+  async_write_fill = (async_write_fill + 1) % async_write_size;
+  while (async_write_queued == async_write_size)
+    pthread_cond_wait (&async_write_cond, &async_write_lock);
+  status = async_write_reap ();
+  pthread_mutex_unlock (&async_write_lock);
+
+  if (status != record_size)
+    {
+      errno = async_write_errno;
+      archive_write_error (status);
+    }
+
+  record_start = async_write_ring[async_write_fill];
+  current_block = record_start;
+  record_end = record_start + blocking_factor;
+}
+
+/* Start writing the archive asynchronously, if requested and possible.
+   Nothing must have been written to the archive yet.  */
+static void
+async_write_start (void)
+{
+  size_t i;
+
+  if (!async_write_option || multi_volume_option || dev_null_output
+      || _isrmt (archive))
+    return;
+
+  async_write_size = max (async_write_option, 2);
+  async_write_buffer = xcalloc (async_write_size, sizeof *async_write_buffer);
+  async_write_ring = xcalloc (async_write_size, sizeof *async_write_ring);
+  for (i = 0; i < async_write_size; i++)
+    async_write_ring[i] = page_aligned_alloc (&async_write_buffer[i],
+					      record_size);
+  async_write_fill = async_write_next = async_write_queued = 0;
+  async_write_done = 0;
+  async_write_status = record_size;
+  async_write_stop = false;
+
+  if (pthread_create (&async_write_thread, NULL, async_write_loop, NULL) != 0)
+    {
+      /* Fall back to writing synchronously.  */
+      for (i = 0; i < async_write_size; i++)
+	free (async_write_buffer[i]);
+      free (async_write_buffer);
+      free (async_write_ring);
+      return;
+    }
+
+  async_write_running = true;
+  flush_write_ptr = async_flush_write;
+  record_start = async_write_ring[async_write_fill];
+  current_block = record_start;
+  record_end = record_start + blocking_factor;
+}
+
+/* Wait until all records handed over to the writer thread are written,
+   and stop it.  */
+static void
+async_write_finish (void)
+{
+  ssize_t status;
+  size_t i;
+
+  if (!async_write_running)
+    return;
+
+  pthread_mutex_lock (&async_write_lock);
+  async_write_stop = true;
+  pthread_cond_broadcast (&async_write_cond);
+  pthread_mutex_unlock (&async_write_lock);
+  pthread_join (async_write_thread, NULL);
+  async_write_running = false;
+
+  status = async_write_reap ();
+  for (i = 0; i < async_write_size; i++)
+    free (async_write_buffer[i]);
+  free (async_write_buffer);
+  free (async_write_ring);
+  init_buffer ();
+
+  if (status != record_size)
+    {
+      errno = async_write_errno;
+      archive_write_error (status);
+    }
+}
+
+/* Wait until all records handed over to the writer thread are
+   written.  */
+static void
+async_write_drain (void)
+{
+  ssize_t status;
+
+  pthread_mutex_lock (&async_write_lock);
+  while (async_write_queued != 0)
+    pthread_cond_wait (&async_write_cond, &async_write_lock);
+  status = async_write_reap ();
+  pthread_mutex_unlock (&async_write_lock);
+
+  if (status != record_size)
+    {
+      errno = async_write_errno;
+      archive_write_error (status);
+    }
+}
+
+/* Copy up to SIZE bytes of data from FD, a file being archived, to the
+   archive within the kernel, with copy_file_range if the archive is a
+   regular file or with splice if it is a pipe, so that the data do not
+   pass through the record buffer.  This is done only for uncompressed
+   single-volume local archives, and only for whole records: the
+   current record is written out first, and the caller writes the rest
+   of the data as usual.
+
+   Return the number of bytes copied from FD.  If FD ends or fails to
+   be read in the middle of a record, the rest of the record is filled
+   with zeros: set *PAD to their number and *ERRNUM to the error
+   number, or to zero at the end of the file.  Otherwise, set *PAD to
+   zero.  */
+off_t
+copy_to_archive (int fd, off_t size, size_t *pad, int *errnum)
+{
+#if HAVE_COPY_FILE_RANGE || HAVE_SPLICE
+  static bool unsupported;
+  bool pipe_archive = S_ISFIFO (archive_stat.st_mode);
+  off_t total, done;
+  size_t rest, count;
+  char *buf;
+
+  *pad = 0;
+  if (size < record_size || unsupported || access_mode != ACCESS_WRITE
+      || archive_codec || multi_volume_option || tape_length_option
+      || dev_null_output || _isrmt (archive)
+      || ! (pipe_archive || S_ISREG (archive_stat.st_mode)))
+    return 0;
+# if !HAVE_SPLICE
+  if (pipe_archive)
+    return 0;
+# endif
+# if !HAVE_COPY_FILE_RANGE
+  if (!pipe_archive)
+    return 0;
+# endif
+
+  if (current_block == record_end)
+    flush_archive ();
+  if (current_block != record_start)
+    return 0;
+  if (async_write_running)
+    async_write_drain ();
+
+  total = size - size % record_size;
+  for (done = 0; done < total; )
+    {
+      /* Stop at each checkpoint, so that the checkpoint actions happen
+	 when they would if the records were written one by one.  */
+      size_t chunk = min (checkpoint_distance (), (1 << 30) / record_size);
+      off_t start = done;
+      off_t end = done + min ((off_t) chunk * record_size, total - done);
+
+      while (done < end)
+	{
+	  ssize_t n;
+
+# if HAVE_SPLICE
+	  if (pipe_archive)
+	    n = splice (fd, NULL, archive, NULL, end - done, SPLICE_F_MOVE);
+	  else
+# endif
+# if HAVE_COPY_FILE_RANGE
+	    n = copy_file_range (fd, NULL, archive, NULL, end - done, 0);
+# else
+	    abort ();
+# endif
+	  if (n <= 0)
+	    {
+	      if (n < 0 && errno == ENOSYS)
+		unsupported = true;
+	      break;
+	    }
+	  done += n;
+	}
+
+      for (; start + record_size <= done; start += record_size)
+	{
+	  checkpoint_run (true);
+	  records_written++;
+	  record_start_block += blocking_factor;
+	  bytes_written += record_size;
+	}
+      if (done < end)
+	break;
+    }
+
+  rest = done % record_size;
+  if (rest == 0)
+    return done;
+
+  /* The copy stopped in the middle of a record.  Complete it with the
+     data that can still be read from FD, and with zeros.  */
+  rest = record_size - rest;
+  buf = xzalloc (rest);
+  count = blocking_read (fd, buf, rest);
+  if (count == SAFE_READ_ERROR)
+    {
+      *errnum = errno;
+      count = 0;
+    }
+  else
+    *errnum = 0;
+  checkpoint_run (true);
+  if (full_write (archive, buf, rest) != rest)
+    archive_write_error (0);
+  free (buf);
+  records_written++;
+  record_start_block += blocking_factor;
+  bytes_written += record_size;
+  if (count < rest)
+    *pad = rest - count;
+  return done + count;
+#else
+  *pad = 0;
+  return 0;
+#endif
+}
+
 /* Close the archive file.  */
 void
 close_archive (void)
@@ -1118,6 +1951,17 @@ close_archive (void)
       while (current_block > record_start);
     }
 
+  async_write_finish ();
+  read_ahead_finish ();
+
+  if (archive_codec)
+    {
+      bool ok = codec_close (archive_codec);
+      archive_codec = NULL;
+      if (!ok)
+	archive_write_error (0);
+    }
+
   compute_duration ();
   if (verify_option)
     verify_volume ();
@@ -1137,6 +1981,7 @@ void
 write_fatal_details (char const *name, ssize_t status, size_t size)
 {
   write_error_details (name, status, size);
+  read_ahead_finish ();
   if (rmtclose (archive) != 0)
     close_error (*archive_name_cursor);
   sys_wait_for_child (child_pid, false);
@@ -1316,6 +2161,8 @@ new_volume (enum access_mode mode)
   continued_file_size = continued_file_offset = 0;
   current_block = record_start;
 
+  read_ahead_stop ();
+  read_ahead_discard ();
   if (rmtclose (archive) != 0)
     close_error (*archive_name_cursor);
 
@@ -1426,7 +2273,7 @@ try_new_volume (void)
   if (!new_volume (acc))
     return true;
 
-  while ((status = rmtread (archive, record_start->buffer, record_size))
+  while ((status = archive_read (record_start->buffer, record_size))
          == SAFE_READ_ERROR)
     archive_read_error ();
 
@@ -1804,7 +2651,7 @@ simple_flush_read (void)
 
   for (;;)
     {
-      status = rmtread (archive, record_start->buffer, record_size);
+      status = archive_read (record_start->buffer, record_size);
       if (status == record_size)
         {
           records_read++;
@@ -1863,7 +2710,7 @@ _gnu_flush_read (void)
 
   for (;;)
     {
-      status = rmtread (archive, record_start->buffer, record_size);
+      status = archive_read (record_start->buffer, record_size);
       if (status == record_size)
         {
           records_read++;
@@ -2020,6 +2867,11 @@ open_archive (enum access_mode wanted_access)
   switch (wanted_access)
     {
     case ACCESS_READ:
+      read_ahead_enabled = read_ahead_option && !_isrmt (archive);
+      if (volume_label_option)
+        match_volume_label ();
+      break;
+
     case ACCESS_UPDATE:
       if (volume_label_option)
         match_volume_label ();
@@ -2027,6 +2879,7 @@ open_archive (enum access_mode wanted_access)
 
     case ACCESS_WRITE:
       records_written = 0;
+      async_write_start ();
       if (volume_label_option)
         write_volume_label ();
       break;
@@ -467,6 +467,17 @@ checkpoint_run (bool do_write)
     run_checkpoint_actions (do_write);
 }
 
+/* Return the number of calls to checkpoint_run up to and including the
+   next one that runs the checkpoint actions, or UINT_MAX if none
+   does.  */
+unsigned
+checkpoint_distance (void)
+{
+  return (checkpoint_option
+	  ? checkpoint_option - checkpoint % checkpoint_option
+	  : UINT_MAX);
+}
+
 void
 checkpoint_finish (void)
 {
@@ -0,0 +1,1372 @@
+/* Built-in compression codecs.
+
+   Copyright 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU tar.
+
+   GNU tar is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU tar is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Normally a compressed archive is piped through an external program
+   run by a child process (see sys_child_open_for_compress and
+   sys_child_open_for_uncompress).  With --builtin-compression, gzip,
+   xz and zstd streams are instead encoded and decoded in-process with
+   zlib, liblzma and libzstd, if tar was built with them.
+
+   The encoders use the defaults of the corresponding programs, so
+   that the output decompresses the same way.  The gzip header carries
+   neither a file name nor a time stamp, as with 'gzip -n'.
+
+   With --compress-threads=N, gzip output is split into chunks of
+   CODEC_CHUNK_SIZE bytes that N worker threads compress independently
+   into separate gzip members, which gzip -d decompresses as a single
+   stream.  For xz and zstd, the libraries' own multithreaded encoders
+   are used instead, as by 'xz -T N' and 'zstd -T N'.
+
+   With --seekable-compression, a gzip member or zstd frame is ended
+   at the first archive member boundary (see mark_member_start) after
+   every CODEC_SEEK_SPACING bytes, and an index mapping the archive
+   offsets of these boundaries to the offsets of the compressed data
+   that start there is appended to the archive.  The index is kept in
+   empty gzip members, in an extra field with the subfield ID "TI"
+   (or in zstd skippable frames starting with "TI"), followed by a
+   locator of fixed size, with the ID "TL", giving its offset.  Other
+   decompressors ignore it.  When such an archive is read from a
+   regular file, the index makes it seekable (see codec_seek), so that
+   the members that are skipped need not be decompressed.
+
+   codec_write may be called from the thread writing the archive (see
+   --async-write), so it does not report errors; it returns a short
+   count with errno set instead.  codec_read is only called from the
+   main thread.  */
+
+#include <system.h>
+#include <rmt.h>
+#include <pthread.h>
+#include "common.h"
+
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+#ifdef HAVE_LZMA
+# include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+# include <zstd_errors.h>
+#endif
+
+enum codec_type
+  {
+    codec_none,
+    codec_gzip,
+    codec_xz,
+    codec_zstd
+  };
+
+/* Size of the chunks compressed in parallel into gzip members.  */
+enum { CODEC_CHUNK_SIZE = 1024 * 1024 };
+
+/* Minimum distance between the points where decompression can start
+   in a seekable archive.  */
+enum { CODEC_SEEK_SPACING = 256 * 1024 };
+
+/* An archive member boundary in a seekable archive.  */
+struct codec_mark
+{
+  off_t offset;                 /* offset in the uncompressed archive */
+  off_t coffset;                /* offset of the compressed data that
+				   start there, or -1 if none */
+};
+
+/* Size of an index entry, and the maximum number of entries in an
+   index gzip member.  */
+enum { INDEX_ENTRY_SIZE = 16, INDEX_GZIP_ENTRIES = 4095 };
+
+/* Size of the index locator in gzip and zstd archives.  */
+enum { LOCATOR_GZIP_SIZE = 42, LOCATOR_ZSTD_SIZE = 26 };
+
+/* Magic number of the zstd skippable frames holding the index.  */
+#define INDEX_ZSTD_MAGIC 0x184D2A5E
+
+/* A chunk of the archive compressed by a worker thread.  */
+struct codec_job
+{
+  char *input;                  /* uncompressed data */
+  size_t input_size;            /* bytes in input */
+  char *output;                 /* compressed gzip member */
+  size_t output_size;           /* bytes in output */
+  int errnum;                   /* errno if compression failed */
+  bool done;                    /* compression is finished */
+  size_t mark;                  /* index of the member boundary at
+				   which the job starts, or SIZE_MAX */
+};
+
+/* Worker threads compressing chunks in parallel.  The jobs form a ring
+   in archive order: the writer fills the job following the COUNT
+   submitted ones, and writes out the one at HEAD once it is done.  */
+struct codec_pool
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t *threads;
+  int nthreads;
+  struct codec_job *jobs;
+  size_t njobs;
+  size_t output_max;            /* size of the output buffer of a job */
+  size_t head;                  /* oldest job not yet written */
+  size_t count;                 /* jobs submitted and not yet written */
+  size_t pick;                  /* next job for a worker to compress */
+  size_t pending;               /* jobs submitted and not yet picked */
+  bool stop;                    /* workers should exit */
+};
+
+struct codec
+{
+  enum codec_type type;
+  enum access_mode mode;
+  int fd;                       /* archive to write to */
+  bool pad;                     /* pad the last record with zeros */
+  size_t (*reader) (char *, size_t); /* read compressed data */
+  char *buffer;                 /* compressed data, record_size bytes */
+  size_t avail;                 /* bytes available in buffer */
+  char const *next;             /* next byte to decode */
+  bool eof;                     /* end of compressed input */
+  bool end;                     /* end of compressed stream */
+  bool member;                  /* a gzip member or zstd frame was
+				   decoded */
+  struct codec_pool *pool;      /* parallel gzip compression, or NULL */
+
+  /* Seekable archives */
+  bool seekable;                /* write an index */
+  off_t (*seeker) (off_t, int); /* reposition the compressed input */
+  off_t written;                /* compressed bytes written */
+  off_t in_offset;              /* uncompressed bytes compressed */
+  off_t member_offset;          /* where the current member started
+				   (with a pool, the last one at a
+				   member boundary) */
+  pthread_mutex_t mark_lock;    /* protects the members below */
+  struct codec_mark *marks;     /* member boundaries, or index entries
+				   when reading */
+  size_t nmarks;                /* number of marks */
+  size_t marks_alloc;           /* allocated size of marks */
+  size_t mark_next;             /* next mark to reach when writing */
+  off_t offset;                 /* uncompressed bytes read */
+  char *scratch;                /* data skipped when seeking */
+  union
+  {
+#ifdef HAVE_ZLIB
+    z_stream z;
+#endif
+#ifdef HAVE_LZMA
+    lzma_stream lzma;
+#endif
+#ifdef HAVE_ZSTD
+    struct
+    {
+      ZSTD_CCtx *cctx;
+      ZSTD_DCtx *dctx;
+      size_t ret;               /* last return of ZSTD_decompressStream */
+    } zstd;
+#endif
+    char dummy;
+  } u;
+};
+
+/* Return the built-in codec that can replace PROGRAM, if any.  */
+static enum codec_type
+codec_type (char const *program)
+{
+  if (!program)
+    return codec_none;
+#ifdef HAVE_ZLIB
+  if (strcmp (program, GZIP_PROGRAM) == 0)
+    return codec_gzip;
+#endif
+#ifdef HAVE_LZMA
+  if (strcmp (program, XZ_PROGRAM) == 0)
+    return codec_xz;
+#endif
+#ifdef HAVE_ZSTD
+  if (strcmp (program, ZSTD_PROGRAM) == 0)
+    return codec_zstd;
+#endif
+  return codec_none;
+}
+
+/* Return true if PROGRAM can be replaced with a built-in codec when
+   accessing the archive in MODE.  The environment variables that
+   change the default compression settings of the programs are not
+   honored by the codecs, so the programs are run if any is set.  */
+bool
+codec_available (char const *program, enum access_mode mode)
+{
+  switch (codec_type (program))
+    {
+    case codec_none:
+      return false;
+
+    case codec_gzip:
+      return mode == ACCESS_READ || !getenv ("GZIP");
+
+    case codec_xz:
+      return mode == ACCESS_READ
+	     || ! (getenv ("XZ_OPT") || getenv ("XZ_DEFAULTS"));
+
+    case codec_zstd:
+      return mode == ACCESS_READ
+	     || ! (getenv ("ZSTD_CLEVEL") || getenv ("ZSTD_NBTHREADS"));
+    }
+  return false;
+}
+
+#ifdef HAVE_ZLIB
+/* Initialize Z for compressing a gzip member the way gzip does by
+   default.  Window bits 15 + 16 select the gzip format.  */
+static int
+gzip_deflate_init (z_stream *z)
+{
+  return deflateInit2 (z, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+}
+
+/* Compress the chunks submitted to the pool ARG into gzip members.  */
+static void *
+codec_pool_loop (void *arg)
+{
+  struct codec_pool *pool = arg;
+  z_stream z = { 0 };
+  bool initialized = gzip_deflate_init (&z) == Z_OK;
+
+  pthread_mutex_lock (&pool->lock);
+  for (;;)
+    {
+      struct codec_job *job;
+
+      while (pool->pending == 0 && !pool->stop)
+	pthread_cond_wait (&pool->cond, &pool->lock);
+      if (pool->pending == 0)
+	break;
+      job = &pool->jobs[pool->pick];
+      pool->pick = (pool->pick + 1) % pool->njobs;
+      pool->pending--;
+      pthread_mutex_unlock (&pool->lock);
+
+      job->errnum = 0;
+      if (! (initialized && deflateReset (&z) == Z_OK))
+	job->errnum = ENOMEM;
+      else
+	{
+	  z.next_in = (Bytef *) job->input;
+	  z.avail_in = job->input_size;
+	  z.next_out = (Bytef *) job->output;
+	  z.avail_out = pool->output_max;
+	  if (deflate (&z, Z_FINISH) == Z_STREAM_END)
+	    job->output_size = pool->output_max - z.avail_out;
+	  else
+	    job->errnum = EINVAL;
+	}
+
+      pthread_mutex_lock (&pool->lock);
+      job->done = true;
+      pthread_cond_broadcast (&pool->cond);
+    }
+  pthread_mutex_unlock (&pool->lock);
+
+  if (initialized)
+    deflateEnd (&z);
+  return NULL;
+}
+
+/* Start NTHREADS threads compressing gzip members in parallel.  Return
+   the new pool, or NULL if no thread could be started.  */
+static struct codec_pool *
+codec_pool_start (int nthreads)
+{
+  struct codec_pool *pool = xzalloc (sizeof *pool);
+  z_stream z = { 0 };
+  size_t i;
+
+  if (gzip_deflate_init (&z) != Z_OK)
+    xalloc_die ();
+  pool->output_max = deflateBound (&z, CODEC_CHUNK_SIZE);
+  deflateEnd (&z);
+
+  /* Two jobs per thread keep the workers busy while the oldest job is
+     being written out.  */
+  pool->njobs = 2 * (size_t) nthreads;
+  pool->jobs = xcalloc (pool->njobs, sizeof *pool->jobs);
+  for (i = 0; i < pool->njobs; i++)
+    {
+      pool->jobs[i].input = xmalloc (CODEC_CHUNK_SIZE);
+      pool->jobs[i].output = xmalloc (pool->output_max);
+      pool->jobs[i].mark = SIZE_MAX;
+    }
+
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->cond, NULL);
+  pool->threads = xnmalloc (nthreads, sizeof *pool->threads);
+  for (pool->nthreads = 0; pool->nthreads < nthreads; pool->nthreads++)
+    if (pthread_create (&pool->threads[pool->nthreads], NULL,
+			codec_pool_loop, pool) != 0)
+      break;
+
+  if (pool->nthreads == 0)
+    {
+      for (i = 0; i < pool->njobs; i++)
+	{
+	  free (pool->jobs[i].input);
+	  free (pool->jobs[i].output);
+	}
+      free (pool->jobs);
+      free (pool->threads);
+      pthread_mutex_destroy (&pool->lock);
+      pthread_cond_destroy (&pool->cond);
+      free (pool);
+      return NULL;
+    }
+  return pool;
+}
+
+/* Stop the threads of POOL and free it.  */
+static void
+codec_pool_free (struct codec_pool *pool)
+{
+  size_t i;
+  int t;
+
+  pthread_mutex_lock (&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast (&pool->cond);
+  pthread_mutex_unlock (&pool->lock);
+  for (t = 0; t < pool->nthreads; t++)
+    pthread_join (pool->threads[t], NULL);
+
+  for (i = 0; i < pool->njobs; i++)
+    {
+      free (pool->jobs[i].input);
+      free (pool->jobs[i].output);
+    }
+  free (pool->jobs);
+  free (pool->threads);
+  pthread_mutex_destroy (&pool->lock);
+  pthread_cond_destroy (&pool->cond);
+  free (pool);
+}
+#endif
+
+static void codec_load_index (struct codec *codec);
+
+/* Create a codec replacing PROGRAM for accessing the archive in MODE.
+   Compressed data are written to FD, padding the last record with
+   zeros if PAD is true, or read by calling READER, which behaves like
+   rmtread.  If SEEKER is not null, it repositions the input like
+   rmtlseek, and the index of a seekable archive is loaded.  */
+struct codec *
+codec_open (char const *program, enum access_mode mode, int fd, bool pad,
+	    size_t (*reader) (char *, size_t),
+	    off_t (*seeker) (off_t, int))
+{
+  struct codec *codec = xzalloc (sizeof *codec);
+  bool ok = false;
+
+  codec->type = codec_type (program);
+  codec->mode = mode;
+  codec->fd = fd;
+  codec->pad = pad;
+  codec->reader = reader;
+  codec->seeker = seeker;
+  codec->buffer = xmalloc (record_size);
+  codec->seekable = (mode == ACCESS_WRITE && seekable_compression_option
+		     && (codec->type == codec_gzip
+			 || codec->type == codec_zstd));
+  pthread_mutex_init (&codec->mark_lock, NULL);
+
+  switch (codec->type)
+    {
+    case codec_none:
+      break;
+
+#ifdef HAVE_ZLIB
+    case codec_gzip:
+      if (mode == ACCESS_WRITE && compress_threads_option > 1)
+	codec->pool = codec_pool_start (compress_threads_option);
+      ok = (mode == ACCESS_WRITE
+	    ? gzip_deflate_init (&codec->u.z)
+	    : inflateInit2 (&codec->u.z, 15 + 16)) == Z_OK;
+      break;
+#endif
+
+#ifdef HAVE_LZMA
+    case codec_xz:
+      if (mode == ACCESS_WRITE && compress_threads_option > 1)
+	{
+	  lzma_mt mt = { .threads = compress_threads_option,
+			 .preset = LZMA_PRESET_DEFAULT,
+			 .check = LZMA_CHECK_CRC64 };
+	  ok = lzma_stream_encoder_mt (&codec->u.lzma, &mt) == LZMA_OK;
+	}
+      /* If liblzma was built without threads, compress in one.  */
+      if (!ok)
+	ok = (mode == ACCESS_WRITE
+	      ? lzma_easy_encoder (&codec->u.lzma, LZMA_PRESET_DEFAULT,
+				   LZMA_CHECK_CRC64)
+	      : lzma_stream_decoder (&codec->u.lzma, UINT64_MAX,
+				     LZMA_CONCATENATED)) == LZMA_OK;
+      break;
+#endif
+
+#ifdef HAVE_ZSTD
+    case codec_zstd:
+      if (mode == ACCESS_WRITE)
+	{
+	  codec->u.zstd.cctx = ZSTD_createCCtx ();
+	  ok = (codec->u.zstd.cctx
+		&& !ZSTD_isError (ZSTD_CCtx_setParameter
+				  (codec->u.zstd.cctx,
+				   ZSTD_c_compressionLevel,
+				   ZSTD_CLEVEL_DEFAULT))
+		&& !ZSTD_isError (ZSTD_CCtx_setParameter
+				  (codec->u.zstd.cctx,
+				   ZSTD_c_checksumFlag, 1)));
+	  /* This fails harmlessly if libzstd was built without
+	     threads.  */
+	  if (ok && compress_threads_option > 1)
+	    ZSTD_CCtx_setParameter (codec->u.zstd.cctx, ZSTD_c_nbWorkers,
+				    compress_threads_option);
+	}
+      else
+	{
+	  codec->u.zstd.dctx = ZSTD_createDCtx ();
+	  ok = codec->u.zstd.dctx != NULL;
+	}
+      break;
+#endif
+
+    default:
+      break;
+    }
+
+  if (!ok)
+    xalloc_die ();
+  if (seeker && (codec->type == codec_gzip || codec->type == codec_zstd))
+    codec_load_index (codec);
+  return codec;
+}
+
+/* Write the compressed data accumulated in CODEC's buffer, padding it
+   to a full record if LAST and CODEC->pad.  Return true if successful,
+   false with errno set otherwise.  */
+static bool
+codec_flush (struct codec *codec, bool last)
+{
+  size_t size = codec->avail;
+
+  if (last && codec->pad && size)
+    {
+      memset (codec->buffer + size, 0, record_size - size);
+      size = record_size;
+    }
+  codec->avail = 0;
+  if (size && rmtwrite (codec->fd, codec->buffer, size) != size)
+    {
+      if (errno == 0)
+	errno = ENOSPC;
+      return false;
+    }
+  codec->written += size;
+  return true;
+}
+
+/* Append SIZE bytes of compressed data at DATA to CODEC's buffer,
+   writing it out whenever it holds a full record.  Return true if
+   successful, false with errno set otherwise.  */
+static bool
+codec_output (struct codec *codec, char const *data, size_t size)
+{
+  while (size)
+    {
+      size_t n = min (size, record_size - codec->avail);
+      memcpy (codec->buffer + codec->avail, data, n);
+      codec->avail += n;
+      data += n;
+      size -= n;
+      if (codec->avail == record_size && !codec_flush (codec, false))
+	return false;
+    }
+  return true;
+}
+
+/* Note that an archive member starts at OFFSET in the uncompressed
+   archive being written.  */
+void
+codec_mark (struct codec *codec, off_t offset)
+{
+  if (!codec->seekable)
+    return;
+  pthread_mutex_lock (&codec->mark_lock);
+  if (codec->nmarks == codec->marks_alloc)
+    codec->marks = x2nrealloc (codec->marks, &codec->marks_alloc,
+			       sizeof *codec->marks);
+  codec->marks[codec->nmarks].offset = offset;
+  codec->marks[codec->nmarks].coffset = -1;
+  codec->nmarks++;
+  pthread_mutex_unlock (&codec->mark_lock);
+}
+
+/* Return the offset of the next member boundary that the compressor
+   has not passed, or -1 if there is none.  */
+static off_t
+codec_next_mark (struct codec *codec)
+{
+  off_t offset = -1;
+
+  if (codec->seekable)
+    {
+      pthread_mutex_lock (&codec->mark_lock);
+      if (codec->mark_next < codec->nmarks)
+	offset = codec->marks[codec->mark_next].offset;
+      pthread_mutex_unlock (&codec->mark_lock);
+    }
+  return offset;
+}
+
+/* Pass the next member boundary, the compressed data for which start
+   at COFFSET (-1 if unknown).  Return its index.  */
+static size_t
+codec_pass_mark (struct codec *codec, off_t coffset)
+{
+  size_t mark;
+
+  pthread_mutex_lock (&codec->mark_lock);
+  mark = codec->mark_next++;
+  codec->marks[mark].coffset = coffset;
+  pthread_mutex_unlock (&codec->mark_lock);
+  return mark;
+}
+
+/* Set the start of the compressed data for the member boundary MARK to
+   COFFSET.  */
+static void
+codec_set_mark (struct codec *codec, size_t mark, off_t coffset)
+{
+  pthread_mutex_lock (&codec->mark_lock);
+  codec->marks[mark].coffset = coffset;
+  pthread_mutex_unlock (&codec->mark_lock);
+}
+
+#ifdef HAVE_ZLIB
+/* Wait for the oldest job of CODEC's pool to be compressed and write
+   it out.  Return true if successful, false with errno set
+   otherwise.  */
+static bool
+codec_pool_drain (struct codec *codec)
+{
+  struct codec_pool *pool = codec->pool;
+  struct codec_job *job = &pool->jobs[pool->head];
+
+  pthread_mutex_lock (&pool->lock);
+  while (!job->done)
+    pthread_cond_wait (&pool->cond, &pool->lock);
+  pthread_mutex_unlock (&pool->lock);
+
+  if (job->errnum)
+    {
+      errno = job->errnum;
+      return false;
+    }
+  if (job->mark != SIZE_MAX)
+    codec_set_mark (codec, job->mark, codec->written + codec->avail);
+  if (!codec_output (codec, job->output, job->output_size))
+    return false;
+
+  job->done = false;
+  job->input_size = 0;
+  job->mark = SIZE_MAX;
+  pool->head = (pool->head + 1) % pool->njobs;
+  pool->count--;
+  return true;
+}
+
+/* Hand the job being filled over to the workers of POOL.  */
+static void
+codec_pool_submit (struct codec_pool *pool)
+{
+  pthread_mutex_lock (&pool->lock);
+  pool->pending++;
+  pthread_cond_broadcast (&pool->cond);
+  pthread_mutex_unlock (&pool->lock);
+  pool->count++;
+}
+
+/* Compress SIZE bytes at BUF in parallel, or compress and write out
+   all pending data if BUF is null.  Return true if successful, false
+   with errno set otherwise.  */
+static bool
+codec_pool_encode (struct codec *codec, char const *buf, size_t size)
+{
+  struct codec_pool *pool = codec->pool;
+
+  for (;;)
+    {
+      struct codec_job *job
+	= &pool->jobs[(pool->head + pool->count) % pool->njobs];
+      off_t mark = codec_next_mark (codec);
+      bool submit;
+
+      if (!buf)
+	{
+	  if (job->input_size == 0)
+	    {
+	      while (pool->count)
+		if (!codec_pool_drain (codec))
+		  return false;
+	      return true;
+	    }
+	  submit = true;
+	}
+      else if (0 <= mark && mark <= codec->in_offset)
+	{
+	  /* Cut the chunk at the member boundary unless the last one
+	     where decompression can start is still close.  */
+	  submit = (job->input_size != 0
+		    && (CODEC_SEEK_SPACING
+			<= codec->in_offset - codec->member_offset));
+	  if (!submit)
+	    {
+	      size_t m = codec_pass_mark (codec, -1);
+	      if (job->input_size == 0)
+		{
+		  job->mark = m;
+		  codec->member_offset = codec->in_offset;
+		}
+	    }
+	}
+      else if (size == 0)
+	return true;
+      else
+	{
+	  size_t n = min (size, CODEC_CHUNK_SIZE - job->input_size);
+	  if (0 <= mark && mark - codec->in_offset < n)
+	    n = mark - codec->in_offset;
+	  memcpy (job->input + job->input_size, buf, n);
+	  job->input_size += n;
+	  codec->in_offset += n;
+	  buf += n;
+	  size -= n;
+	  submit = job->input_size == CODEC_CHUNK_SIZE;
+	}
+
+      if (submit)
+	{
+	  codec_pool_submit (pool);
+	  if (pool->count == pool->njobs && !codec_pool_drain (codec))
+	    return false;
+	}
+    }
+}
+#endif
+
+/* Compress SIZE bytes at BUF into CODEC's buffer, writing out full
+   records.  If FINISH, end the gzip member, zstd frame or xz stream
+   after them.  Return true if successful, false with errno set
+   otherwise.  */
+static bool
+codec_compress (struct codec *codec, char const *buf, size_t size,
+		bool finish)
+{
+  for (;;)
+    {
+      bool done;
+
+      switch (codec->type)
+	{
+#ifdef HAVE_ZLIB
+	case codec_gzip:
+	  {
+	    z_stream *z = &codec->u.z;
+	    int ret;
+	    z->next_in = (Bytef *) buf;
+	    z->avail_in = size;
+	    z->next_out = (Bytef *) codec->buffer + codec->avail;
+	    z->avail_out = record_size - codec->avail;
+	    ret = deflate (z, finish ? Z_FINISH : Z_NO_FLUSH);
+	    if (ret == Z_STREAM_ERROR)
+	      {
+		errno = EINVAL;
+		return false;
+	      }
+	    buf = (char const *) z->next_in;
+	    size = z->avail_in;
+	    codec->avail = record_size - z->avail_out;
+	    done = finish ? ret == Z_STREAM_END : size == 0;
+	  }
+	  break;
+#endif
+
+#ifdef HAVE_LZMA
+	case codec_xz:
+	  {
+	    lzma_stream *lz = &codec->u.lzma;
+	    lzma_ret ret;
+	    lz->next_in = (uint8_t const *) buf;
+	    lz->avail_in = size;
+	    lz->next_out = (uint8_t *) codec->buffer + codec->avail;
+	    lz->avail_out = record_size - codec->avail;
+	    ret = lzma_code (lz, finish ? LZMA_FINISH : LZMA_RUN);
+	    if (ret != LZMA_OK && ret != LZMA_STREAM_END)
+	      {
+		errno = ret == LZMA_MEM_ERROR ? ENOMEM : EINVAL;
+		return false;
+	      }
+	    buf = (char const *) lz->next_in;
+	    size = lz->avail_in;
+	    codec->avail = record_size - lz->avail_out;
+	    done = finish ? ret == LZMA_STREAM_END : size == 0;
+	  }
+	  break;
+#endif
+
+#ifdef HAVE_ZSTD
+	case codec_zstd:
+	  {
+	    ZSTD_inBuffer in = { buf, size, 0 };
+	    ZSTD_outBuffer out = { codec->buffer, record_size, codec->avail };
+	    size_t ret = ZSTD_compressStream2 (codec->u.zstd.cctx, &out, &in,
+					       finish ? ZSTD_e_end
+					       : ZSTD_e_continue);
+	    if (ZSTD_isError (ret))
+	      {
+		errno = (ZSTD_getErrorCode (ret) == ZSTD_error_memory_allocation
+			 ? ENOMEM : EINVAL);
+		return false;
+	      }
+	    buf += in.pos;
+	    size -= in.pos;
+	    codec->avail = out.pos;
+	    done = finish ? ret == 0 : size == 0;
+	  }
+	  break;
+#endif
+
+	default:
+	  abort ();
+	}
+
+      if (done)
+	return true;
+      if (codec->avail == record_size && !codec_flush (codec, false))
+	return false;
+    }
+}
+
+/* End the gzip member or zstd frame being compressed, so that
+   decompression can start at the current input offset.  Return true
+   if successful, false with errno set otherwise.  */
+static bool
+codec_end_member (struct codec *codec)
+{
+  if (!codec_compress (codec, NULL, 0, true))
+    return false;
+#ifdef HAVE_ZLIB
+  if (codec->type == codec_gzip && deflateReset (&codec->u.z) != Z_OK)
+    {
+      errno = EINVAL;
+      return false;
+    }
+#endif
+  codec->member_offset = codec->in_offset;
+  return true;
+}
+
+/* Compress SIZE bytes at BUF, starting a new gzip member or zstd
+   frame at the member boundaries where needed.  Return true if
+   successful, false with errno set otherwise.  */
+static bool
+codec_encode (struct codec *codec, char const *buf, size_t size)
+{
+#ifdef HAVE_ZLIB
+  if (codec->pool)
+    return codec_pool_encode (codec, buf, size);
+#endif
+
+  while (size)
+    {
+      off_t mark = codec_next_mark (codec);
+      size_t n = size;
+
+      if (0 <= mark && mark <= codec->in_offset)
+	{
+	  if (CODEC_SEEK_SPACING <= codec->in_offset - codec->member_offset
+	      && !codec_end_member (codec))
+	    return false;
+	  codec_pass_mark (codec, (codec->in_offset == codec->member_offset
+				   ? codec->written + codec->avail : -1));
+	  continue;
+	}
+      if (0 <= mark && mark - codec->in_offset < n)
+	n = mark - codec->in_offset;
+      if (!codec_compress (codec, buf, n, false))
+	return false;
+      codec->in_offset += n;
+      buf += n;
+      size -= n;
+    }
+  return true;
+}
+
+/* Trailer of the empty gzip members holding the index: an empty final
+   deflate block, and the CRC and size of no data.  */
+static char const index_gzip_trailer[10] = { 3, 0 };
+
+static void
+put_le (char *p, uintmax_t v, int size)
+{
+  for (int i = 0; i < size; i++, v >>= 8)
+    p[i] = v & 0xff;
+}
+
+static uintmax_t
+get_le (char const *p, int size)
+{
+  uintmax_t v = 0;
+  for (int i = size; 0 < i; i--)
+    v = v << 8 | (unsigned char) p[i - 1];
+  return v;
+}
+
+static void
+put_be64 (char *p, uintmax_t v)
+{
+  for (int i = 7; 0 <= i; i--, v >>= 8)
+    p[i] = v & 0xff;
+}
+
+static uintmax_t
+get_be64 (char const *p)
+{
+  uintmax_t v = 0;
+  for (int i = 0; i < 8; i++)
+    v = v << 8 | (unsigned char) p[i];
+  return v;
+}
+
+/* Append an index frame with the ID "T" ID holding the LEN bytes at
+   DATA.  Return true if successful, false with errno set otherwise.  */
+static bool
+codec_put_index_frame (struct codec *codec, char id, char const *data,
+		       size_t len)
+{
+  char head[16];
+  size_t hlen;
+
+  if (codec->type == codec_gzip)
+    {
+      /* A gzip header with no mtime and an extra field (FLG.FEXTRA).  */
+      memcpy (head, "\x1f\x8b\x08\x04\0\0\0\0\0\x03", 10);
+      put_le (head + 10, len + 4, 2);
+      head[12] = 'T';
+      head[13] = id;
+      put_le (head + 14, len, 2);
+      hlen = 16;
+    }
+  else
+    {
+      put_le (head, INDEX_ZSTD_MAGIC, 4);
+      put_le (head + 4, len + 2, 4);
+      head[8] = 'T';
+      head[9] = id;
+      hlen = 10;
+    }
+  return (codec_output (codec, head, hlen)
+	  && codec_output (codec, data, len)
+	  && (codec->type != codec_gzip
+	      || codec_output (codec, index_gzip_trailer,
+			       sizeof index_gzip_trailer)));
+}
+
+/* Append the index of the member boundaries at which compressed data
+   start, and its locator.  Return true if successful, false with errno
+   set otherwise.  */
+static bool
+codec_write_index (struct codec *codec)
+{
+  off_t index_offset = codec->written + codec->avail;
+  char *data = xmalloc (INDEX_GZIP_ENTRIES * INDEX_ENTRY_SIZE);
+  char locator[16];
+  uintmax_t count = 0;
+  size_t n = 0;
+  bool ok = true;
+
+  for (size_t i = 0; ok && i < codec->nmarks; i++)
+    if (0 <= codec->marks[i].coffset)
+      {
+	put_be64 (data + n * INDEX_ENTRY_SIZE, codec->marks[i].offset);
+	put_be64 (data + n * INDEX_ENTRY_SIZE + 8, codec->marks[i].coffset);
+	count++;
+	if (++n == INDEX_GZIP_ENTRIES)
+	  {
+	    ok = codec_put_index_frame (codec, 'I', data,
+					n * INDEX_ENTRY_SIZE);
+	    n = 0;
+	  }
+      }
+  if (ok && n)
+    ok = codec_put_index_frame (codec, 'I', data, n * INDEX_ENTRY_SIZE);
+  free (data);
+
+  put_be64 (locator, index_offset);
+  put_be64 (locator + 8, count);
+  return ok && codec_put_index_frame (codec, 'L', locator, sizeof locator);
+}
+
+/* Finish the compressed stream and write out all pending data.  Return
+   true if successful, false with errno set otherwise.  */
+static bool
+codec_finish (struct codec *codec)
+{
+  bool ok;
+
+#ifdef HAVE_ZLIB
+  if (codec->pool)
+    ok = codec_pool_encode (codec, NULL, 0);
+  else
+#endif
+    ok = codec_compress (codec, NULL, 0, true);
+
+  return (ok
+	  && (!codec->seekable || codec_write_index (codec))
+	  && codec_flush (codec, true));
+}
+
+/* Compress SIZE bytes at BUF and write the result to the archive.
+   Return SIZE if successful, 0 with errno set otherwise.  */
+size_t
+codec_write (struct codec *codec, char const *buf, size_t size)
+{
+  return codec_encode (codec, buf, size) ? size : 0;
+}
+
+/* Report that the compressed archive cannot be decoded.  */
+static void
+codec_error (char const *message)
+{
+  FATAL_ERROR ((0, 0, _("%s: Cannot decompress archive: %s"),
+		quotearg_colon (*archive_name_cursor), message));
+}
+
+/* Make compressed data available in CODEC's buffer.  Return false at
+   end of input, or on read error with *STATUS set to SAFE_READ_ERROR
+   and errno set.  */
+static bool
+codec_fill (struct codec *codec, size_t *status)
+{
+  size_t n;
+
+  if (codec->avail)
+    return true;
+  if (codec->eof)
+    return false;
+  n = codec->reader (codec->buffer, record_size);
+  if (n == SAFE_READ_ERROR)
+    {
+      *status = n;
+      return false;
+    }
+  if (n == 0)
+    codec->eof = true;
+  codec->next = codec->buffer;
+  codec->avail = n;
+  return n != 0;
+}
+
+/* Read and decompress at most SIZE bytes from the archive into BUF.
+   Return the number of bytes stored, 0 at end of the compressed
+   stream, or SAFE_READ_ERROR on read error.  */
+size_t
+codec_read (struct codec *codec, char *buf, size_t size)
+{
+  size_t status = 0;
+
+  while (!codec->end && status == 0)
+    {
+      bool more = codec_fill (codec, &status);
+      size_t used;
+
+      if (status == SAFE_READ_ERROR)
+	return status;
+
+      switch (codec->type)
+	{
+#ifdef HAVE_ZLIB
+	case codec_gzip:
+	  {
+	    z_stream *z = &codec->u.z;
+	    int ret;
+	    if (!more)
+	      {
+		if (z->total_in != 0)
+		  codec_error (_("Unexpected end of compressed data"));
+		codec->end = true;
+		break;
+	      }
+	    z->next_in = (Bytef *) codec->next;
+	    z->avail_in = codec->avail;
+	    z->next_out = (Bytef *) buf;
+	    z->avail_out = size;
+	    ret = inflate (z, Z_NO_FLUSH);
+	    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+	      {
+		/* As with gzip -d, garbage following the last member is
+		   ignored.  */
+		if (codec->u.z.total_out == 0 && codec->member)
+		  {
+		    codec->end = true;
+		    break;
+		  }
+		codec_error (z->msg ? z->msg : _("Invalid compressed data"));
+	      }
+	    used = codec->avail - z->avail_in;
+	    codec->next += used;
+	    codec->avail -= used;
+	    status = size - z->avail_out;
+	    /* Concatenated members are decoded as one stream.  */
+	    if (ret == Z_STREAM_END)
+	      {
+		codec->member = true;
+		if (inflateReset (z) != Z_OK)
+		  codec_error (_("Invalid compressed data"));
+	      }
+	  }
+	  break;
+#endif
+
+#ifdef HAVE_LZMA
+	case codec_xz:
+	  {
+	    lzma_stream *lz = &codec->u.lzma;
+	    lzma_ret ret;
+	    lz->next_in = (uint8_t const *) codec->next;
+	    lz->avail_in = codec->avail;
+	    lz->next_out = (uint8_t *) buf;
+	    lz->avail_out = size;
+	    ret = lzma_code (lz, more ? LZMA_RUN : LZMA_FINISH);
+	    used = codec->avail - lz->avail_in;
+	    codec->next += used;
+	    codec->avail -= used;
+	    status = size - lz->avail_out;
+	    switch (ret)
+	      {
+	      case LZMA_OK:
+		break;
+
+	      case LZMA_STREAM_END:
+		codec->end = true;
+		break;
+
+	      case LZMA_MEM_ERROR:
+		xalloc_die ();
+
+	      case LZMA_BUF_ERROR:
+		codec_error (_("Unexpected end of compressed data"));
+
+	      default:
+		codec_error (_("Invalid compressed data"));
+	      }
+	  }
+	  break;
+#endif
+
+#ifdef HAVE_ZSTD
+	case codec_zstd:
+	  {
+	    ZSTD_inBuffer in = { codec->next, codec->avail, 0 };
+	    ZSTD_outBuffer out = { buf, size, 0 };
+	    size_t ret;
+	    if (!more)
+	      {
+		if (codec->u.zstd.ret != 0)
+		  codec_error (_("Unexpected end of compressed data"));
+		codec->end = true;
+		break;
+	      }
+	    /* As with zstd -d, the zeros padding the last record after
+	       the last frame are ignored.  */
+	    if (codec->member && codec->u.zstd.ret == 0 && !*codec->next)
+	      {
+		codec->end = true;
+		break;
+	      }
+	    ret = ZSTD_decompressStream (codec->u.zstd.dctx, &out, &in);
+	    if (ZSTD_isError (ret))
+	      codec_error (ZSTD_getErrorName (ret));
+	    codec->u.zstd.ret = ret;
+	    if (ret == 0)
+	      codec->member = true;
+	    codec->next += in.pos;
+	    codec->avail -= in.pos;
+	    status = out.pos;
+	  }
+	  break;
+#endif
+
+	default:
+	  abort ();
+	}
+    }
+  codec->offset += status;
+  return status;
+}
+
+/* Read SIZE bytes at OFFSET in the compressed archive into BUF.
+   Return true if successful.  */
+static bool
+codec_pread (struct codec *codec, char *buf, size_t size, off_t offset)
+{
+  if (codec->seeker (offset, SEEK_SET) != offset)
+    return false;
+  while (size)
+    {
+      size_t n = codec->reader (buf, size);
+      if (n == SAFE_READ_ERROR || n == 0)
+	return false;
+      buf += n;
+      size -= n;
+    }
+  return true;
+}
+
+/* Parse the index frame with the ID "T" ID at P, of at most SIZE
+   bytes.  Set *DATA and *LEN to its contents and return its size, or
+   return 0 if there is no such frame at P.  */
+static size_t
+codec_parse_index_frame (struct codec const *codec, char id,
+			 char const *p, size_t size,
+			 char const **data, size_t *len)
+{
+  if (codec->type == codec_gzip)
+    {
+      size_t overhead = 16 + sizeof index_gzip_trailer;
+      if (! (overhead <= size && memcmp (p, "\x1f\x8b\x08\x04", 4) == 0
+	     && p[12] == 'T' && p[13] == id))
+	return 0;
+      *len = get_le (p + 14, 2);
+      if (! (get_le (p + 10, 2) == *len + 4 && *len <= size - overhead
+	     && memcmp (p + 16 + *len, index_gzip_trailer,
+			sizeof index_gzip_trailer) == 0))
+	return 0;
+      *data = p + 16;
+      return overhead + *len;
+    }
+  else
+    {
+      uintmax_t frame_len;
+      if (! (10 <= size && get_le (p, 4) == INDEX_ZSTD_MAGIC
+	     && p[8] == 'T' && p[9] == id))
+	return 0;
+      frame_len = get_le (p + 4, 4);
+      if (! (2 <= frame_len && frame_len <= size - 8))
+	return 0;
+      *data = p + 10;
+      *len = frame_len - 2;
+      return 8 + frame_len;
+    }
+}
+
+/* Load the index of a seekable archive, if any, into CODEC->marks.  */
+static void
+codec_load_index (struct codec *codec)
+{
+  size_t locator_size = (codec->type == codec_gzip
+			 ? LOCATOR_GZIP_SIZE : LOCATOR_ZSTD_SIZE);
+  char locator[LOCATOR_GZIP_SIZE];
+  char *buf = NULL;
+  char const *data;
+  size_t len, left;
+  char const *p;
+  off_t end = codec->seeker (0, SEEK_END);
+  uintmax_t index_offset, count;
+
+  if (! (locator_size <= end
+	 && codec_pread (codec, locator, locator_size, end - locator_size)
+	 && (codec_parse_index_frame (codec, 'L', locator, locator_size,
+				      &data, &len)
+	     == locator_size)
+	 && len == 16))
+    goto done;
+  end -= locator_size;
+  index_offset = get_be64 (data);
+  count = get_be64 (data + 8);
+  if (! (index_offset <= end
+	 && count <= (end - index_offset) / INDEX_ENTRY_SIZE))
+    goto done;
+
+  left = end - index_offset;
+  buf = xmalloc (left);
+  if (!codec_pread (codec, buf, left, index_offset))
+    goto done;
+  codec->marks = xnmalloc (count, sizeof *codec->marks);
+  for (p = buf; left; )
+    {
+      size_t frame_size = codec_parse_index_frame (codec, 'I', p, left,
+						   &data, &len);
+      if (frame_size == 0 || len % INDEX_ENTRY_SIZE != 0)
+	goto fail;
+      for (size_t i = 0; i < len; i += INDEX_ENTRY_SIZE)
+	{
+	  uintmax_t offset = get_be64 (data + i);
+	  uintmax_t coffset = get_be64 (data + i + 8);
+	  if (! (codec->nmarks < count
+		 && offset <= TYPE_MAXIMUM (off_t) && coffset < index_offset
+		 && (codec->nmarks == 0
+		     || (codec->marks[codec->nmarks - 1].offset < offset
+			 && codec->marks[codec->nmarks - 1].coffset < coffset))))
+	    goto fail;
+	  codec->marks[codec->nmarks].offset = offset;
+	  codec->marks[codec->nmarks].coffset = coffset;
+	  codec->nmarks++;
+	}
+      p += frame_size;
+      left -= frame_size;
+    }
+  if (codec->nmarks == count)
+    {
+      codec->scratch = xmalloc (record_size);
+      goto done;
+    }
+
+ fail:
+  codec->nmarks = 0;
+ done:
+  free (buf);
+  codec->seeker (0, SEEK_SET);
+}
+
+/* Return true if the archive being read has an index, which allows
+   seeking in it.  */
+bool
+codec_seekable (struct codec const *codec)
+{
+  return codec->mode == ACCESS_READ && codec->nmarks != 0;
+}
+
+/* Skip SIZE bytes of the uncompressed archive, jumping over the
+   compressed data in between if the index allows.  Return the offset
+   reached in the uncompressed archive, which is the current one if
+   the index does not help.  */
+off_t
+codec_seek (struct codec *codec, off_t size)
+{
+  off_t target = codec->offset + size;
+  size_t lo = 0, hi = codec->nmarks;
+  struct codec_mark const *mark;
+
+  /* Find the last index entry at or before TARGET.  */
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (codec->marks[mid].offset <= target)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  if (lo == 0 || codec->marks[lo - 1].offset <= codec->offset)
+    return codec->offset;
+  mark = &codec->marks[lo - 1];
+
+  if (codec->seeker (mark->coffset, SEEK_SET) != mark->coffset)
+    {
+      seek_error_details (*archive_name_cursor, mark->coffset);
+      fatal_exit ();
+    }
+  codec->avail = 0;
+  codec->eof = codec->end = false;
+  switch (codec->type)
+    {
+#ifdef HAVE_ZLIB
+    case codec_gzip:
+      if (inflateReset (&codec->u.z) != Z_OK)
+	codec_error (_("Invalid compressed data"));
+      break;
+#endif
+
+#ifdef HAVE_ZSTD
+    case codec_zstd:
+      ZSTD_DCtx_reset (codec->u.zstd.dctx, ZSTD_reset_session_only);
+      codec->u.zstd.ret = 0;
+      break;
+#endif
+
+    default:
+      abort ();
+    }
+  codec->offset = mark->offset;
+
+  /* Decompress the data between the entry and TARGET.  */
+  while (codec->offset < target)
+    {
+      size_t n = codec_read (codec, codec->scratch,
+			     min (record_size, target - codec->offset));
+      if (n == SAFE_READ_ERROR)
+	read_fatal (*archive_name_cursor);
+      if (n == 0)
+	codec_error (_("Unexpected end of compressed data"));
+    }
+  return codec->offset;
+}
+
+/* Finish the compressed stream, if writing, and free CODEC.  Return
+   true if successful, false with errno set otherwise.  */
+bool
+codec_close (struct codec *codec)
+{
+  bool ok = codec->mode != ACCESS_WRITE || codec_finish (codec);
+  int e = errno;
+
+  switch (codec->type)
+    {
+#ifdef HAVE_ZLIB
+    case codec_gzip:
+      if (codec->pool)
+	codec_pool_free (codec->pool);
+      if (codec->mode == ACCESS_WRITE)
+	deflateEnd (&codec->u.z);
+      else
+	inflateEnd (&codec->u.z);
+      break;
+#endif
+
+#ifdef HAVE_LZMA
+    case codec_xz:
+      lzma_end (&codec->u.lzma);
+      break;
+#endif
+
+#ifdef HAVE_ZSTD
+    case codec_zstd:
+      ZSTD_freeCCtx (codec->u.zstd.cctx);
+      ZSTD_freeDCtx (codec->u.zstd.dctx);
+      break;
+#endif
+
+    default:
+      break;
+    }
+
+  pthread_mutex_destroy (&codec->mark_lock);
+  free (codec->marks);
+  free (codec->scratch);
+  free (codec->buffer);
+  free (codec);
+  errno = e;
+  return ok;
+}
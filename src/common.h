@@ -143,11 +143,23 @@ GLOBAL unsigned checkpoint_option;
 /* Specified name of compression program, or "gzip" as implied by -z.  */
 GLOBAL const char *use_compress_program_option;
 
+/* Compress and decompress with a built-in codec instead of running the
+   compression program, when possible.  */
+GLOBAL bool builtin_compression_option;
+
+/* Number of threads compressing the archive with a built-in codec, or
+   0 to compress it in the thread writing the archive.  */
+GLOBAL int compress_threads_option;
+
+/* Make compressed archives seekable, by restarting compression at
+   member boundaries and appending an index.  */
+GLOBAL bool seekable_compression_option;
+
 GLOBAL bool dereference_option;
 GLOBAL bool hard_dereference_option;
 
 /* Patterns that match file names to be excluded.  */
-GLOBAL struct exclude *excluded;
+GLOBAL struct exclmatch *excluded;
 
 enum exclusion_tag_type
   {
@@ -200,6 +212,9 @@ GLOBAL bool keep_directory_symlink_option;
 GLOBAL const char *listed_incremental_option;
 /* Incremental dump level */
 GLOBAL int incremental_level;
+/* Format version of the snapshot file to write, or 0 to keep the
+   format of the snapshot read, if it is binary.  */
+GLOBAL int snapshot_format_option;
 /* Check device numbers when doing incremental dumps. */
 GLOBAL bool check_device_option;
 
@@ -374,6 +389,11 @@ GLOBAL const char **archive_name_cursor;
 /* Output index file name.  */
 GLOBAL char const *index_file_name;
 
+/* Table of contents file name (--toc-file), and whether to use it
+   when reading the archive (--use-toc).  */
+GLOBAL char const *toc_file_name;
+GLOBAL bool use_toc_option;
+
 /* Opaque structure for keeping directory meta-data */
 struct directory;
 
@@ -394,6 +414,8 @@ struct name
 				   Set with the -C option. */
     uintmax_t found_count;	/* number of times a matching file has
 				   been found */
+    size_t seqno;		/* position in the name list */
+    struct name *twin;		/* next name with the same text */
 
     /* The following members are used for incremental dumps only,
        if this struct name represents a directory;
@@ -426,6 +448,29 @@ GLOBAL bool unquote_option;
 
 GLOBAL int savedir_sort_order;
 
+/* Number of threads reading ahead files being archived, or 0 if files
+   are read only when dumped.  */
+GLOBAL int read_threads_option;
+
+/* Number of threads writing extracted files, or 0 if files are
+   written by the main thread.  */
+GLOBAL int write_threads_option;
+
+/* Number of threads reading directories ahead when archiving, or 0 if
+   directories are read only when dumped.  */
+GLOBAL int walk_threads_option;
+
+/* Batch system calls with io_uring where possible.  */
+GLOBAL bool io_uring_option;
+
+/* Number of records buffered for writing the archive asynchronously,
+   or 0 to write it synchronously.  */
+GLOBAL size_t async_write_option;
+
+/* Number of records read ahead from the archive, or 0 to read records
+   only when needed.  */
+GLOBAL size_t read_ahead_option;
+
 /* Show file or archive names after transformation.
    In particular, when creating archive in verbose mode, list member names
    as stored in the archive */
@@ -466,6 +511,7 @@ char *drop_volume_label_suffix (const char *label)
 
 size_t available_space_after (union block *pointer);
 off_t current_block_ordinal (void);
+void mark_member_start (void);
 void close_archive (void);
 void closeout_volume_number (void);
 double compute_duration (void);
@@ -483,6 +529,8 @@ void xclose (int fd);
 _Noreturn void archive_write_error (ssize_t status);
 void archive_read_error (void);
 off_t seek_archive (off_t size);
+off_t copy_archive_data (int fd, off_t size, bool *failed);
+off_t copy_to_archive (int fd, off_t size, size_t *pad, int *errnum);
 void set_start_time (void);
 
 #define TF_READ    0
@@ -522,6 +570,7 @@ void create_archive (void);
 void pad_archive (off_t size_left);
 void dump_file (struct tar_stat_info *parent, char const *name,
 		char const *fullname);
+bool archive_stores_atime (void);
 union block *start_header (struct tar_stat_info *st);
 void finish_header (struct tar_stat_info *st, union block *header,
 		    off_t block_ordinal);
@@ -531,12 +580,14 @@ union block * write_extended (bool global, struct tar_stat_info *st,
 union block *start_private_header (const char *name, size_t size, time_t t);
 void write_eot (void);
 void check_links (void);
+bool file_dumpable_p (struct stat const *st);
 int subfile_open (struct tar_stat_info const *dir, char const *file, int flags);
 void restore_parent_fd (struct tar_stat_info const *st);
 void exclusion_tag_warning (const char *dirname, const char *tagname,
 			    const char *message);
 enum exclusion_tag_type check_exclusion_tags (struct tar_stat_info const *st,
 					      const char **tag_file_name);
+enum exclusion_tag_type exclusion_tag_at (int fd);
 
 #define OFF_TO_CHARS(val, where) off_to_chars (val, where, sizeof (where))
 #define TIME_TO_CHARS(val, where) time_to_chars (val, where, sizeof (where))
@@ -558,6 +609,7 @@ void extr_init (void);
 void extract_archive (void);
 void extract_finish (void);
 bool rename_directory (char *src, char *dst);
+void check_time (char const *file_name, struct timespec t);
 
 void remove_delayed_set_stat (const char *fname);
 
@@ -737,6 +789,7 @@ extern int chdir_fd;
 int chdir_arg (char const *dir);
 void chdir_do (int dir);
 int chdir_count (void);
+void chdir_cache_stats (uintmax_t *hits, uintmax_t *reopens);
 
 void close_diag (char const *name);
 void open_diag (char const *name);
@@ -792,6 +845,7 @@ struct name *addname (char const *string, int change_dir,
 void add_starting_file (char const *file_name);
 void remname (struct name *name);
 bool name_match (const char *name);
+bool namelist_select_toc (void);
 void names_notfound (void);
 void label_notfound (void);
 void collect_and_sort_names (void);
@@ -977,6 +1031,7 @@ char *strip_compression_suffix (const char *name);
 void checkpoint_compile_action (const char *str);
 void checkpoint_finish_compile (void);
 void checkpoint_run (bool do_write);
+unsigned checkpoint_distance (void);
 void checkpoint_finish (void);
 void checkpoint_flush_actions (void);
 
@@ -1031,6 +1086,100 @@ extern int warning_option;
 void queue_deferred_unlink (const char *name, bool is_dir);
 void finish_deferred_unlinks (void);
 
+/* Module prefetch.c */
+
+struct prefetch_dir;
+struct prefetch_dir *prefetch_dir_open (struct tar_stat_info const *st);
+void prefetch_dir_add (struct prefetch_dir *dir, char const *name);
+char const *prefetch_dir_next (struct prefetch_dir *dir);
+void prefetch_dir_close (struct prefetch_dir *dir);
+char const *prefetch_file_data (struct stat const *st);
+void prefetch_finish (void);
+
+/* Module writethr.c */
+
+/* A file being extracted, open for writing, and what remains to be
+   done with it.  */
+struct write_job
+  {
+    char *file_name;          /* Name, for diagnostics; malloc'ed */
+    int fd;                   /* Descriptor, closed when done */
+    char *data;               /* Contents; malloc'ed */
+    size_t size;              /* Size of DATA */
+    bool set_times;           /* Set the times to TS */
+    struct timespec ts[2];
+    bool set_owner;           /* Set the owner to UID and GID */
+    uid_t uid;
+    gid_t gid;
+    mode_t mode;              /* Mode, and the bits of it that matter */
+    mode_t mode_mask;
+    mode_t current_mode;      /* As for struct delayed_set_stat */
+    mode_t current_mode_mask;
+  };
+
+void write_threads_submit (struct write_job const *job);
+void write_threads_finish (void);
+
+/* Module uring.c */
+
+struct uring;
+struct uring *uring_open (unsigned entries);
+void uring_close (struct uring *ring);
+void uring_write (struct uring *ring, int fd, void const *buf, unsigned size,
+		  size_t tag);
+void uring_close_fd (struct uring *ring, int fd, size_t tag);
+void uring_openat (struct uring *ring, int dirfd, char const *name, int flags,
+		   size_t tag);
+void uring_fstatat (struct uring *ring, int dirfd, char const *name,
+		    struct stat *st, int flags, size_t tag);
+int uring_wait (struct uring *ring, size_t *tag);
+
+/* Module statahead.c */
+
+struct stat_ahead_dir;
+struct stat_ahead_dir *stat_ahead_dir_open (struct tar_stat_info const *st);
+void stat_ahead_dir_add (struct stat_ahead_dir *dir, char const *name);
+char const *stat_ahead_dir_next (struct stat_ahead_dir *dir);
+void stat_ahead_dir_close (struct stat_ahead_dir *dir);
+bool stat_ahead_file (struct tar_stat_info const *parent, char const *name,
+		      struct stat *st, int *fd);
+void stat_ahead_finish (void);
+
+/* Module walker.c */
+
+struct walk_dir;
+struct walk_dir *walk_dir_open (struct tar_stat_info const *st,
+				char **entries);
+void walk_dir_expand (struct walk_dir *dir, char const *entries);
+void walk_dir_close (struct walk_dir *dir);
+void walk_finish (void);
+
+/* Module codec.c */
+
+struct codec;
+bool codec_available (char const *program, enum access_mode mode);
+struct codec *codec_open (char const *program, enum access_mode mode,
+			  int fd, bool pad,
+			  size_t (*reader) (char *, size_t),
+			  off_t (*seeker) (off_t, int));
+void codec_mark (struct codec *codec, off_t offset);
+size_t codec_write (struct codec *codec, char const *buf, size_t size);
+size_t codec_read (struct codec *codec, char *buf, size_t size);
+bool codec_seekable (struct codec const *codec);
+off_t codec_seek (struct codec *codec, off_t size);
+bool codec_close (struct codec *codec);
+
+/* Module toc.c */
+
+void toc_add (char const *name, off_t ordinal, off_t size, char type);
+void toc_set_name (char const *name);
+void toc_write (void);
+void toc_select (char const *name, int matching_flags);
+bool toc_start (void);
+bool toc_skip (void);
+void toc_check (char const *file_name);
+void toc_finish (void);
+
 /* Module exit.c */
 extern void (*fatal_exit_hook) (void);
 
@@ -1045,6 +1194,22 @@ void info_free_exclist (struct tar_stat_info *dir);
 bool excluded_name (char const *name, struct tar_stat_info *st);
 void exclude_vcs_ignores (void);
 
+/* Module exclmatch.c */
+struct exclmatch *exclmatch_new (void);
+void exclmatch_free (struct exclmatch *m);
+void exclmatch_add (struct exclmatch *m, char const *pattern, int options);
+int exclmatch_add_fp (void (*add_func) (struct exclmatch *, char const *,
+					int, void *),
+		      struct exclmatch *m, FILE *fp, int options,
+		      char line_end, void *data);
+int exclmatch_add_file (struct exclmatch *m, char const *file_name,
+			int options, char line_end);
+bool exclmatch_p (struct exclmatch *m, char const *name);
+
+/* Module blocksum.c */
+void block_sums (char const *p, int *unsigned_sum, int *signed_sum);
+bool zero_block_p (char const *buffer, size_t size);
+
 /* Module map.c */
 void owner_map_read (char const *name);
 int owner_map_translate (uid_t uid, uid_t *new_uid, char const **new_name);
@@ -101,6 +101,30 @@ check_exclusion_tags (struct tar_stat_info const *st, char const **tag_file_name
   return exclusion_tag_none;
 }
 
+/* Like check_exclusion_tags, but for the directory open on FD, and
+   without reporting the tag file name.  Unlike check_exclusion_tags,
+   this does not recover from running out of file descriptors, and it
+   may be called from any thread.  */
+enum exclusion_tag_type
+exclusion_tag_at (int fd)
+{
+  struct exclusion_tag *tag;
+
+  for (tag = exclusion_tags; tag; tag = tag->next)
+    {
+      int tagfd = openat (fd, tag->name, open_read_flags);
+      if (0 <= tagfd)
+	{
+	  bool satisfied = !tag->predicate || tag->predicate (tagfd);
+	  close (tagfd);
+	  if (satisfied)
+	    return tag->type;
+	}
+    }
+
+  return exclusion_tag_none;
+}
+
 /* Exclusion predicate to test if the named file (usually "CACHEDIR.TAG")
    contains a valid header, as described at:
 	http://www.brynosaurus.com/cachedir
@@ -473,7 +497,7 @@ string_to_chars (char const *str, char *p, size_t s)
    a) it is empty *and* world-readable, or
    b) current archive is /dev/null */
 
-static bool
+bool
 file_dumpable_p (struct stat const *st)
 {
   if (S_ISDIR (st->st_mode))
@@ -738,6 +762,21 @@ write_header_name (struct tar_stat_info *st)
 
 /* Header handling.  */
 
+/* Block ordinal of the first header of the member being written,
+   which may be a long name or extended header.  */
+static off_t member_start_ordinal;
+
+/* Return true if start_header stores the access times of the files
+   in the archive being created.  */
+bool
+archive_stores_atime (void)
+{
+  return (archive_format == POSIX_FORMAT
+	  || (incremental_option
+	      && (archive_format == OLDGNU_FORMAT
+		  || archive_format == GNU_FORMAT)));
+}
+
 /* Make a header block for the file whose stat info is st,
    and return its address.  */
 
@@ -748,6 +787,8 @@ start_header (struct tar_stat_info *st)
   char const *uname = NULL;
   char const *gname = NULL;
 
+  member_start_ordinal = current_block_ordinal ();
+  mark_member_start ();
   header = write_header_name (st);
   if (!header)
     return NULL;
@@ -1030,6 +1071,10 @@ finish_header (struct tar_stat_info *st,
       print_header (st, header, block_ordinal);
     }
 
+  if (toc_file_name && 0 <= block_ordinal)
+    toc_add (st->file_name, member_start_ordinal, st->stat.st_size,
+	     header->header.typeflag);
+
   header = write_extended (false, st, header);
   simple_finish_header (header);
 }
@@ -1048,12 +1093,31 @@ pad_archive (off_t size_left)
     }
 }
 
+/* Warn that the file ST shrank by SIZE_LEFT bytes while being
+   archived.  */
+static void
+warn_file_shrank (struct tar_stat_info const *st, off_t size_left)
+{
+  char buf[UINTMAX_STRSIZE_BOUND];
+
+  WARNOPT (WARN_FILE_SHRANK,
+	   (0, 0,
+	    ngettext ("%s: File shrank by %s byte; padding with zeros",
+		      "%s: File shrank by %s bytes; padding with zeros",
+		      size_left),
+	    quotearg_colon (st->orig_file_name),
+	    STRINGIFY_BIGINT (size_left, buf)));
+  if (! ignore_failed_read_option)
+    set_exit_status (TAREXIT_DIFFERS);
+}
+
 static enum dump_status
 dump_regular_file (int fd, struct tar_stat_info *st)
 {
   off_t size_left = st->stat.st_size;
   off_t block_ordinal;
   union block *blk;
+  char const *prefetched;
 
   block_ordinal = current_block_ordinal ();
   blk = start_header (st);
@@ -1066,11 +1130,37 @@ dump_regular_file (int fd, struct tar_stat_info *st)
 
   finish_header (st, blk, block_ordinal);
 
+  prefetched = fd <= 0 ? NULL : prefetch_file_data (&st->stat);
+
   mv_begin_write (st->file_name, st->stat.st_size, st->stat.st_size);
   while (size_left > 0)
     {
       size_t bufsize, count;
 
+      if (fd > 0 && !prefetched)
+	{
+	  /* Let the kernel copy whole records when it can.  */
+	  size_t pad;
+	  int errnum;
+
+	  size_left -= copy_to_archive (fd, size_left, &pad, &errnum);
+	  if (pad)
+	    {
+	      if (errnum)
+		{
+		  errno = errnum;
+		  read_diag_details (st->orig_file_name,
+				     st->stat.st_size - size_left, pad);
+		}
+	      else
+		warn_file_shrank (st, size_left);
+	      pad_archive (size_left - pad);
+	      return dump_status_short;
+	    }
+	  if (size_left == 0)
+	    break;
+	}
+
       blk = find_next_block ();
 
       bufsize = available_space_after (blk);
@@ -1084,7 +1174,16 @@ dump_regular_file (int fd, struct tar_stat_info *st)
 	    memset (blk->buffer + size_left, 0, BLOCKSIZE - count);
 	}
 
-      count = (fd <= 0) ? bufsize : blocking_read (fd, blk->buffer, bufsize);
+      if (fd <= 0)
+	count = bufsize;
+      else if (prefetched)
+	{
+	  memcpy (blk->buffer, prefetched, bufsize);
+	  prefetched += bufsize;
+	  count = bufsize;
+	}
+      else
+	count = blocking_read (fd, blk->buffer, bufsize);
       if (count == SAFE_READ_ERROR)
 	{
 	  read_diag_details (st->orig_file_name,
@@ -1097,17 +1196,8 @@ dump_regular_file (int fd, struct tar_stat_info *st)
 
       if (count != bufsize)
 	{
-	  char buf[UINTMAX_STRSIZE_BOUND];
 	  memset (blk->buffer + count, 0, bufsize - count);
-	  WARNOPT (WARN_FILE_SHRANK,
-		   (0, 0,
-		    ngettext ("%s: File shrank by %s byte; padding with zeros",
-			      "%s: File shrank by %s bytes; padding with zeros",
-			      size_left),
-		    quotearg_colon (st->orig_file_name),
-		    STRINGIFY_BIGINT (size_left, buf)));
-	  if (! ignore_failed_read_option)
-	    set_exit_status (TAREXIT_DIFFERS);
+	  warn_file_shrank (st, size_left);
 	  pad_archive (size_left - (bufsize - count));
 	  return dump_status_short;
 	}
@@ -1218,11 +1308,14 @@ dump_dir0 (struct tar_stat_info *st, char const *directory)
 	    char const *entry;
 	    size_t entry_len;
 	    size_t name_len;
+	    struct prefetch_dir *prefetch = prefetch_dir_open (st);
+	    struct stat_ahead_dir *stat_ahead = stat_ahead_dir_open (st);
 
 	    name_buf = xstrdup (st->orig_file_name);
 	    name_size = name_len = strlen (name_buf);
 
-	    /* Now output all the files in the directory.  */
+	    /* Now output all the files in the directory.  If reading or
+	       statting ahead, only queue them in this pass.  */
 	    for (entry = directory; (entry_len = strlen (entry)) != 0;
 		 entry += entry_len + 1)
 	      {
@@ -1233,7 +1326,29 @@ dump_dir0 (struct tar_stat_info *st, char const *directory)
 		  }
 		strcpy (name_buf + name_len, entry);
 		if (!excluded_name (name_buf, st))
-		  dump_file (st, entry, name_buf);
+		  {
+		    if (prefetch)
+		      prefetch_dir_add (prefetch, entry);
+		    if (stat_ahead)
+		      stat_ahead_dir_add (stat_ahead, entry);
+		    if (! (prefetch || stat_ahead))
+		      dump_file (st, entry, name_buf);
+		  }
+	      }
+
+	    if (prefetch || stat_ahead)
+	      {
+		while ((entry = (prefetch
+				 ? prefetch_dir_next (prefetch)
+				 : stat_ahead_dir_next (stat_ahead))))
+		  {
+		    strcpy (name_buf + name_len, entry);
+		    dump_file (st, entry, name_buf);
+		  }
+		if (prefetch)
+		  prefetch_dir_close (prefetch);
+		if (stat_ahead)
+		  stat_ahead_dir_close (stat_ahead);
 	      }
 
 	    free (name_buf);
@@ -1319,15 +1434,27 @@ get_directory_entries (struct tar_stat_info *st)
 static bool
 dump_dir (struct tar_stat_info *st)
 {
-  char *directory = get_directory_entries (st);
+  char *directory = NULL;
+  struct walk_dir *walk = walk_dir_open (st, &directory);
+
   if (! directory)
     {
-      savedir_diag (st->orig_file_name);
-      return false;
+      directory = get_directory_entries (st);
+      if (! directory)
+	{
+	  if (walk)
+	    walk_dir_close (walk);
+	  savedir_diag (st->orig_file_name);
+	  return false;
+	}
+      if (walk)
+	walk_dir_expand (walk, directory);
     }
 
   dump_dir0 (st, directory);
 
+  if (walk)
+    walk_dir_close (walk);
   restore_parent_fd (st);
   free (directory);
   return true;
@@ -1421,11 +1548,16 @@ create_archive (void)
 	  dump_file (0, name, name);
     }
 
+  prefetch_finish ();
+  stat_ahead_finish ();
+  walk_finish ();
   write_eot ();
   close_archive ();
   finish_deferred_unlinks ();
   if (listed_incremental_option)
     write_directory_file ();
+  if (toc_file_name)
+    toc_write ();
 }
 
 
@@ -1673,20 +1805,33 @@ dump_file0 (struct tar_stat_info *st, char const *name, char const *p)
       errno = - parentfd;
       diag = open_diag;
     }
-  else if (fstatat (parentfd, name, &st->stat, fstatat_flags) != 0)
+  else if (stat_ahead_file (parent, name, &st->stat, &fd)
+	   ? fd < 0
+	   : fstatat (parentfd, name, &st->stat, fstatat_flags) != 0)
     diag = stat_diag;
   else if (file_dumpable_p (&st->stat))
     {
-      fd = subfile_open (parent, name, open_read_flags);
-      if (fd < 0)
-	diag = open_diag;
+      /* If the file was opened ahead, ST->stat is that of FD.  */
+      if (fd)
+	st->fd = fd;
       else
 	{
-	  st->fd = fd;
-	  if (fstat (fd, &st->stat) != 0)
-	    diag = stat_diag;
+	  fd = subfile_open (parent, name, open_read_flags);
+	  if (fd < 0)
+	    diag = open_diag;
+	  else
+	    {
+	      st->fd = fd;
+	      if (fstat (fd, &st->stat) != 0)
+		diag = stat_diag;
+	    }
 	}
     }
+  else if (fd)
+    {
+      close (fd);
+      fd = 0;
+    }
   if (diag)
     {
       file_removed_diag (p, top_level, diag);
@@ -25,7 +25,7 @@
 #include <wordsplit.h>
 #include "common.h"
 
-typedef void (*add_fn) (struct exclude *, char const *, int, void *);
+typedef void (*add_fn) (struct exclmatch *, char const *, int, void *);
 
 struct vcs_ignore_file
 {
@@ -66,7 +66,7 @@ struct exclist
 {
   struct exclist *next, *prev;
   int flags;
-  struct exclude *excluded;
+  struct exclmatch *excluded;
 };
 
 void
@@ -83,7 +83,7 @@ info_attach_exclist (struct tar_stat_info *dir)
       if (faccessat (dir ? dir->fd : chdir_fd, file->name, F_OK, 0) == 0)
 	{
 	  FILE *fp;
-	  struct exclude *ex = NULL;
+	  struct exclmatch *ex = NULL;
 	  int fd = subfile_open (dir, file->name, O_RDONLY);
 	  if (fd == -1)
 	    {
@@ -99,17 +99,17 @@ info_attach_exclist (struct tar_stat_info *dir)
 	    }
 
 	  if (!ex)
-	    ex = new_exclude ();
+	    ex = exclmatch_new ();
 
 	  vcsfile = get_vcs_ignore_file (file->name);
 
 	  if (vcsfile->initfn)
 	    vcsfile->data = vcsfile->initfn (vcsfile->data);
 
-	  if (add_exclude_fp (vcsfile->addfn, ex, fp,
-			      FNM_FILE_NAME|EXCLUDE_WILDCARDS|EXCLUDE_ANCHORED,
-			      '\n',
-			      vcsfile->data))
+	  if (exclmatch_add_fp (vcsfile->addfn, ex, fp,
+				FNM_FILE_NAME|EXCLUDE_WILDCARDS|EXCLUDE_ANCHORED,
+				'\n',
+				vcsfile->data))
 	    {
 	      int e = errno;
 	      FATAL_ERROR ((0, e, "%s", quotearg_colon (file->name)));
@@ -140,7 +140,7 @@ info_free_exclist (struct tar_stat_info *dir)
   while (ep)
     {
       struct exclist *next = ep->next;
-      free_exclude (ep->excluded);
+      exclmatch_free (ep->excluded);
       free (ep);
       ep = next;
     }
@@ -162,7 +162,7 @@ excluded_name (char const *name, struct tar_stat_info *st)
   name += FILE_SYSTEM_PREFIX_LEN (name);
 
   /* Try global exclusion list first */
-  if (excluded_file_name (excluded, name))
+  if (exclmatch_p (excluded, name))
     return true;
 
   if (!st)
@@ -174,7 +174,7 @@ excluded_name (char const *name, struct tar_stat_info *st)
 	{
 	  if (ep->flags & nr)
 	    continue;
-	  if ((result = excluded_file_name (ep->excluded, name)))
+	  if ((result = exclmatch_p (ep->excluded, name)))
 	    break;
 
 	  if (!rname)
@@ -184,12 +184,12 @@ excluded_name (char const *name, struct tar_stat_info *st)
 	      while (*rname == '.' && ISSLASH (rname[1]))
 		rname += 2;
 	    }
-	  if ((result = excluded_file_name (ep->excluded, rname)))
+	  if ((result = exclmatch_p (ep->excluded, rname)))
 	    break;
 
 	  if (!bname)
 	    bname = base_name (name);
-	  if ((result = excluded_file_name (ep->excluded, bname)))
+	  if ((result = exclmatch_p (ep->excluded, bname)))
 	    break;
 	}
     }
@@ -200,23 +200,22 @@ excluded_name (char const *name, struct tar_stat_info *st)
 }
 
 static void
-cvs_addfn (struct exclude *ex, char const *pattern, int options,
+cvs_addfn (struct exclmatch *ex, char const *pattern, int options,
 	   MAYBE_UNUSED void *data)
 {
   struct wordsplit ws;
   size_t i;
 
-  options |= EXCLUDE_ALLOC;
   if (wordsplit (pattern, &ws,
 		 WRDSF_NOVAR | WRDSF_NOCMD | WRDSF_SQUEEZE_DELIMS))
     return;
   for (i = 0; i < ws.ws_wordc; i++)
-    add_exclude (ex, ws.ws_wordv[i], options);
+    exclmatch_add (ex, ws.ws_wordv[i], options);
   wordsplit_free (&ws);
 }
 
 static void
-git_addfn (struct exclude *ex, char const *pattern, int options,
+git_addfn (struct exclmatch *ex, char const *pattern, int options,
 	   MAYBE_UNUSED void *data)
 {
   while (c_isspace (*pattern))
@@ -225,11 +224,11 @@ git_addfn (struct exclude *ex, char const *pattern, int options,
     return;
   if (*pattern == '\\' && pattern[1] == '#')
     ++pattern;
-  add_exclude (ex, pattern, options);
+  exclmatch_add (ex, pattern, options);
 }
 
 static void
-bzr_addfn (struct exclude *ex, char const *pattern, int options,
+bzr_addfn (struct exclmatch *ex, char const *pattern, int options,
 	   MAYBE_UNUSED void *data)
 {
   while (c_isspace (*pattern))
@@ -251,7 +250,7 @@ bzr_addfn (struct exclude *ex, char const *pattern, int options,
       options &= ~EXCLUDE_WILDCARDS;
       options |= EXCLUDE_REGEX;
     }
-  add_exclude (ex, pattern, options);
+  exclmatch_add (ex, pattern, options);
 }
 
 static void *
@@ -264,10 +263,11 @@ hg_initfn (void *data)
 }
 
 static void
-hg_addfn (struct exclude *ex, char const *pattern, int options, void *data)
+hg_addfn (struct exclmatch *ex, char const *pattern, int options, void *data)
 {
   int *hgopt = data;
   size_t len;
+  char *buf = NULL;
 
   while (c_isspace (*pattern))
     ++pattern;
@@ -289,21 +289,19 @@ hg_addfn (struct exclude *ex, char const *pattern, int options, void *data)
   len = strlen(pattern);
   if (pattern[len-1] == '/')
     {
-      char *p;
-
       --len;
-      p = xmalloc (len+1);
-      memcpy (p, pattern, len);
-      p[len] = 0;
-      pattern = p;
-      exclude_add_pattern_buffer (ex, p);
-      options |= FNM_LEADING_DIR|EXCLUDE_ALLOC;
+      buf = xmalloc (len+1);
+      memcpy (buf, pattern, len);
+      buf[len] = 0;
+      pattern = buf;
+      options |= FNM_LEADING_DIR;
     }
 
-  add_exclude (ex, pattern,
-	       ((*hgopt == EXCLUDE_REGEX)
-		? (options & ~EXCLUDE_WILDCARDS)
-		: (options & ~EXCLUDE_REGEX)) | *hgopt);
+  exclmatch_add (ex, pattern,
+		 ((*hgopt == EXCLUDE_REGEX)
+		  ? (options & ~EXCLUDE_WILDCARDS)
+		  : (options & ~EXCLUDE_REGEX)) | *hgopt);
+  free (buf);
 }
 
 static struct vcs_ignore_file vcs_ignore_files[] = {
@@ -0,0 +1,518 @@
+/* Compiled exclusion patterns for tar.
+
+   Copyright 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU tar.
+
+   GNU tar is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU tar is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Every file name that tar visits is checked against the exclusion
+   lists, and trying a list of thousands of patterns one at a time
+   takes most of the run time.  An exclusion list therefore keeps its
+   patterns as they are added, and sorts them on first use into:
+
+     - a trie of the literal patterns and of the literal prefixes of
+       the wildcard patterns, walked from each place in a file name
+       where a pattern may start to match;
+     - a trie of the reversed literal suffixes of the other wildcard
+       patterns, such as "*.o", walked back from each place where a
+       pattern may stop matching;
+     - a gnulib exclusion list holding the patterns left over.
+
+   Literal patterns are matched in the tries the way gnulib matches
+   them: against the whole name or, with FNM_LEADING_DIR, one of its
+   leading directories.  The tries only narrow down the wildcard
+   patterns that may match, which are then checked by exclude_fnmatch,
+   so that a name is excluded exactly when it would be by gnulib.
+
+   When EXCLUDE_INCLUDE patterns are mixed with the others, gnulib goes
+   by the last pattern that matches, so such a list is handed to it
+   whole.  So is every list in locales whose multibyte characters may
+   contain the bytes that fnmatch treats specially.  */
+
+#include <system.h>
+#include <localcharset.h>
+#include "common.h"
+
+/* A pattern of the list.  */
+struct exclpat
+{
+  char *pattern;		/* pattern text */
+  int options;			/* options it was added with */
+  struct exclpat *next;		/* next pattern in the same trie node */
+  size_t generation;		/* last match in which it was tried */
+};
+
+/* Flags of literal patterns ending at a trie node, by anchoring and
+   FNM_LEADING_DIR.  */
+enum
+  {
+    LITERAL_FLOATING = 1,
+    LITERAL_FLOATING_DIR = 2,
+    LITERAL_ANCHORED = 4,
+    LITERAL_ANCHORED_DIR = 8
+  };
+
+struct trie_node
+{
+  size_t child;			/* first child, or 0 */
+  size_t sibling;		/* next sibling, or 0 */
+  struct exclpat *patterns;	/* wildcard patterns attached here */
+  unsigned char c;		/* byte leading here from the parent */
+  unsigned char literal;	/* LITERAL_* flags */
+};
+
+/* A trie of byte strings.  Node 0 is the root, and children are kept
+   in increasing order of their byte.  */
+struct trie
+{
+  struct trie_node *nodes;
+  size_t nnodes;
+  size_t nodes_alloc;
+};
+
+struct exclmatch
+{
+  struct exclpat *pats;		/* patterns, in the order they were added */
+  size_t npats;
+  size_t pats_alloc;
+  bool has_include;		/* whether some of them are EXCLUDE_INCLUDE */
+
+  bool compiled;		/* whether the fields below are set up */
+  struct trie prefixes;		/* literal prefixes */
+  struct trie suffixes;		/* reversed literal suffixes */
+  struct exclude *rest;		/* remaining patterns, or NULL */
+  size_t generation;		/* number of matches so far */
+};
+
+struct exclmatch *
+exclmatch_new (void)
+{
+  return xzalloc (sizeof (struct exclmatch));
+}
+
+static void
+exclmatch_uncompile (struct exclmatch *m)
+{
+  free (m->prefixes.nodes);
+  memset (&m->prefixes, 0, sizeof m->prefixes);
+  free (m->suffixes.nodes);
+  memset (&m->suffixes, 0, sizeof m->suffixes);
+  if (m->rest)
+    {
+      free_exclude (m->rest);
+      m->rest = NULL;
+    }
+  m->compiled = false;
+}
+
+void
+exclmatch_free (struct exclmatch *m)
+{
+  size_t i;
+
+  exclmatch_uncompile (m);
+  for (i = 0; i < m->npats; i++)
+    free (m->pats[i].pattern);
+  free (m->pats);
+  free (m);
+}
+
+/* Add PATTERN with OPTIONS, as for gnulib's add_exclude.  */
+void
+exclmatch_add (struct exclmatch *m, char const *pattern, int options)
+{
+  struct exclpat *p;
+
+  if (m->compiled)
+    exclmatch_uncompile (m);
+  if (m->npats == m->pats_alloc)
+    m->pats = x2nrealloc (m->pats, &m->pats_alloc, sizeof *m->pats);
+  p = &m->pats[m->npats++];
+  p->pattern = xstrdup (pattern);
+  p->options = options;
+  if (options & EXCLUDE_INCLUDE)
+    m->has_include = true;
+}
+
+struct add_closure
+{
+  void (*add_func) (struct exclmatch *, char const *, int, void *);
+  struct exclmatch *m;
+  void *data;
+};
+
+static void
+call_add_func (MAYBE_UNUSED struct exclude *ex, char const *pattern,
+	       int options, void *data)
+{
+  struct add_closure *c = data;
+  c->add_func (c->m, pattern, options, c->data);
+}
+
+/* Read patterns from FP, each terminated by LINE_END, and call
+   ADD_FUNC for each of them, as for gnulib's add_exclude_fp.  */
+int
+exclmatch_add_fp (void (*add_func) (struct exclmatch *, char const *, int,
+				    void *),
+		  struct exclmatch *m, FILE *fp, int options, char line_end,
+		  void *data)
+{
+  /* gnulib splits the file into patterns, leaving its contents in a
+     scratch list.  */
+  struct exclude *scratch = new_exclude ();
+  struct add_closure c = { add_func, m, data };
+  int rc = add_exclude_fp (call_add_func, scratch, fp, options, line_end, &c);
+  int e = errno;
+
+  free_exclude (scratch);
+  errno = e;
+  return rc;
+}
+
+static void
+add_pattern (struct exclmatch *m, char const *pattern, int options,
+	     MAYBE_UNUSED void *data)
+{
+  exclmatch_add (m, pattern, options);
+}
+
+/* Add the patterns read from FILE_NAME, or from the standard input if
+   it is "-", as for gnulib's add_exclude_file.  */
+int
+exclmatch_add_file (struct exclmatch *m, char const *file_name, int options,
+		    char line_end)
+{
+  bool use_stdin = file_name[0] == '-' && !file_name[1];
+  FILE *in;
+  int rc;
+
+  if (use_stdin)
+    in = stdin;
+  else if (! (in = fopen (file_name, "r")))
+    return -1;
+
+  rc = exclmatch_add_fp (add_pattern, m, in, options, line_end, NULL);
+
+  if (!use_stdin && fclose (in) != 0)
+    rc = -1;
+
+  return rc;
+}
+
+static size_t
+trie_child (struct trie const *t, size_t n, unsigned char c)
+{
+  size_t i;
+
+  for (i = t->nodes[n].child; i && t->nodes[i].c < c; i = t->nodes[i].sibling)
+    continue;
+  return i && t->nodes[i].c == c ? i : 0;
+}
+
+/* Return the node of trie T for the LEN bytes at S, read backwards if
+   REVERSE, creating it if needed.  */
+static size_t
+trie_insert (struct trie *t, char const *s, size_t len, bool reverse)
+{
+  size_t n = 0;
+  size_t i;
+
+  if (t->nnodes == 0)
+    {
+      t->nodes = x2nrealloc (NULL, &t->nodes_alloc, sizeof *t->nodes);
+      memset (&t->nodes[0], 0, sizeof t->nodes[0]);
+      t->nnodes = 1;
+    }
+
+  for (i = 0; i < len; i++)
+    {
+      unsigned char c = s[reverse ? len - 1 - i : i];
+      size_t prev = 0;
+      size_t next = t->nodes[n].child;
+      size_t new;
+
+      while (next && t->nodes[next].c < c)
+	{
+	  prev = next;
+	  next = t->nodes[next].sibling;
+	}
+      if (next && t->nodes[next].c == c)
+	{
+	  n = next;
+	  continue;
+	}
+
+      if (t->nnodes == t->nodes_alloc)
+	t->nodes = x2nrealloc (t->nodes, &t->nodes_alloc, sizeof *t->nodes);
+      new = t->nnodes++;
+      t->nodes[new] = (struct trie_node) { .sibling = next, .c = c };
+      if (prev)
+	t->nodes[prev].sibling = new;
+      else
+	t->nodes[n].child = new;
+      n = new;
+    }
+  return n;
+}
+
+static void
+trie_attach (struct trie *t, char const *s, size_t len, bool reverse,
+	     struct exclpat *p)
+{
+  size_t n = trie_insert (t, s, len, reverse);
+
+  p->next = t->nodes[n].patterns;
+  t->nodes[n].patterns = p;
+}
+
+/* Remove the backslashes quoting characters in S, as gnulib does for
+   literal patterns.  */
+static void
+unescape_pattern (char *s)
+{
+  char const *q = s;
+
+  do
+    q += *q == '\\' && q[1];
+  while ((*s++ = *q++));
+}
+
+/* Copy to BUF the literal text that the names matched by the wildcard
+   PATTERN with OPTIONS start with, and return its length.  */
+static size_t
+pattern_prefix (char const *pattern, int options, char *buf)
+{
+  size_t len = 0;
+
+  for (;; pattern++)
+    switch (*pattern)
+      {
+      case '\0': case '*': case '?': case '[': case ']':
+	return len;
+
+      case '\\':
+	if (! (options & FNM_NOESCAPE))
+	  {
+	    if (!pattern[1])
+	      return len;
+	    pattern++;
+	  }
+	FALLTHROUGH;
+      default:
+	buf[len++] = *pattern;
+      }
+}
+
+/* Copy to BUF the literal text that the names matched by the wildcard
+   PATTERN with OPTIONS end with, and return its length.  Give up on
+   bracket expressions and return 0.  */
+static size_t
+pattern_suffix (char const *pattern, int options, char *buf)
+{
+  size_t len = 0;
+
+  for (;; pattern++)
+    switch (*pattern)
+      {
+      case '\0':
+	return len;
+
+      case '*': case '?':
+	len = 0;
+	break;
+
+      case '[': case ']':
+	return 0;
+
+      case '\\':
+	if (! (options & FNM_NOESCAPE))
+	  {
+	    if (!pattern[1])
+	      return 0;
+	    pattern++;
+	  }
+	FALLTHROUGH;
+      default:
+	buf[len++] = *pattern;
+      }
+}
+
+static void
+exclmatch_compile (struct exclmatch *m)
+{
+  /* The tries work on bytes, which is safe only if no multibyte
+     character can contain a byte that fnmatch treats specially.  */
+  bool split = (!m->has_include
+		&& (MB_CUR_MAX == 1 || STREQ (locale_charset (), "UTF-8")));
+  char *prefix = NULL;
+  char *suffix = NULL;
+  size_t buf_size = 0;
+  size_t i;
+
+  for (i = 0; i < m->npats; i++)
+    {
+      struct exclpat *p = &m->pats[i];
+      int options = p->options;
+      size_t size = strlen (p->pattern) + 1;
+      size_t plen, slen;
+
+      p->generation = 0;
+      if (!split || (options & (EXCLUDE_REGEX | FNM_CASEFOLD | FNM_EXTMATCH)))
+	goto rest;
+
+      if (buf_size < size)
+	{
+	  free (prefix);
+	  free (suffix);
+	  prefix = xmalloc (size);
+	  suffix = xmalloc (size);
+	  buf_size = size;
+	}
+
+      if (! (options & EXCLUDE_WILDCARDS)
+	  || !fnmatch_pattern_has_wildcards (p->pattern, options))
+	{
+	  size_t n;
+
+	  strcpy (prefix, p->pattern);
+	  if ((options & (EXCLUDE_WILDCARDS | FNM_NOESCAPE))
+	      == EXCLUDE_WILDCARDS)
+	    unescape_pattern (prefix);
+	  n = trie_insert (&m->prefixes, prefix, strlen (prefix), false);
+	  m->prefixes.nodes[n].literal
+	    |= ((options & EXCLUDE_ANCHORED
+		 ? LITERAL_ANCHORED : LITERAL_FLOATING)
+		<< !!(options & FNM_LEADING_DIR));
+	  continue;
+	}
+
+      /* Use the longer of the literal prefix and suffix.  */
+      plen = pattern_prefix (p->pattern, options, prefix);
+      slen = pattern_suffix (p->pattern, options, suffix);
+      if (plen && slen <= plen)
+	{
+	  trie_attach (&m->prefixes, prefix, plen, false, p);
+	  continue;
+	}
+      if (slen)
+	{
+	  trie_attach (&m->suffixes, suffix, slen, true, p);
+	  continue;
+	}
+
+    rest:
+      if (!m->rest)
+	m->rest = new_exclude ();
+      add_exclude (m->rest, p->pattern, options);
+    }
+
+  free (prefix);
+  free (suffix);
+  m->compiled = true;
+}
+
+/* Try the patterns from P on that were not tried yet during this
+   match, skipping those with any of the options in FORBID or without
+   all of those in REQUIRE.  */
+static bool
+try_patterns (struct exclmatch *m, struct exclpat *p, char const *name,
+	      int forbid, int require)
+{
+  for (; p; p = p->next)
+    if (p->generation != m->generation
+	&& ! (p->options & forbid) && (p->options & require) == require)
+      {
+	p->generation = m->generation;
+	if (exclude_fnmatch (p->pattern, name, p->options))
+	  return true;
+      }
+  return false;
+}
+
+/* Walk the prefix trie along NAME from its byte START on, which is
+   0 or follows a slash.  */
+static bool
+match_prefixes (struct exclmatch *m, char const *name, size_t start)
+{
+  struct trie const *t = &m->prefixes;
+  int forbid = start == 0 ? 0 : EXCLUDE_ANCHORED;
+  char const *p = name + start;
+  size_t n = 0;
+
+  for (;; p++)
+    {
+      struct trie_node const *node = &t->nodes[n];
+      int literal = (!*p ? (LITERAL_FLOATING | LITERAL_FLOATING_DIR
+			    | LITERAL_ANCHORED | LITERAL_ANCHORED_DIR)
+		     : *p == '/' ? LITERAL_FLOATING_DIR | LITERAL_ANCHORED_DIR
+		     : 0);
+
+      if (start != 0)
+	literal &= LITERAL_FLOATING | LITERAL_FLOATING_DIR;
+      if (node->literal & literal)
+	return true;
+      if (node->patterns && try_patterns (m, node->patterns, name, forbid, 0))
+	return true;
+      if (!*p || ! (n = trie_child (t, n, *p)))
+	return false;
+    }
+}
+
+/* Walk the suffix trie back along NAME from its byte END, which is
+   its terminating null byte or a slash.  */
+static bool
+match_suffixes (struct exclmatch *m, char const *name, size_t end)
+{
+  struct trie const *t = &m->suffixes;
+  int require = name[end] ? FNM_LEADING_DIR : 0;
+  char const *p = name + end;
+  size_t n = 0;
+
+  while (p != name && (n = trie_child (t, n, *--p)))
+    if (t->nodes[n].patterns
+	&& try_patterns (m, t->nodes[n].patterns, name, 0, require))
+      return true;
+  return false;
+}
+
+/* Return true if NAME is excluded by M, as for gnulib's
+   excluded_file_name.  */
+bool
+exclmatch_p (struct exclmatch *m, char const *name)
+{
+  char const *p;
+
+  if (!m->compiled)
+    exclmatch_compile (m);
+
+  if (m->prefixes.nnodes || m->suffixes.nnodes)
+    {
+      m->generation++;
+      if (m->prefixes.nnodes && match_prefixes (m, name, 0))
+	return true;
+      for (p = name; *p; p++)
+	if (*p == '/')
+	  {
+	    if (m->prefixes.nnodes && match_prefixes (m, name, p + 1 - name))
+	      return true;
+	    if (m->suffixes.nnodes && match_suffixes (m, name, p - name))
+	      return true;
+	  }
+      if (m->suffixes.nnodes && match_suffixes (m, name, p - name))
+	return true;
+    }
+
+  return m->rest && excluded_file_name (m->rest, name);
+}
@@ -79,8 +79,8 @@ implemented (int err)
 
 struct delayed_set_stat
   {
-    /* Next directory in list.  */
-    struct delayed_set_stat *next;
+    /* Next and previous directories in list.  */
+    struct delayed_set_stat *next, *prev;
 
     /* Metadata for this directory.  */
     dev_t dev;
@@ -130,7 +130,9 @@ struct delayed_set_stat
 
 static struct delayed_set_stat *delayed_set_stat_head;
 
-/* Table of delayed stat updates hashed by path; null if none.  */
+/* Table of delayed stat updates hashed by path; null if none.  Each
+   entry of the list above is in it, so that a directory is found
+   without walking the list.  */
 static Hash_table *delayed_set_stat_table;
 
 /* A link whose creation we have delayed.  */
@@ -221,14 +223,20 @@ static size_t
 ds_hash (void const *entry, size_t table_size)
 {
   struct delayed_set_stat const *ds = entry;
-  return hash_string (ds->file_name, table_size);
+  size_t i, value = 0;
+
+  /* Like hash_string, but the key need not be null-terminated.  */
+  for (i = 0; i < ds->file_name_len; i++)
+    value = (value * 31 + (unsigned char) ds->file_name[i]) % table_size;
+  return value;
 }
 
 static bool
 ds_compare (void const *a, void const *b)
 {
   struct delayed_set_stat const *dsa = a, *dsb = b;
-  return strcmp (dsa->file_name, dsb->file_name) == 0;
+  return (dsa->file_name_len == dsb->file_name_len
+	  && memcmp (dsa->file_name, dsb->file_name, dsa->file_name_len) == 0);
 }
 
 /*  Set up to extract files.  */
@@ -363,7 +371,7 @@ set_mode (char const *file_name,
 }
 
 /* Check time after successfully setting FILE_NAME's time stamp to T.  */
-static void
+void
 check_time (char const *file_name, struct timespec t)
 {
   if (t.tv_sec < 0)
@@ -462,22 +470,33 @@ set_stat (char const *file_name,
   xattrs_selinux_set (st, file_name, typeflag);
 }
 
+/* Return the entry of the delayed_set_stat list whose name is the
+   first LEN bytes of FILE_NAME, or NULL if there is none.  */
+static struct delayed_set_stat *
+find_delayed_set_stat (char const *file_name, size_t len)
+{
+  struct delayed_set_stat key;
+
+  if (! delayed_set_stat_table)
+    return NULL;
+  key.file_name = (char *) file_name;
+  key.file_name_len = len;
+  return hash_lookup (delayed_set_stat_table, &key);
+}
+
 /* Find the direct ancestor of FILE_NAME in the delayed_set_stat list.
+   Its name is FILE_NAME without the last slash and last component.
  */
 static struct delayed_set_stat *
 find_direct_ancestor (char const *file_name)
 {
-  struct delayed_set_stat *h = delayed_set_stat_head;
-  while (h)
-    {
-      if (! h->after_links
-	  && strncmp (file_name, h->file_name, h->file_name_len) == 0
-	  && ISSLASH (file_name[h->file_name_len])
-	  && (last_component (file_name) == file_name + h->file_name_len + 1))
-	break;
-      h = h->next;
-    }
-  return h;
+  char const *base = last_component (file_name);
+  struct delayed_set_stat *h;
+
+  if (base == file_name || ! ISSLASH (base[-1]))
+    return NULL;
+  h = find_delayed_set_stat (file_name, base - 1 - file_name);
+  return h && ! h->after_links ? h : NULL;
 }
 
 /* For each entry H in the leading prefix of entries in HEAD that do
@@ -537,6 +556,7 @@ delay_set_stat (char const *file_name, struct tar_stat_info const *st,
 
   struct delayed_set_stat key;
   key.file_name = (char *) file_name;
+  key.file_name_len = file_name_len;
 
   data = hash_lookup (delayed_set_stat_table, &key);
   if (data)
@@ -560,6 +580,9 @@ delay_set_stat (char const *file_name, struct tar_stat_info const *st,
     {
       data = xmalloc (sizeof (*data));
       data->next = delayed_set_stat_head;
+      data->prev = NULL;
+      if (delayed_set_stat_head)
+	delayed_set_stat_head->prev = data;
       delayed_set_stat_head = data;
       data->file_name_len = file_name_len;
       data->file_name = xstrdup (file_name);
@@ -624,8 +647,12 @@ static void
 repair_delayed_set_stat (char const *dir,
 			 struct stat const *dir_stat_info)
 {
-  struct delayed_set_stat *data;
-  for (data = delayed_set_stat_head; data; data = data->next)
+  /* Usually the intermediate directory was made under the name DIR
+     itself, so look at it first.  */
+  struct delayed_set_stat *named = find_delayed_set_stat (dir, strlen (dir));
+  struct delayed_set_stat *data = named ? named : delayed_set_stat_head;
+
+  while (data)
     {
       struct stat st;
       if (fstatat (chdir_fd, data->file_name, &st, data->atflag) != 0)
@@ -649,6 +676,14 @@ repair_delayed_set_stat (char const *dir,
 	  data->interdir = false;
 	  return;
 	}
+
+      if (data == named)
+	{
+	  named = NULL;
+	  data = delayed_set_stat_head;
+	}
+      else
+	data = data->next;
     }
 
   ERROR ((0, 0, _("%s: Unexpected inconsistency when making directory"),
@@ -666,43 +701,44 @@ free_delayed_set_stat (struct delayed_set_stat *data)
   free (data);
 }
 
+/* Remove DATA from the delayed_set_stat list and table, and free it.  */
+static void
+unlink_delayed_set_stat (struct delayed_set_stat *data)
+{
+  if (data->prev)
+    data->prev->next = data->next;
+  else
+    delayed_set_stat_head = data->next;
+  if (data->next)
+    data->next->prev = data->prev;
+  /* After fixup_delayed_set_stat, another entry may have the name.  */
+  if (hash_lookup (delayed_set_stat_table, data) == data)
+    hash_remove (delayed_set_stat_table, data);
+  free_delayed_set_stat (data);
+}
+
 void
 remove_delayed_set_stat (const char *fname)
 {
-  struct delayed_set_stat *data, *next, *prev = NULL;
-  for (data = delayed_set_stat_head; data; data = next)
-    {
-      next = data->next;
-      if (chdir_current == data->change_dir
-	  && strcmp (data->file_name, fname) == 0)
-	{
-	  hash_remove (delayed_set_stat_table, data);
-	  free_delayed_set_stat (data);
-	  if (prev)
-	    prev->next = next;
-	  else
-	    delayed_set_stat_head = next;
-	  return;
-	}
-      else
-	prev = data;
-    }
+  struct delayed_set_stat *data = find_delayed_set_stat (fname,
+							 strlen (fname));
+  if (data && chdir_current == data->change_dir)
+    unlink_delayed_set_stat (data);
 }
 
 static void
 fixup_delayed_set_stat (char const *src, char const *dst)
 {
-  struct delayed_set_stat *data;
-  for (data = delayed_set_stat_head; data; data = data->next)
+  struct delayed_set_stat *data = find_delayed_set_stat (src, strlen (src));
+  if (data && chdir_current == data->change_dir)
     {
-      if (chdir_current == data->change_dir
-	  && strcmp (data->file_name, src) == 0)
-	{
-	  free (data->file_name);
-	  data->file_name = xstrdup (dst);
-	  data->file_name_len = strlen (dst);
-	  return;
-	}
+      hash_remove (delayed_set_stat_table, data);
+      free (data->file_name);
+      data->file_name = xstrdup (dst);
+      data->file_name_len = strlen (dst);
+      /* If DST has an entry already, leave this one out of the table.  */
+      if (hash_insert_if_absent (delayed_set_stat_table, data, NULL) < 0)
+	xalloc_die ();
     }
 }
 
@@ -1025,9 +1061,7 @@ apply_nonancestor_delayed_set_stat (char const *file_name, bool after_links)
 		    DIRTYPE, data->interdir, data->atflag);
 	}
 
-      delayed_set_stat_head = data->next;
-      hash_remove (delayed_set_stat_table, data);
-      free_delayed_set_stat (data);
+      unlink_delayed_set_stat (data);
     }
 }
 
@@ -1272,6 +1306,101 @@ open_output_file (char const *file_name, int typeflag, mode_t mode,
   return fd;
 }
 
+/* Largest regular file whose data and attributes are left to a
+   thread, when --write-threads or --io-uring is in effect.  */
+enum { WRITE_THREAD_SIZE_MAX = 1024 * 1024 };
+
+/* Return true if the regular file being extracted can be written by
+   a thread, or in a batch with io_uring, once it is open.  The file
+   must be created anew, so that no later member and no backup depends
+   on its contents or on an error closing it, and everything left to do
+   with it must be doable through its file descriptor.  */
+static bool
+write_thread_p (void)
+{
+  return ((write_threads_option || io_uring_option)
+	  && ! to_stdout_option && ! to_command_option
+	  && ! current_stat_info.is_sparse
+	  && current_stat_info.stat.st_size <= WRITE_THREAD_SIZE_MAX
+	  && ! backup_option
+	  && old_files_option != OVERWRITE_OLD_FILES
+	  && old_files_option != KEEP_NEWER_FILES
+	  && ! xattrs_option && ! acls_option && ! selinux_context_option);
+}
+
+/* Read the data of the member being extracted to FILE_NAME, open as
+   FD, and queue the file for a thread to write it and restore its
+   attributes as set_stat would.  TYPEFLAG, CURRENT_MODE and
+   CURRENT_MODE_MASK are as for set_stat.  If the archive ends
+   prematurely, finish the file here as extract_file would.  Return
+   the status of closing FD, or 0 if it is left to the thread.  */
+static int
+extract_file_by_thread (char const *file_name, int typeflag, int fd,
+			mode_t current_mode, mode_t current_mode_mask)
+{
+  struct write_job job;
+  off_t left;
+
+  job.data = xmalloc (current_stat_info.stat.st_size);
+  job.size = 0;
+
+  mv_begin_read (&current_stat_info);
+  for (left = current_stat_info.stat.st_size; left > 0; )
+    {
+      union block *data_block;
+      size_t count;
+
+      mv_size_left (left);
+      data_block = find_next_block ();
+      if (! data_block)
+	{
+	  int status;
+
+	  ERROR ((0, 0, _("Unexpected EOF in archive")));
+	  count = blocking_write (fd, job.data, job.size);
+	  if (count != job.size)
+	    write_error_details (file_name, count, job.size);
+	  free (job.data);
+	  skim_file (left, false);
+	  mv_end ();
+	  set_stat (file_name, &current_stat_info, fd,
+		    current_mode, current_mode_mask, typeflag, false,
+		    AT_SYMLINK_NOFOLLOW);
+	  status = close (fd);
+	  if (status < 0)
+	    close_error (file_name);
+	  return status;
+	}
+      count = available_space_after (data_block);
+      if (count > left)
+	count = left;
+      memcpy (job.data + job.size, data_block->buffer, count);
+      job.size += count;
+      left -= count;
+      set_next_block_after ((union block *)
+			    (data_block->buffer + count - 1));
+    }
+  mv_end ();
+
+  job.file_name = xstrdup (file_name);
+  job.fd = fd;
+  job.set_times = ! touch_option;
+  if (incremental_option)
+    job.ts[0] = current_stat_info.atime;
+  else
+    job.ts[0].tv_nsec = UTIME_OMIT;
+  job.ts[1] = current_stat_info.mtime;
+  job.set_owner = 0 < same_owner_option;
+  job.uid = current_stat_info.stat.st_uid;
+  job.gid = current_stat_info.stat.st_gid;
+  job.mode = current_stat_info.stat.st_mode & ~ current_umask;
+  job.mode_mask = 0 < same_permissions_option ? MODE_ALL : MODE_RWX;
+  job.current_mode = current_mode;
+  job.current_mode_mask = current_mode_mask;
+  write_threads_submit (&job);
+  return 0;
+}
+
 static int
 extract_file (char *file_name, int typeflag)
 {
@@ -1325,14 +1454,31 @@ extract_file (char *file_name, int typeflag)
 	}
     }
 
+  if (write_thread_p ())
+    return extract_file_by_thread (file_name, typeflag, fd,
+				   current_mode, current_mode_mask);
+
   mv_begin_read (&current_stat_info);
   if (current_stat_info.is_sparse)
     sparse_extract_file (fd, &current_stat_info, &size);
   else
     for (size = current_stat_info.stat.st_size; size > 0; )
       {
+	bool copy_failed;
+
 	mv_size_left (size);
 
+	/* Let the kernel copy whole records when it can.  */
+	size -= copy_archive_data (fd, size, &copy_failed);
+	if (copy_failed)
+	  {
+	    if (!to_command_option)
+	      write_error (file_name);
+	    break;
+	  }
+	if (size == 0)
+	  break;
+
 	/* Locate data, determine max length writeable, write it,
 	   block that we have used the data, then check if the write
 	   worked.  */
@@ -1537,29 +1683,10 @@ extract_link (char *file_name, MAYBE_UNUSED int typeflag)
       int status = linkat (chdir_fd, link_name, chdir_fd, file_name, 0);
       e = errno;
 
+      /* LINK_NAME was found above not to be a delayed link, so the
+	 new link need not be added to the sources of one.  */
       if (status == 0)
-	{
-	  if (delayed_link_table
-	      && fstatat (chdir_fd, link_name, &st1, AT_SYMLINK_NOFOLLOW) == 0)
-	    {
-	      struct delayed_link dl1;
-	      dl1.ino = st1.st_ino;
-	      dl1.dev = st1.st_dev;
-	      struct delayed_link *ds = hash_lookup (delayed_link_table, &dl1);
-	      if (ds && ds->change_dir == chdir_current
-		  && BIRTHTIME_EQ (ds->birthtime, get_stat_birthtime (&st1)))
-		{
-		  struct string_list *p
-		    = xmalloc (FLEXNSIZEOF (struct string_list,
-					    string, strlen (file_name) + 1));
-		  strcpy (p->string, file_name);
-		  p->next = ds->sources;
-		  ds->sources = p;
-		}
-	    }
-
-	  return 0;
-	}
+	return 0;
       else if ((e == EEXIST && strcmp (link_name, file_name) == 0)
 	       || ((fstatat (chdir_fd, link_name, &st1, AT_SYMLINK_NOFOLLOW)
 		    == 0)
@@ -1979,6 +2106,9 @@ apply_delayed_links (void)
 void
 extract_finish (void)
 {
+  /* Wait for the files still being written.  */
+  write_threads_finish ();
+
   /* First, fix the status of ordinary directories that need fixing.  */
   apply_nonancestor_delayed_set_stat ("", false);
 
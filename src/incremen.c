@@ -23,6 +23,10 @@
 #include <quotearg.h>
 #include "common.h"
 
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
 /* Incremental dump specialities.  */
 
 /* Which child files to save under a directory.  */
@@ -61,9 +65,13 @@ enum children
 struct dumpdir                 /* Dump directory listing */
 {
   char *contents;              /* Actual contents */
+  char const *cmask;           /* Types of the elements of ELV, or NULL
+				  for all types */
+  bool shared;                 /* CONTENTS are in the snapshot read */
   size_t total;                /* Total number of elements */
   size_t elc;                  /* Number of D/N/Y elements. */
-  char **elv;                  /* Array of D/N/Y elements */
+  char **elv;                  /* Array of D/N/Y elements, or NULL if
+				  not built yet */
 };
 
 /* Directory attributes.  */
@@ -86,41 +94,82 @@ struct directory
     char *name;	     	        /* file name of directory */
   };
 
+/* Return a dumpdir for CONTENTS, whose elements of the types in
+   CMASK are to be looked up.  The array of these elements is built by
+   dumpdir_index when first needed, since most directories of a large
+   snapshot are never looked into.  */
 static struct dumpdir *
 dumpdir_create0 (const char *contents, const char *cmask)
 {
   struct dumpdir *dump;
-  size_t i, total, ctsize, len;
-  char *p;
-  const char *q;
+  size_t ctsize = dumpdir_size (contents);
 
-  for (i = 0, total = 0, ctsize = 1, q = contents; *q; total++, q += len)
-    {
-      len = strlen (q) + 1;
-      ctsize += len;
-      if (!cmask || strchr (cmask, *q))
-	i++;
-    }
   dump = xmalloc (sizeof (*dump) + ctsize);
   dump->contents = (char*)(dump + 1);
   memcpy (dump->contents, contents, ctsize);
+  dump->cmask = cmask;
+  dump->shared = false;
+  dump->elv = NULL;
+  return dump;
+}
+
+static struct dumpdir *
+dumpdir_create (const char *contents)
+{
+  return dumpdir_create0 (contents, "YND");
+}
+
+/* Return a dumpdir using CONTENTS, which are part of the snapshot
+   read, in place.  */
+static struct dumpdir *
+dumpdir_create_shared (const char *contents)
+{
+  struct dumpdir *dump = xmalloc (sizeof (*dump));
+  dump->contents = (char *) contents;
+  dump->cmask = "YND";
+  dump->shared = true;
+  dump->elv = NULL;
+  return dump;
+}
+
+/* Build the array of elements of DUMP, unless already done.  */
+static void
+dumpdir_index (struct dumpdir *dump)
+{
+  size_t i, total;
+  char *p;
+
+  if (dump->elv)
+    return;
+
+  for (i = 0, total = 0, p = dump->contents; *p; total++, p += strlen (p) + 1)
+    if (!dump->cmask || strchr (dump->cmask, *p))
+      i++;
   dump->total = total;
   dump->elc = i;
-  dump->elv = xcalloc (i + 1, sizeof (dump->elv[0]));
+  dump->elv = xnmalloc (i + 1, sizeof (dump->elv[0]));
 
   for (i = 0, p = dump->contents; *p; p += strlen (p) + 1)
     {
-      if (!cmask || strchr (cmask, *p))
+      if (!dump->cmask || strchr (dump->cmask, *p))
 	dump->elv[i++] = p + 1;
     }
   dump->elv[i] = NULL;
-  return dump;
 }
 
+/* If DUMP uses the contents of the snapshot in place, return a copy
+   of it that does not, and free DUMP.  Otherwise return DUMP.  */
 static struct dumpdir *
-dumpdir_create (const char *contents)
+dumpdir_unshare (struct dumpdir *dump)
 {
-  return dumpdir_create0 (contents, "YND");
+  struct dumpdir *copy;
+
+  if (! (dump && dump->shared))
+    return dump;
+  copy = dumpdir_create0 (dump->contents, dump->cmask);
+  free (dump->elv);
+  free (dump);
+  return copy;
 }
 
 static void
@@ -147,6 +196,7 @@ dumpdir_locate (struct dumpdir *dump, const char *name)
   if (!dump)
     return NULL;
 
+  dumpdir_index (dump);
   ptr = bsearch (&name, dump->elv, dump->elc, sizeof (dump->elv[0]),
 		 compare_dirnames);
   return ptr ? *ptr - 1: NULL;
@@ -189,6 +239,8 @@ dumpdir_first (struct dumpdir *dump, int all, struct dumpdir_iter **pitr)
   itr->all = all;
   itr->next = 0;
   *pitr = itr;
+  if (!all)
+    dumpdir_index (dump);
   return dumpdir_next (itr);
 }
 
@@ -212,6 +264,36 @@ static struct directory *dirhead, *dirtail;
 static Hash_table *directory_table;
 static Hash_table *directory_meta_table;
 
+/* A snapshot in format 3, whose directories are entered into the
+   tables above only when looked up.  */
+static char *snap_data;           /* Contents of the snapshot file */
+static size_t snap_size;          /* Size of SNAP_DATA */
+static bool snap_mapped;          /* SNAP_DATA is mapped into memory */
+static char const *snap_records;  /* Directory records */
+static size_t snap_ndirs;         /* Number of records */
+static char const *snap_strings;  /* String table */
+static size_t snap_strings_size;  /* Size of the string table */
+static char const *snap_name_index; /* Index by canonical name */
+static char const *snap_meta_index; /* Index by device and inode */
+static size_t snap_nbuckets;      /* Number of buckets in each index */
+static unsigned char *snap_loaded; /* Bit set of records entered */
+
+/* Prefix replacements made by dirlist_replace_prefix, to be made as
+   well in the names of directories entered later from the snapshot.  */
+struct snap_rename
+{
+  char *pref;
+  char *repl;
+};
+static struct snap_rename *snap_renames;
+static size_t snap_nrenames, snap_renames_alloc;
+
+/* Index of the working directory when the snapshot was read.  */
+static int snapshot_chdir;
+
+/* Format of the snapshot that was read, or 0 if none.  */
+static int snapshot_read_version;
+
 #if HAVE_ST_FSTYPE_STRING
   static char const nfs_string[] = "nfs";
 # define NFS_FILE_STAT(st) (strcmp ((st).st_fstype, nfs_string) == 0)
@@ -286,9 +368,9 @@ free_directory (struct directory *dir)
 }
 
 static struct directory *
-attach_directory (const char *name)
+attach_directory (const char *name, char *caname)
 {
-  char *cname = normalize_filename (chdir_current, name);
+  char *cname = caname ? caname : normalize_filename (chdir_current, name);
   struct directory *dir = make_directory (name, cname);
   if (dirtail)
     dirtail->next = dir;
@@ -307,8 +389,20 @@ dirlist_replace_prefix (const char *pref, const char *repl)
   size_t repl_len = strlen (repl);
   for (dp = dirhead; dp; dp = dp->next)
     replace_prefix (&dp->name, pref, pref_len, repl, repl_len);
+
+  if (snap_data)
+    {
+      if (snap_nrenames == snap_renames_alloc)
+	snap_renames = x2nrealloc (snap_renames, &snap_renames_alloc,
+				   sizeof *snap_renames);
+      snap_renames[snap_nrenames].pref = xstrdup (pref);
+      snap_renames[snap_nrenames].repl = xstrdup (repl);
+      snap_nrenames++;
+    }
 }
 
+static void snap_release (void);
+
 void
 clear_directory_table (void)
 {
@@ -325,18 +419,20 @@ clear_directory_table (void)
       dp = next;
     }
   dirhead = dirtail = NULL;
+  snap_release ();
 }
 
 /* Create and link a new directory entry for directory NAME, having a
    device number DEV and an inode number INO, with NFS indicating
    whether it is an NFS device and FOUND indicating whether we have
-   found that the directory exists.  */
+   found that the directory exists.  CANAME, if not null, is the
+   canonical name of the directory, which the entry takes over.  */
 static struct directory *
 note_directory (char const *name, struct timespec mtime,
 		dev_t dev, ino_t ino, bool nfs, bool found,
-		const char *contents)
+		const char *contents, char *caname)
 {
-  struct directory *directory = attach_directory (name);
+  struct directory *directory = attach_directory (name, caname);
 
   directory->mtime = mtime;
   directory->device_number = dev;
@@ -370,17 +466,257 @@ note_directory (char const *name, struct timespec mtime,
   return directory;
 }
 
+/* Snapshot format 3 (see write_incr_db_3 below) is made of 64-bit
+   little-endian words.  These are the words of its header, which
+   follows the format identifier line padded to a multiple of 8 bytes,
+   and of each directory record.  Offsets of strings are relative to
+   the string table, other offsets to the start of the file.  */
+enum
+  {
+    SNAP_MAGIC,            /* SNAP_MAGIC_NUMBER */
+    SNAP_TIME_SEC,         /* Time of the dump */
+    SNAP_TIME_NSEC,
+    SNAP_BASE,             /* Working directory, relative to which
+			      canonical names were computed */
+    SNAP_NDIRS,            /* Number of directory records */
+    SNAP_RECORDS,          /* Offset of the directory records */
+    SNAP_STRINGS,          /* Offset and size of the string table */
+    SNAP_STRINGS_SIZE,
+    SNAP_NBUCKETS,         /* Number of buckets in each index */
+    SNAP_NAME_INDEX,       /* Offset of the index by canonical name */
+    SNAP_META_INDEX,       /* Offset of the index by device and inode */
+    SNAP_HEADER_WORDS
+  };
+
+enum
+  {
+    SNAP_REC_NFS,          /* 1 if on NFS, 0 otherwise */
+    SNAP_REC_MTIME_SEC,    /* Modification time */
+    SNAP_REC_MTIME_NSEC,
+    SNAP_REC_DEV,          /* Device and inode numbers */
+    SNAP_REC_INO,
+    SNAP_REC_NAME,         /* Directory name */
+    SNAP_REC_CANAME,       /* Canonical name */
+    SNAP_REC_DUMPDIR,      /* Contents */
+    SNAP_REC_NAME_NEXT,    /* Next record in the same bucket of each */
+    SNAP_REC_META_NEXT,    /* index, plus 1, or 0 */
+    SNAP_RECORD_WORDS
+  };
+
+#define SNAP_MAGIC_NUMBER 0x3350414e53524154 /* "TARSNAP3" */
+
+static uint_least64_t
+snap_get (char const *p)
+{
+  unsigned char const *q = (unsigned char const *) p;
+  uint_least64_t w = 0;
+  int i;
+
+  for (i = 7; 0 <= i; i--)
+    w = (w << 8) | q[i];
+  return w;
+}
+
+static _Noreturn void
+snap_corrupt (void)
+{
+  FATAL_ERROR ((0, 0, "%s: %s",
+		quotearg_colon (listed_incremental_option),
+		_("Bad incremental file format")));
+}
+
+/* Return the string at offset OFF in the string table.  */
+static char const *
+snap_string (uint_least64_t off)
+{
+  if (! (off < snap_strings_size
+	 && memchr (snap_strings + off, 0, snap_strings_size - off)))
+    snap_corrupt ();
+  return snap_strings + off;
+}
+
+/* Return word W of record I.  */
+static uint_least64_t
+snap_record_word (size_t i, int w)
+{
+  return snap_get (snap_records + (i * SNAP_RECORD_WORDS + w) * 8);
+}
+
+static uint_least64_t
+snap_hash_name (char const *name)
+{
+  /* FNV-1a.  The hash is part of the format, so it must not change.  */
+  uint_least64_t h = 0xcbf29ce484222325;
+  for (; *name; name++)
+    h = ((h ^ (unsigned char) *name) * 0x100000001b3) & 0xffffffffffffffff;
+  return h;
+}
+
+static uint_least64_t
+snap_hash_meta (uint_least64_t dev, uint_least64_t ino)
+{
+  uint_least64_t h = ((dev * 0x9e3779b97f4a7c15) & 0xffffffffffffffff) ^ ino;
+  return ((h ^ (h >> 29)) * 0xbf58476d1ce4e5b9) & 0xffffffffffffffff;
+}
+
+/* Return the word W of the snapshot as an integer, which is signed if
+   MIN_VAL is negative.  MIN_VAL and MAX_VAL are the minimum and
+   maximum permissible values, as for read_num.  */
+static intmax_t
+snap_int (uint_least64_t w, intmax_t min_val, uintmax_t max_val)
+{
+  if (min_val < 0)
+    {
+      intmax_t i = (w <= INT_LEAST64_MAX ? (intmax_t) w
+		    : - (intmax_t) (- w - 1) - 1);
+      if (i < min_val || (0 < i && max_val < i))
+	snap_corrupt ();
+      return i;
+    }
+  if (max_val < w)
+    snap_corrupt ();
+  return represent_uintmax (w);
+}
+
+/* Enter the directory of record I of the snapshot into the tables and
+   return it.  If KEEP_CANAME, use the canonical name recorded for it;
+   otherwise compute it anew.  */
+static struct directory *
+snap_load (size_t i, bool keep_caname)
+{
+  struct directory *directory;
+  struct timespec mtime;
+  dev_t dev;
+  ino_t ino;
+  char const *name;
+  char const *caname;
+  char const *contents, *p;
+  size_t j;
+
+  snap_loaded[i / CHAR_BIT] |= 1 << (i % CHAR_BIT);
+
+  mtime.tv_sec = snap_int (snap_record_word (i, SNAP_REC_MTIME_SEC),
+			   TYPE_MINIMUM (time_t), TYPE_MAXIMUM (time_t));
+  mtime.tv_nsec = snap_int (snap_record_word (i, SNAP_REC_MTIME_NSEC),
+			    0, BILLION - 1);
+  dev = snap_int (snap_record_word (i, SNAP_REC_DEV),
+		  TYPE_MINIMUM (dev_t), TYPE_MAXIMUM (dev_t));
+  ino = snap_int (snap_record_word (i, SNAP_REC_INO),
+		  TYPE_MINIMUM (ino_t), TYPE_MAXIMUM (ino_t));
+  name = snap_string (snap_record_word (i, SNAP_REC_NAME));
+  caname = snap_string (snap_record_word (i, SNAP_REC_CANAME));
+
+  /* The contents must end within the string table.  */
+  contents = p = snap_string (snap_record_word (i, SNAP_REC_DUMPDIR));
+  while (*p)
+    p = snap_string (p - snap_strings + strlen (p) + 1);
+
+  directory = note_directory (name, mtime, dev, ino,
+			      snap_record_word (i, SNAP_REC_NFS) != 0, false,
+			      NULL, keep_caname ? xstrdup (caname) : NULL);
+  directory->dump = dumpdir_create_shared (contents);
+  for (j = 0; j < snap_nrenames; j++)
+    replace_prefix (&directory->name,
+		    snap_renames[j].pref, strlen (snap_renames[j].pref),
+		    snap_renames[j].repl, strlen (snap_renames[j].repl));
+  return directory;
+}
+
+/* Return the index plus 1 of the first record in bucket H of INDEX, or
+   of the record after record I plus 1 in the chain linked by word W,
+   or 0 at the end of the chain.  */
+static size_t
+snap_chain (char const *index, uint_least64_t h, size_t i, int w)
+{
+  uint_least64_t next = (i
+			 ? snap_record_word (i - 1, w)
+			 : snap_get (index + h % snap_nbuckets * 8));
+  /* Chains go forward, so that they cannot loop.  */
+  if (next && ! (i < next && next <= snap_ndirs))
+    snap_corrupt ();
+  return next;
+}
+
+/* Look up the first directory of the snapshot with canonical name
+   CANAME.  If it has not been entered into the tables, enter it and
+   return it.  Otherwise return NULL, as for a directory not in the
+   snapshot.  */
+static struct directory *
+snap_find_name (char const *caname)
+{
+  uint_least64_t h = snap_hash_name (caname);
+  size_t i;
+
+  for (i = snap_chain (snap_name_index, h, 0, SNAP_REC_NAME_NEXT); i;
+       i = snap_chain (snap_name_index, h, i, SNAP_REC_NAME_NEXT))
+    if (strcmp (snap_string (snap_record_word (i - 1, SNAP_REC_CANAME)),
+		caname) == 0)
+      return (snap_loaded[(i - 1) / CHAR_BIT] & (1 << ((i - 1) % CHAR_BIT))
+	      ? NULL : snap_load (i - 1, true));
+  return NULL;
+}
+
+/* Likewise, for the directory with device number DEV and inode
+   number INO.  */
+static struct directory *
+snap_find_meta (dev_t dev, ino_t ino)
+{
+  uint_least64_t h = snap_hash_meta (dev, ino);
+  size_t i;
+
+  for (i = snap_chain (snap_meta_index, h, 0, SNAP_REC_META_NEXT); i;
+       i = snap_chain (snap_meta_index, h, i, SNAP_REC_META_NEXT))
+    if (snap_record_word (i - 1, SNAP_REC_DEV) == (uint_least64_t) dev
+	&& snap_record_word (i - 1, SNAP_REC_INO) == (uint_least64_t) ino)
+      return (snap_loaded[(i - 1) / CHAR_BIT] & (1 << ((i - 1) % CHAR_BIT))
+	      ? NULL : snap_load (i - 1, true));
+  return NULL;
+}
+
+/* Release the snapshot.  Directories entered from it remain.  */
+static void
+snap_release (void)
+{
+  struct directory *dp;
+  size_t i;
+
+  if (! snap_data)
+    return;
+  for (dp = dirhead; dp; dp = dp->next)
+    {
+      dp->dump = dumpdir_unshare (dp->dump);
+      dp->idump = dumpdir_unshare (dp->idump);
+    }
+#if HAVE_SYS_MMAN_H
+  if (snap_mapped)
+    munmap (snap_data, snap_size);
+  else
+#endif
+    free (snap_data);
+  snap_data = NULL;
+  free (snap_loaded);
+  snap_loaded = NULL;
+  for (i = 0; i < snap_nrenames; i++)
+    {
+      free (snap_renames[i].pref);
+      free (snap_renames[i].repl);
+    }
+  snap_nrenames = 0;
+}
+
 /* Return a directory entry for a given file NAME, or zero if none found.  */
 static struct directory *
 find_directory (const char *name)
 {
-  if (! directory_table)
+  if (! (directory_table || snap_data))
     return 0;
   else
     {
       char *caname = normalize_filename (chdir_current, name);
       struct directory *dir = make_directory (name, caname);
-      struct directory *ret = hash_lookup (directory_table, dir);
+      struct directory *ret = snap_data ? snap_find_name (caname) : NULL;
+      if (! ret && directory_table)
+	ret = hash_lookup (directory_table, dir);
       free_directory (dir);
       return ret;
     }
@@ -415,12 +751,13 @@ rebase_directory (struct directory *dir,
 static struct directory *
 find_directory_meta (dev_t dev, ino_t ino)
 {
-  if (! directory_meta_table)
-    return 0;
+  struct directory *ret = snap_data ? snap_find_meta (dev, ino) : NULL;
+
+  if (ret || ! directory_meta_table)
+    return ret;
   else
     {
       struct directory *dir = make_directory ("", NULL);
-      struct directory *ret;
       dir->device_number = dev;
       dir->inode_number = ino;
       ret = hash_lookup (directory_meta_table, dir);
@@ -535,7 +872,7 @@ procdir (const char *name_buffer, struct tar_stat_info *st,
 				  stat_data->st_ino,
 				  nfs,
 				  true,
-				  NULL);
+				  NULL, NULL);
 
       if (d)
 	{
@@ -657,6 +994,7 @@ makedumpdir (struct directory *directory, const char *dir)
   char const **array;
   char *new_dump, *new_dump_ptr;
   struct dumpdir *dump;
+  bool sorted;
 
   if (directory->children == ALL_CHILDREN)
     dump = NULL;
@@ -673,12 +1011,19 @@ makedumpdir (struct directory *directory, const char *dir)
     len += strlen (p) + 2;
   len++;
 
-  /* Create a sorted directory listing */
+  /* Create a sorted directory listing.  With --sort=name, DIR is
+     sorted already.  */
   array = xcalloc (dirsize, sizeof array[0]);
+  sorted = true;
   for (i = 0, p = dir; *p; p += strlen (p) + 1, i++)
-    array[i] = p;
+    {
+      array[i] = p;
+      if (sorted && i && strcmp (array[i - 1], p) > 0)
+	sorted = false;
+    }
 
-  qsort (array, dirsize, sizeof (array[0]), compare_dirnames);
+  if (!sorted)
+    qsort (array, dirsize, sizeof (array[0]), compare_dirnames);
 
   /* Prepare space for new dumpdir */
   new_dump = xmalloc (len);
@@ -966,10 +1311,12 @@ static FILE *listed_incremental_stream;
    incremental snapshots as per tar version before 1.15.2.
 
    The current tar version supports incremental versions from
-   0 up to TAR_INCREMENTAL_VERSION, inclusive.
-   It is able to create only snapshots of TAR_INCREMENTAL_VERSION */
+   0 up to TAR_INCREMENTAL_BINARY_VERSION, inclusive.
+   It is able to create snapshots of TAR_INCREMENTAL_VERSION, the
+   default, and of TAR_INCREMENTAL_BINARY_VERSION */
 
 #define TAR_INCREMENTAL_VERSION 2
+#define TAR_INCREMENTAL_BINARY_VERSION 3
 
 /* Read incremental snapshot formats 0 and 1 */
 static void
@@ -1086,7 +1433,7 @@ read_incr_db_01 (int version, const char *initbuf)
 
       strp++;
       unquote_string (strp);
-      note_directory (strp, mtime, dev, ino, nfs, false, NULL);
+      note_directory (strp, mtime, dev, ino, nfs, false, NULL, NULL);
     }
   free (buf);
 }
@@ -1269,7 +1616,7 @@ read_incr_db_2 (void)
 		      _("Missing record terminator")));
 
       content = obstack_finish (&stk);
-      note_directory (name, mtime, dev, ino, nfs, false, content);
+      note_directory (name, mtime, dev, ino, nfs, false, content, NULL);
       obstack_free (&stk, content);
     }
   FATAL_ERROR ((0, 0, "%s: %s",
@@ -1277,6 +1624,94 @@ read_incr_db_2 (void)
 		_("Unexpected EOF in snapshot file")));
 }
 
+/* Read incremental snapshot format 3.  Only its header is read here:
+   directories are entered into the tables as they are looked up,
+   provided that the canonical names recorded in the snapshot were
+   computed relative to the same working directory as now.  */
+static void
+read_incr_db_3 (void)
+{
+  FILE *fp = listed_incremental_stream;
+  off_t start = ftello (fp);
+  struct stat st;
+  char const *header;
+  uint_least64_t off, size, ndirs, nbuckets;
+  char *cwd;
+  size_t i;
+
+  if (start < 0 || fstat (fileno (fp), &st) != 0)
+    read_fatal (listed_incremental_option);
+  if (SIZE_MAX < st.st_size)
+    xalloc_die ();
+  snap_size = st.st_size;
+  off = ((uint_least64_t) start + 7) & ~ (uint_least64_t) 7;
+  if (! (off <= snap_size && SNAP_HEADER_WORDS <= (snap_size - off) / 8))
+    snap_corrupt ();
+
+#if HAVE_SYS_MMAN_H
+  snap_data = mmap (NULL, snap_size, PROT_READ, MAP_PRIVATE, fileno (fp), 0);
+  snap_mapped = snap_data != MAP_FAILED;
+  if (! snap_mapped)
+    snap_data = NULL;
+#endif
+  if (! snap_data)
+    {
+      snap_data = xmalloc (snap_size);
+      if (fseeko (fp, 0, SEEK_SET) != 0
+	  || fread (snap_data, 1, snap_size, fp) != snap_size)
+	read_fatal (listed_incremental_option);
+    }
+
+  header = snap_data + off;
+#define SNAP_HEADER(w) snap_get (header + (w) * 8)
+  if (SNAP_HEADER (SNAP_MAGIC) != SNAP_MAGIC_NUMBER)
+    snap_corrupt ();
+  newer_mtime_option.tv_sec = snap_int (SNAP_HEADER (SNAP_TIME_SEC),
+					TYPE_MINIMUM (time_t),
+					TYPE_MAXIMUM (time_t));
+  newer_mtime_option.tv_nsec = snap_int (SNAP_HEADER (SNAP_TIME_NSEC),
+					 0, BILLION - 1);
+
+  off = SNAP_HEADER (SNAP_RECORDS);
+  ndirs = SNAP_HEADER (SNAP_NDIRS);
+  if (! (off <= snap_size
+	 && ndirs <= (snap_size - off) / (SNAP_RECORD_WORDS * 8)))
+    snap_corrupt ();
+  snap_records = snap_data + off;
+  snap_ndirs = ndirs;
+
+  off = SNAP_HEADER (SNAP_STRINGS);
+  size = SNAP_HEADER (SNAP_STRINGS_SIZE);
+  if (! (off <= snap_size && size <= snap_size - off))
+    snap_corrupt ();
+  snap_strings = snap_data + off;
+  snap_strings_size = size;
+
+  nbuckets = SNAP_HEADER (SNAP_NBUCKETS);
+  off = SNAP_HEADER (SNAP_NAME_INDEX);
+  if (! (0 < nbuckets && off <= snap_size
+	 && nbuckets <= (snap_size - off) / 8))
+    snap_corrupt ();
+  snap_name_index = snap_data + off;
+  off = SNAP_HEADER (SNAP_META_INDEX);
+  if (! (off <= snap_size && nbuckets <= (snap_size - off) / 8))
+    snap_corrupt ();
+  snap_meta_index = snap_data + off;
+  snap_nbuckets = nbuckets;
+
+  snap_loaded = xzalloc (snap_ndirs / CHAR_BIT + 1);
+
+  cwd = normalize_filename (chdir_current, ".");
+  if (strcmp (snap_string (SNAP_HEADER (SNAP_BASE)), cwd) != 0)
+    {
+      for (i = 0; i < snap_ndirs; i++)
+	snap_load (i, false);
+      snap_release ();
+    }
+  free (cwd);
+#undef SNAP_HEADER
+}
+
 /* Display (to stdout) the range of allowed values for each field
    in the snapshot file.  The array below should be kept in sync
    with any changes made to the read_num() calls in the parsing
@@ -1362,6 +1797,7 @@ read_directory_file (void)
      which is necessary to recreate absolute file names. */
   name_from_list ();
   blank_name_list ();
+  snapshot_chdir = chdir_current;
 
   if (0 < getline (&buf, &bufsize, listed_incremental_stream))
     {
@@ -1393,10 +1829,15 @@ read_directory_file (void)
 	  read_incr_db_2 ();
 	  break;
 
+	case TAR_INCREMENTAL_BINARY_VERSION:
+	  read_incr_db_3 ();
+	  break;
+
 	default:
 	  ERROR ((1, 0, _("Unsupported incremental format version: %"PRIuMAX),
 		  incremental_version));
 	}
+      snapshot_read_version = incremental_version;
 
     }
 
@@ -1450,33 +1891,235 @@ write_directory_file_entry (void *entry, void *data)
   return ! ferror (fp);
 }
 
+/* Directories to be written to a snapshot in format 3.  */
+struct snap_dirs
+{
+  struct directory **v;
+  size_t n;
+  size_t alloc;
+};
+
+/* Add the directory ENTRY to the snap_dirs DATA, if it was found.  */
+static bool
+collect_found_directory (void *entry, void *data)
+{
+  struct directory *directory = entry;
+  struct snap_dirs *dirs = data;
+
+  if (DIR_IS_FOUND (directory))
+    {
+      if (dirs->n == dirs->alloc)
+	dirs->v = x2nrealloc (dirs->v, &dirs->alloc, sizeof *dirs->v);
+      dirs->v[dirs->n++] = directory;
+    }
+  return true;
+}
+
+/* Write N words from W to FP, in little-endian order.  */
+static void
+snap_put (FILE *fp, uint_least64_t const *w, size_t n)
+{
+  unsigned char buf[8];
+  size_t i;
+  int j;
+
+  for (i = 0; i < n; i++)
+    {
+      for (j = 0; j < 8; j++)
+	buf[j] = (w[i] >> (j * 8)) & 0xff;
+      fwrite (buf, sizeof buf, 1, fp);
+    }
+}
+
+/* Pad FP with null bytes to a multiple of 8 bytes.  Return the
+   resulting offset.  */
+static uint_least64_t
+snap_align (FILE *fp, uint_least64_t off)
+{
+  static char const zeros[8];
+  uint_least64_t n = -off & 7;
+
+  fwrite (zeros, 1, n, fp);
+  return off + n;
+}
+
+/* Return the number of bytes of the contents of DIRECTORY as written
+   to a snapshot.  */
+static uint_least64_t
+snap_dumpdir_size (struct directory const *directory)
+{
+  uint_least64_t size = 1;
+
+  if (directory->dump)
+    {
+      const char *p;
+      struct dumpdir_iter *itr;
+
+      for (p = dumpdir_first (directory->dump, 0, &itr); p;
+	   p = dumpdir_next (itr))
+	size += strlen (p) + 1;
+      free (itr);
+    }
+  return size;
+}
+
+/* Write incremental snapshot format 3 to FP, which is at offset START
+   just after the format identifier line.  Along with the directories
+   found, record their canonical names as computed relative to the
+   working directory when the snapshot was read, and that directory,
+   so that the next run can tell whether the canonical names still
+   hold.  The records are followed by the string table, of names and
+   contents, and then by the hash indexes, whose chains go forward
+   in the order of the records.  */
+static void
+write_incr_db_3 (FILE *fp, uint_least64_t start)
+{
+  struct snap_dirs dirs = { NULL, 0, 0 };
+  uint_least64_t header[SNAP_HEADER_WORDS] = { 0 };
+  uint_least64_t rec[SNAP_RECORD_WORDS];
+  uint_least64_t *name_heads, *meta_heads, *name_next, *meta_next;
+  uint_least64_t off, pos;
+  size_t i, n, nbuckets;
+  char **canames;
+  char *base;
+
+  if (directory_table)
+    hash_do_for_each (directory_table, collect_found_directory, &dirs);
+  n = dirs.n;
+  for (nbuckets = 1; nbuckets < n; nbuckets *= 2)
+    continue;
+
+  base = normalize_filename (snapshot_chdir, ".");
+  canames = xnmalloc (n + 1, sizeof *canames);
+  name_heads = xcalloc (nbuckets, sizeof *name_heads);
+  meta_heads = xcalloc (nbuckets, sizeof *meta_heads);
+  name_next = xnmalloc (n + 1, sizeof *name_next);
+  meta_next = xnmalloc (n + 1, sizeof *meta_next);
+
+  pos = strlen (base) + 1;
+  for (i = 0; i < n; i++)
+    {
+      canames[i] = normalize_filename (snapshot_chdir, dirs.v[i]->name);
+      pos += (strlen (dirs.v[i]->name) + 1 + strlen (canames[i]) + 1
+	      + snap_dumpdir_size (dirs.v[i]));
+    }
+  for (i = n; i-- > 0; )
+    {
+      size_t b = snap_hash_name (canames[i]) % nbuckets;
+      name_next[i] = name_heads[b];
+      name_heads[b] = i + 1;
+      b = (snap_hash_meta (dirs.v[i]->device_number, dirs.v[i]->inode_number)
+	   % nbuckets);
+      meta_next[i] = meta_heads[b];
+      meta_heads[b] = i + 1;
+    }
+
+  off = snap_align (fp, start);
+  header[SNAP_MAGIC] = SNAP_MAGIC_NUMBER;
+  header[SNAP_TIME_SEC] = start_time.tv_sec;
+  header[SNAP_TIME_NSEC] = start_time.tv_nsec;
+  header[SNAP_BASE] = 0;
+  header[SNAP_NDIRS] = n;
+  header[SNAP_RECORDS] = off + sizeof header;
+  header[SNAP_STRINGS] = header[SNAP_RECORDS] + n * sizeof rec;
+  header[SNAP_STRINGS_SIZE] = pos;
+  header[SNAP_NBUCKETS] = nbuckets;
+  header[SNAP_NAME_INDEX] = ((header[SNAP_STRINGS] + pos + 7)
+			     & ~ (uint_least64_t) 7);
+  header[SNAP_META_INDEX] = header[SNAP_NAME_INDEX] + nbuckets * 8;
+  snap_put (fp, header, SNAP_HEADER_WORDS);
+
+  pos = strlen (base) + 1;
+  for (i = 0; i < n; i++)
+    {
+      struct directory const *directory = dirs.v[i];
+      rec[SNAP_REC_NFS] = DIR_IS_NFS (directory) != 0;
+      rec[SNAP_REC_MTIME_SEC] = directory->mtime.tv_sec;
+      rec[SNAP_REC_MTIME_NSEC] = directory->mtime.tv_nsec;
+      rec[SNAP_REC_DEV] = directory->device_number;
+      rec[SNAP_REC_INO] = directory->inode_number;
+      rec[SNAP_REC_NAME] = pos;
+      pos += strlen (directory->name) + 1;
+      rec[SNAP_REC_CANAME] = pos;
+      pos += strlen (canames[i]) + 1;
+      rec[SNAP_REC_DUMPDIR] = pos;
+      pos += snap_dumpdir_size (directory);
+      rec[SNAP_REC_NAME_NEXT] = name_next[i];
+      rec[SNAP_REC_META_NEXT] = meta_next[i];
+      snap_put (fp, rec, SNAP_RECORD_WORDS);
+    }
+
+  fwrite (base, strlen (base) + 1, 1, fp);
+  for (i = 0; i < n; i++)
+    {
+      struct directory const *directory = dirs.v[i];
+      fwrite (directory->name, strlen (directory->name) + 1, 1, fp);
+      fwrite (canames[i], strlen (canames[i]) + 1, 1, fp);
+      if (directory->dump)
+	{
+	  const char *p;
+	  struct dumpdir_iter *itr;
+
+	  for (p = dumpdir_first (directory->dump, 0, &itr); p;
+	       p = dumpdir_next (itr))
+	    fwrite (p, strlen (p) + 1, 1, fp);
+	  free (itr);
+	}
+      fputc (0, fp);
+      free (canames[i]);
+    }
+  snap_align (fp, header[SNAP_STRINGS] + pos);
+  snap_put (fp, name_heads, nbuckets);
+  snap_put (fp, meta_heads, nbuckets);
+
+  free (base);
+  free (canames);
+  free (name_heads);
+  free (meta_heads);
+  free (name_next);
+  free (meta_next);
+  free (dirs.v);
+}
+
 void
 write_directory_file (void)
 {
   FILE *fp = listed_incremental_stream;
   char buf[UINTMAX_STRSIZE_BOUND];
   char *s;
+  int version = (snapshot_format_option ? snapshot_format_option
+		 : snapshot_read_version == TAR_INCREMENTAL_BINARY_VERSION
+		 ? TAR_INCREMENTAL_BINARY_VERSION
+		 : TAR_INCREMENTAL_VERSION);
 
   if (! fp)
     return;
 
+  /* The snapshot read may be mapped from the file about to be
+     truncated.  */
+  snap_release ();
+
   if (fseeko (fp, 0L, SEEK_SET) != 0)
     seek_error (listed_incremental_option);
   if (sys_truncate (fileno (fp)) != 0)
     truncate_error (listed_incremental_option);
 
-  fprintf (fp, "%s-%s-%d\n", PACKAGE_NAME, PACKAGE_VERSION,
-	   TAR_INCREMENTAL_VERSION);
+  fprintf (fp, "%s-%s-%d\n", PACKAGE_NAME, PACKAGE_VERSION, version);
 
-  s = (TYPE_SIGNED (time_t)
-       ? imaxtostr (start_time.tv_sec, buf)
-       : umaxtostr (start_time.tv_sec, buf));
-  fwrite (s, strlen (s) + 1, 1, fp);
-  s = umaxtostr (start_time.tv_nsec, buf);
-  fwrite (s, strlen (s) + 1, 1, fp);
+  if (version == TAR_INCREMENTAL_BINARY_VERSION)
+    write_incr_db_3 (fp, ftello (fp));
+  else
+    {
+      s = (TYPE_SIGNED (time_t)
+	   ? imaxtostr (start_time.tv_sec, buf)
+	   : umaxtostr (start_time.tv_sec, buf));
+      fwrite (s, strlen (s) + 1, 1, fp);
+      s = umaxtostr (start_time.tv_nsec, buf);
+      fwrite (s, strlen (s) + 1, 1, fp);
 
-  if (! ferror (fp) && directory_table)
-    hash_do_for_each (directory_table, write_directory_file_entry, fp);
+      if (! ferror (fp) && directory_table)
+	hash_do_for_each (directory_table, write_directory_file_entry, fp);
+    }
 
   if (ferror (fp))
     write_error (listed_incremental_option);
@@ -170,9 +170,11 @@ read_and (void (*do_something) (void))
   enum read_header status = HEADER_STILL_UNREAD;
   enum read_header prev_status;
   struct timespec mtime;
+  bool use_toc;
 
   base64_init ();
   name_gather ();
+  use_toc = use_toc_option && toc_start ();
 
   open_archive (ACCESS_READ);
   do
@@ -180,6 +182,12 @@ read_and (void (*do_something) (void))
       prev_status = status;
       tar_stat_destroy (&current_stat_info);
 
+      /* With a table of contents, go to the next member selected in it.
+	 The first header is read anyway, so as not to miss a volume
+	 label or global extended header at the start of the archive.  */
+      if (use_toc && status != HEADER_STILL_UNREAD && !toc_skip ())
+	break;
+
       status = read_header (&current_header, &current_stat_info,
                             read_header_auto);
       switch (status)
@@ -194,6 +202,8 @@ read_and (void (*do_something) (void))
 	     Ensure incoming names are null terminated.  */
 	  decode_header (current_header, &current_stat_info,
 			 &current_format, 1);
+	  if (use_toc)
+	    toc_check (current_stat_info.file_name);
 	  if (! name_match (current_stat_info.file_name)
 	      || (TIME_OPTION_INITIALIZED (newer_mtime_option)
 		  /* FIXME: We get mtime now, and again later; this causes
@@ -273,6 +283,8 @@ read_and (void (*do_something) (void))
 	  break;
 
 	case HEADER_FAILURE:
+	  if (use_toc)
+	    toc_check (NULL);
 	  /* If the previous header was good, tell them that we are
 	     skipping bad ones.  */
 	  set_next_block_after (current_header);
@@ -310,6 +322,8 @@ read_and (void (*do_something) (void))
   while (!all_names_found (&current_stat_info));
 
   close_archive ();
+  if (use_toc)
+    toc_finish ();
   names_notfound ();		/* print names not found */
 }
 
@@ -350,18 +364,12 @@ enum read_header
 tar_checksum (union block *header, bool silent)
 {
   size_t i;
-  int unsigned_sum = 0;		/* the POSIX one :-) */
-  int signed_sum = 0;		/* the Sun one :-( */
+  int unsigned_sum;		/* the POSIX one :-) */
+  int signed_sum;		/* the Sun one :-( */
   int recorded_sum;
   int parsed_sum;
-  char *p;
 
-  p = header->buffer;
-  for (i = sizeof *header; i-- != 0;)
-    {
-      unsigned_sum += (unsigned char) *p;
-      signed_sum += (signed char) (*p++);
-    }
+  block_sums (header->buffer, &unsigned_sum, &signed_sum);
 
   if (unsigned_sum == 0)
     return HEADER_ZERO_BLOCK;
@@ -25,6 +25,10 @@
 #include <unlinkdir.h>
 #include <utimens.h>
 
+#if HAVE_SYS_RESOURCE_H
+# include <sys/resource.h>
+#endif
+
 #ifndef DOUBLE_SLASH_IS_DISTINCT_ROOT
 # define DOUBLE_SLASH_IS_DISTINCT_ROOT 0
 #endif
@@ -891,6 +895,12 @@ struct wd
      the working directory.  If zero, the directory needs to be opened
      to be used.  */
   int fd;
+  /* If FD is positive, the indexes into WD of the previous and next
+     directories in the list of those with open file descriptors,
+     or -1 at either end of the list.  */
+  int prev, next;
+  /* True if the directory was opened before.  */
+  bool opened;
 };
 
 /* A vector of chdir targets.  wd[0] is the initial working directory.  */
@@ -902,19 +912,85 @@ static size_t wd_count;
 /* The allocated size of the vector.  */
 static size_t wd_alloc;
 
-/* The maximum number of chdir targets with open directories.
-   Don't make it too large, as many operating systems have a small
-   limit on the number of open file descriptors.  Also, the current
-   implementation does not scale well.  */
-enum { CHDIR_CACHE_SIZE = 16 };
+/* The minimum and maximum number of chdir targets with open
+   directories.  Between these, the number is a quarter of the limit on
+   open file descriptors, which leaves descriptors for the files being
+   archived or extracted, and for the threads that handle them.  */
+enum { CHDIR_CACHE_MIN = 16, CHDIR_CACHE_MAX = 4096 };
 
-/* Indexes into WD of chdir targets with open file descriptors, sorted
-   most-recently used first.  Zero indexes are unused.  */
-static int wdcache[CHDIR_CACHE_SIZE];
+/* The maximum number of chdir targets with open directories, or zero
+   if not determined yet.  */
+static size_t wdcache_size;
 
-/* Number of nonzero entries in WDCACHE.  */
+/* Indexes into WD of the most and least recently used chdir targets
+   with open file descriptors, or -1 if there are none.  */
+static int wdcache_head = -1, wdcache_tail = -1;
+
+/* Number of chdir targets with open file descriptors.  */
 static size_t wdcache_count;
 
+/* Number of changes to a chdir target whose directory was open, and
+   number of times a directory had to be opened again.  */
+static uintmax_t wdcache_hits, wdcache_reopens;
+
+static size_t
+wdcache_capacity (void)
+{
+#if HAVE_SYS_RESOURCE_H && defined RLIMIT_NOFILE
+  struct rlimit rlim;
+  if (getrlimit (RLIMIT_NOFILE, &rlim) == 0)
+    {
+      if (rlim.rlim_cur == RLIM_INFINITY
+	  || CHDIR_CACHE_MAX <= rlim.rlim_cur / 4)
+	return CHDIR_CACHE_MAX;
+      if (CHDIR_CACHE_MIN < rlim.rlim_cur / 4)
+	return rlim.rlim_cur / 4;
+    }
+#endif
+  return CHDIR_CACHE_MIN;
+}
+
+/* Remove chdir target I from the list of those with open file
+   descriptors.  */
+static void
+wdcache_unlink (int i)
+{
+  struct wd *w = &wd[i];
+  if (0 <= w->prev)
+    wd[w->prev].next = w->next;
+  else
+    wdcache_head = w->next;
+  if (0 <= w->next)
+    wd[w->next].prev = w->prev;
+  else
+    wdcache_tail = w->prev;
+}
+
+/* Put chdir target I at the front of the list of those with open file
+   descriptors.  */
+static void
+wdcache_push (int i)
+{
+  struct wd *w = &wd[i];
+  w->prev = -1;
+  w->next = wdcache_head;
+  if (0 <= wdcache_head)
+    wd[wdcache_head].prev = i;
+  else
+    wdcache_tail = i;
+  wdcache_head = i;
+}
+
+/* Store into *HITS the number of changes to a chdir target whose
+   directory was open, and into *REOPENS the number of times a
+   directory had to be opened again.  */
+void
+chdir_cache_stats (uintmax_t *hits, uintmax_t *reopens)
+{
+  *hits = wdcache_hits;
+  *reopens = wdcache_reopens;
+}
+
 int
 chdir_count (void)
 {
@@ -939,6 +1015,8 @@ chdir_arg (char const *dir)
 	  wd[wd_count].name = ".";
 	  wd[wd_count].abspath = NULL;
 	  wd[wd_count].fd = AT_FDCWD;
+	  wd[wd_count].prev = wd[wd_count].next = -1;
+	  wd[wd_count].opened = false;
 	  wd_count++;
 	}
     }
@@ -957,6 +1035,8 @@ chdir_arg (char const *dir)
   wd[wd_count].name = dir;
   wd[wd_count].abspath = NULL;
   wd[wd_count].fd = 0;
+  wd[wd_count].prev = wd[wd_count].next = -1;
+  wd[wd_count].opened = false;
   return wd_count++;
 }
 
@@ -992,36 +1072,32 @@ chdir_do (int i)
 	    open_fatal (curr->name);
 
 	  curr->fd = fd;
-
-	  /* Add I to the cache, tossing out the lowest-ranking entry if the
-	     cache is full.  */
-	  if (wdcache_count < CHDIR_CACHE_SIZE)
-	    wdcache[wdcache_count++] = i;
+	  if (curr->opened)
+	    wdcache_reopens++;
+	  curr->opened = true;
+
+	  /* Add I to the cache, tossing out the least recently used
+	     entry if the cache is full.  */
+	  if (! wdcache_size)
+	    wdcache_size = wdcache_capacity ();
+	  if (wdcache_count < wdcache_size)
+	    wdcache_count++;
 	  else
 	    {
-	      struct wd *stale = &wd[wdcache[CHDIR_CACHE_SIZE - 1]];
+	      struct wd *stale = &wd[wdcache_tail];
+	      wdcache_unlink (wdcache_tail);
 	      if (close (stale->fd) != 0)
 		close_diag (stale->name);
 	      stale->fd = 0;
-	      wdcache[CHDIR_CACHE_SIZE - 1] = i;
 	    }
+	  wdcache_push (i);
 	}
-
-      if (0 < fd)
+      else if (0 < fd)
 	{
-	  /* Move the i value to the front of the cache.  This is
-	     O(CHDIR_CACHE_SIZE), but the cache is small.  */
-	  size_t ci;
-	  int prev = wdcache[0];
-	  for (ci = 1; prev != i; ci++)
-	    {
-	      int cur = wdcache[ci];
-	      wdcache[ci] = prev;
-	      if (cur == i)
-		break;
-	      prev = cur;
-	    }
-	  wdcache[0] = i;
+	  /* Move I to the front of the cache.  */
+	  wdcache_hits++;
+	  wdcache_unlink (i);
+	  wdcache_push (i);
 	}
 
       chdir_current = i;
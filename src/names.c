@@ -297,7 +297,7 @@ add_exclude_array (char const * const * fv, int opts)
   int i;
 
   for (i = 0; fv[i]; i++)
-    add_exclude (excluded, fv[i], opts);
+    exclmatch_add (excluded, fv[i], opts);
 }
 
 static void
@@ -310,7 +310,7 @@ handle_file_selection_option (int key, const char *arg)
       break;
 
     case EXCLUDE_OPTION:
-      add_exclude (excluded, arg, EXCLUDE_OPTIONS);
+      exclmatch_add (excluded, arg, EXCLUDE_OPTIONS);
       break;
 
     case EXCLUDE_CACHES_OPTION:
@@ -383,8 +383,7 @@ handle_file_selection_option (int key, const char *arg)
       break;
 
     case 'X':
-      if (add_exclude_file (add_exclude, excluded, arg, EXCLUDE_OPTIONS, '\n')
-	  != 0)
+      if (exclmatch_add_file (excluded, arg, EXCLUDE_OPTIONS, '\n') != 0)
 	{
 	  int e = errno;
 	  FATAL_ERROR ((0, e, "%s", quotearg_colon (arg)));
@@ -455,108 +454,141 @@ struct argp names_argp = {
    This code should also be modified for non-UNIX systems to do something
    reasonable.  */
 
-static char *cached_uname;
-static char *cached_gname;
+/* Names of the user and group IDs, and IDs of the user and group
+   names, looked up so far.  With network databases each lookup may be
+   a round trip, so failed lookups are remembered too.  */
 
-static uid_t cached_uid;	/* valid only if cached_uname is not empty */
-static gid_t cached_gid;	/* valid only if cached_gname is not empty */
+struct id_entry
+{
+  uintmax_t id;			/* user or group ID */
+  char *name;			/* its name */
+  bool found;			/* false if the lookup failed */
+};
+
+static Hash_table *uid_names;	/* uid_to_uname results, by ID */
+static Hash_table *gid_names;	/* gid_to_gname results, by ID */
+static Hash_table *uname_ids;	/* uname_to_uid results, by name */
+static Hash_table *gname_ids;	/* gname_to_gid results, by name */
+
+static size_t
+id_entry_hash_id (void const *entry, size_t n_buckets)
+{
+  struct id_entry const *ent = entry;
+  return ent->id % n_buckets;
+}
 
-/* These variables are valid only if nonempty.  */
-static char *cached_no_such_uname;
-static char *cached_no_such_gname;
+static bool
+id_entry_compare_id (void const *entry1, void const *entry2)
+{
+  struct id_entry const *ent1 = entry1;
+  struct id_entry const *ent2 = entry2;
+  return ent1->id == ent2->id;
+}
 
-/* These variables are valid only if nonzero.  It's not worth optimizing
-   the case for weird systems where 0 is not a valid uid or gid.  */
-static uid_t cached_no_such_uid;
-static gid_t cached_no_such_gid;
+static size_t
+id_entry_hash_name (void const *entry, size_t n_buckets)
+{
+  struct id_entry const *ent = entry;
+  return hash_string (ent->name, n_buckets);
+}
+
+static bool
+id_entry_compare_name (void const *entry1, void const *entry2)
+{
+  struct id_entry const *ent1 = entry1;
+  struct id_entry const *ent2 = entry2;
+  return strcmp (ent1->name, ent2->name) == 0;
+}
+
+/* Look up ID in TABLE, which is indexed by IDs.  */
+static struct id_entry *
+id_cache_find_id (Hash_table const *table, uintmax_t id)
+{
+  struct id_entry key;
+
+  if (!table)
+    return NULL;
+  key.id = id;
+  return hash_lookup (table, &key);
+}
+
+/* Look up NAME in TABLE, which is indexed by names.  */
+static struct id_entry *
+id_cache_find_name (Hash_table const *table, char const *name)
+{
+  struct id_entry key;
+
+  if (!table)
+    return NULL;
+  key.name = (char *) name;
+  return hash_lookup (table, &key);
+}
+
+/* Record in *TABLE, created with HASHER and COMPARATOR if needed, the
+   result of looking up ID or NAME.  */
+static struct id_entry *
+id_cache_add (Hash_table **table, Hash_hasher hasher,
+	      Hash_comparator comparator,
+	      uintmax_t id, char const *name, bool found)
+{
+  struct id_entry *ent = xmalloc (sizeof *ent);
+
+  ent->id = id;
+  ent->name = xstrdup (name);
+  ent->found = found;
+  if (!((*table
+	 || (*table = hash_initialize (0, 0, hasher, comparator, 0)))
+	&& hash_insert (*table, ent)))
+    xalloc_die ();
+  return ent;
+}
 
 /* Given UID, find the corresponding UNAME.  */
 void
 uid_to_uname (uid_t uid, char **uname)
 {
-  struct passwd *passwd;
+  struct id_entry *ent = id_cache_find_id (uid_names, uid);
 
-  if (uid != 0 && uid == cached_no_such_uid)
+  if (!ent)
     {
-      *uname = xstrdup ("");
-      return;
-    }
-
-  if (!cached_uname || uid != cached_uid)
-    {
-      passwd = getpwuid (uid);
-      if (passwd)
-	{
-	  cached_uid = uid;
-	  assign_string (&cached_uname, passwd->pw_name);
-	}
-      else
-	{
-	  cached_no_such_uid = uid;
-	  *uname = xstrdup ("");
-	  return;
-	}
+      struct passwd *passwd = getpwuid (uid);
+      ent = id_cache_add (&uid_names, id_entry_hash_id, id_entry_compare_id,
+			  uid, passwd ? passwd->pw_name : "", !!passwd);
     }
-  *uname = xstrdup (cached_uname);
+  *uname = xstrdup (ent->name);
 }
 
 /* Given GID, find the corresponding GNAME.  */
 void
 gid_to_gname (gid_t gid, char **gname)
 {
-  struct group *group;
+  struct id_entry *ent = id_cache_find_id (gid_names, gid);
 
-  if (gid != 0 && gid == cached_no_such_gid)
+  if (!ent)
     {
-      *gname = xstrdup ("");
-      return;
-    }
-
-  if (!cached_gname || gid != cached_gid)
-    {
-      group = getgrgid (gid);
-      if (group)
-	{
-	  cached_gid = gid;
-	  assign_string (&cached_gname, group->gr_name);
-	}
-      else
-	{
-	  cached_no_such_gid = gid;
-	  *gname = xstrdup ("");
-	  return;
-	}
+      struct group *group = getgrgid (gid);
+      ent = id_cache_add (&gid_names, id_entry_hash_id, id_entry_compare_id,
+			  gid, group ? group->gr_name : "", !!group);
     }
-  *gname = xstrdup (cached_gname);
+  *gname = xstrdup (ent->name);
 }
 
 /* Given UNAME, set the corresponding UID and return 1, or else, return 0.  */
 int
 uname_to_uid (char const *uname, uid_t *uidp)
 {
-  struct passwd *passwd;
+  struct id_entry *ent = id_cache_find_name (uname_ids, uname);
 
-  if (cached_no_such_uname
-      && strcmp (uname, cached_no_such_uname) == 0)
-    return 0;
-
-  if (!cached_uname
-      || uname[0] != cached_uname[0]
-      || strcmp (uname, cached_uname) != 0)
+  if (!ent)
     {
-      passwd = getpwnam (uname);
-      if (passwd)
-	{
-	  cached_uid = passwd->pw_uid;
-	  assign_string (&cached_uname, passwd->pw_name);
-	}
-      else
-	{
-	  assign_string (&cached_no_such_uname, uname);
-	  return 0;
-	}
+      struct passwd *passwd = getpwnam (uname);
+      ent = id_cache_add (&uname_ids,
+			  id_entry_hash_name, id_entry_compare_name,
+			  passwd ? passwd->pw_uid : 0, uname, !!passwd);
     }
-  *uidp = cached_uid;
+  if (!ent->found)
+    return 0;
+  *uidp = ent->id;
   return 1;
 }
 
@@ -564,29 +596,18 @@ uname_to_uid (char const *uname, uid_t *uidp)
 int
 gname_to_gid (char const *gname, gid_t *gidp)
 {
-  struct group *group;
+  struct id_entry *ent = id_cache_find_name (gname_ids, gname);
 
-  if (cached_no_such_gname
-      && strcmp (gname, cached_no_such_gname) == 0)
-    return 0;
-
-  if (!cached_gname
-      || gname[0] != cached_gname[0]
-      || strcmp (gname, cached_gname) != 0)
+  if (!ent)
     {
-      group = getgrnam (gname);
-      if (group)
-	{
-	  cached_gid = group->gr_gid;
-	  assign_string (&cached_gname, gname);
-	}
-      else
-	{
-	  assign_string (&cached_no_such_gname, gname);
-	  return 0;
-	}
+      struct group *group = getgrnam (gname);
+      ent = id_cache_add (&gname_ids,
+			  id_entry_hash_name, id_entry_compare_name,
+			  group ? group->gr_gid : 0, gname, !!group);
     }
-  *gidp = cached_gid;
+  if (!ent->found)
+    return 0;
+  *gidp = ent->id;
   return 1;
 }
 
@@ -1161,8 +1182,152 @@ name_is_wildcard (struct name const *name)
     fnmatch_pattern_has_wildcards (name->name, name->matching_flags);
 }
 
-/* Gather names in a list for scanning.  Could hash them later if we
-   really care.
+/* Index of the name list, so that namelist_match need not try every
+   name against every archive member.  A name that is matched literally,
+   anchored and case-sensitively matches only a file name equal to it
+   or, with recursion, one with a leading directory equal to it.  Such
+   names are kept in NAMELIST_TABLE, keyed on their text, the names
+   with the same text being chained through their TWIN member.  The
+   other names, patterns in particular, are kept in NAMELIST_PATTERNS
+   and tried in turn.  The names are numbered in the order of the name
+   list, so that the first one that matches is still the one found.
+
+   The index is built by the first call to namelist_match, and kept up
+   to date by addname and remname.  Other changes to the name list
+   discard it.  */
+static Hash_table *namelist_table;
+static struct name **namelist_patterns;
+static size_t namelist_npatterns;
+static size_t namelist_patterns_alloc;
+static size_t namelist_seqno;	/* number of the last name indexed */
+
+static size_t
+namelist_hash (void const *entry, size_t n_buckets)
+{
+  struct name const *name = entry;
+  size_t value = 0;
+
+  for (size_t i = 0; i < name->length; i++)
+    value = (value * 31 + (unsigned char) name->name[i]) % n_buckets;
+  return value;
+}
+
+static bool
+namelist_compare (void const *entry1, void const *entry2)
+{
+  struct name const *name1 = entry1;
+  struct name const *name2 = entry2;
+  return (name1->length == name2->length
+	  && memcmp (name1->name, name2->name, name1->length) == 0);
+}
+
+/* Return true if NAME is matched literally, anchored and
+   case-sensitively, so that any file name it matches starts with it.
+   A backslash in a name matched with wildcards quotes the next
+   character, which does not match itself.  */
+static bool
+name_is_literal (struct name const *name)
+{
+  return (!name->is_wildcard
+	  && (name->matching_flags & EXCLUDE_ANCHORED)
+	  && !(name->matching_flags & FNM_CASEFOLD)
+	  && !((name->matching_flags & EXCLUDE_WILDCARDS)
+	       && !(name->matching_flags & FNM_NOESCAPE)
+	       && strchr (name->name, '\\')));
+}
+
+/* Add NAME, which is last in the name list, to the index.  */
+static void
+namelist_index_add (struct name *name)
+{
+  name->seqno = ++namelist_seqno;
+  name->twin = NULL;
+  if (!name->name[0])
+    return;
+  if (name_is_literal (name))
+    {
+      struct name *p = hash_insert (namelist_table, name);
+      if (!p)
+	xalloc_die ();
+      if (p != name)
+	{
+	  while (p->twin)
+	    p = p->twin;
+	  p->twin = name;
+	}
+    }
+  else
+    {
+      if (namelist_npatterns == namelist_patterns_alloc)
+	namelist_patterns = x2nrealloc (namelist_patterns,
+					&namelist_patterns_alloc,
+					sizeof *namelist_patterns);
+      namelist_patterns[namelist_npatterns++] = name;
+    }
+}
+
+/* Remove NAME from the index.  */
+static void
+namelist_index_remove (struct name *name)
+{
+  if (!name->name[0])
+    return;
+  if (name_is_literal (name))
+    {
+      struct name *p = hash_lookup (namelist_table, name);
+      if (p == name)
+	{
+	  hash_remove (namelist_table, name);
+	  if (name->twin && !hash_insert (namelist_table, name->twin))
+	    xalloc_die ();
+	}
+      else
+	{
+	  while (p->twin != name)
+	    p = p->twin;
+	  p->twin = name->twin;
+	}
+    }
+  else
+    {
+      size_t i;
+
+      for (i = 0; namelist_patterns[i] != name; i++)
+	continue;
+      namelist_npatterns--;
+      memmove (namelist_patterns + i, namelist_patterns + i + 1,
+	       (namelist_npatterns - i) * sizeof *namelist_patterns);
+    }
+}
+
+static void
+namelist_index_build (void)
+{
+  struct name *p;
+
+  namelist_table = hash_initialize (0, 0, namelist_hash, namelist_compare,
+				    NULL);
+  if (!namelist_table)
+    xalloc_die ();
+  namelist_npatterns = namelist_seqno = 0;
+  for (p = namelist; p; p = p->next)
+    namelist_index_add (p);
+}
+
+/* Discard the index, before the name list is changed otherwise than by
+   addname or remname.  */
+static void
+namelist_index_free (void)
+{
+  if (namelist_table)
+    {
+      hash_free (namelist_table);
+      namelist_table = NULL;
+    }
+  namelist_npatterns = 0;
+}
+
+/* Gather names in a list for scanning.
 
    If the names are already sorted to match the archive, we just read
    them one by one.  name_gather reads the first one, and it is called
@@ -1188,6 +1353,7 @@ name_gather (void)
 
       if (ep)
 	{
+	  namelist_index_free ();
 	  free_name (buffer);
 	  buffer = make_name (ep->v.name);
 	  buffer->change_dir = change_dir;
@@ -1248,6 +1414,8 @@ addname (char const *string, int change_dir, bool cmdline, struct name *parent)
   else
     namelist = name;
   nametail = name;
+  if (namelist_table)
+    namelist_index_add (name);
   return name;
 }
 
@@ -1256,6 +1424,7 @@ add_starting_file (char const *file_name)
 {
   struct name *name = make_name (file_name);
 
+  namelist_index_free ();
   if (starting_file_option)
     {
       struct name *head = namelist;
@@ -1285,17 +1454,49 @@ add_starting_file (char const *file_name)
 static struct name *
 namelist_match (char const *file_name, bool exact)
 {
-  struct name *p;
+  struct name *match = NULL;
+  struct name key;
+  size_t i;
 
-  for (p = namelist; p; p = p->next)
+  if (!namelist)
+    return NULL;
+  if (!namelist_table)
+    namelist_index_build ();
+
+  /* Look up FILE_NAME and each of its leading directories.  */
+  key.name = (char *) file_name;
+  for (key.length = 0; ; key.length++)
     {
-      if (p->name[0]
-	  && (exact ? !p->is_wildcard : true)
+      char c = file_name[key.length];
+
+      if (c == '/' || c == 0)
+	{
+	  struct name *p;
+
+	  for (p = hash_lookup (namelist_table, &key); p; p = p->twin)
+	    if (c == 0 || (p->matching_flags & FNM_LEADING_DIR))
+	      {
+		if (!match || p->seqno < match->seqno)
+		  match = p;
+		break;
+	      }
+	  if (c == 0)
+	    break;
+	}
+    }
+
+  for (i = 0; i < namelist_npatterns; i++)
+    {
+      struct name *p = namelist_patterns[i];
+
+      if (match && match->seqno < p->seqno)
+	break;
+      if ((exact ? !p->is_wildcard : true)
 	  && exclude_fnmatch (p->name, file_name, p->matching_flags))
 	return p;
     }
 
-  return NULL;
+  return match;
 }
 
 void
@@ -1312,6 +1513,9 @@ remname (struct name *name)
     p->prev = name->prev;
   else
     nametail = name->prev;
+
+  if (namelist_table)
+    namelist_index_remove (name);
 }
 
 /* Return true if and only if name FILE_NAME (from an archive) matches any
@@ -1329,6 +1533,7 @@ name_match (const char *file_name)
       if (cursor->name[0] == 0)
 	{
 	  chdir_do (cursor->change_dir);
+	  namelist_index_free ();
 	  namelist = NULL;
 	  nametail = NULL;
 	  return true;
@@ -1398,6 +1603,25 @@ all_names_found (struct tar_stat_info *p)
   return true;
 }
 
+/* Select in the table of contents the members that the name list
+   matches.  Return false without selecting anything if some names are
+   patterns, or are matched without regard to case or anchoring, as
+   the table of contents cannot be searched for them.  */
+bool
+namelist_select_toc (void)
+{
+  struct name const *cursor;
+
+  if (!namelist || same_order_option || starting_file_option)
+    return false;
+  for (cursor = namelist; cursor; cursor = cursor->next)
+    if (!cursor->name[0] || !name_is_literal (cursor))
+      return false;
+  for (cursor = namelist; cursor; cursor = cursor->next)
+    toc_select (cursor->name, cursor->matching_flags);
+  return true;
+}
+
 static int
 regex_usage_warning (const char *name)
 {
@@ -1436,6 +1660,7 @@ names_notfound (void)
       }
 
   /* Don't bother freeing the name list; we're about to exit.  */
+  namelist_index_free ();
   namelist = NULL;
   nametail = NULL;
 
@@ -1475,6 +1700,7 @@ label_notfound (void)
     }
 
   /* Don't bother freeing the name list; we're about to exit.  */
+  namelist_index_free ();
   namelist = NULL;
   nametail = NULL;
 
@@ -1824,6 +2050,7 @@ collect_and_sort_names (void)
       tar_stat_destroy (&st);
     }
 
+  namelist_index_free ();
   namelist = merge_sort (namelist, num_names, compare_names);
 
   num_names = 0;
@@ -1868,6 +2095,7 @@ collect_and_sort_names (void)
   nametail = prev_name;
   hash_free (nametab);
 
+  namelist_index_free ();
   namelist = merge_sort (namelist, num_names, compare_names_found);
 
   if (listed_incremental_option)
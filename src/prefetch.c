@@ -0,0 +1,433 @@
+/* Read ahead the contents of files being archived.
+
+   Copyright 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU tar.
+
+   GNU tar is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU tar is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* When creating an archive, the main thread dumps the members of a
+   directory one after another, so the latency of opening and reading
+   each file adds up.  With --read-threads=N, the entries of each
+   directory are queued as soon as its contents are known, and N
+   worker threads open and read the small regular files among them
+   into memory while the main thread is busy with the preceding ones.
+
+   The main thread still does all the work that affects the archive:
+   it stats and opens every file itself and writes headers and data
+   in the usual order.  When it reaches a file whose contents were
+   read ahead, it copies them from memory instead of reading the file,
+   provided that the file looks the same now as it did when it was
+   read.  Otherwise it reads the file as usual.  Files are not read
+   ahead when that could change access times stored in the archive.
+   The archive is thus the same as without this option.
+
+   Worker threads never report errors and never call functions that
+   are not thread safe (e.g. exclude or regex matching); any problem
+   merely means that the file is not read ahead.  */
+
+#include <system.h>
+#include "common.h"
+#include <full-read.h>
+#include <pthread.h>
+
+/* Maximum size of a file that is read ahead.  Larger files gain little
+   from overlapping their latency, and would tie up too much memory.  */
+enum { PREFETCH_FILE_MAX = 1024 * 1024 };
+
+/* Maximum total size of the file contents read ahead but not yet
+   consumed.  */
+enum { PREFETCH_MEMORY_MAX = 32 * 1024 * 1024 };
+
+enum prefetch_state
+  {
+    prefetch_queued,         /* Not yet taken by a worker */
+    prefetch_busy,           /* A worker is reading the file */
+    prefetch_done,           /* Finished; DATA is the contents, if any */
+    prefetch_cancelled       /* The main thread does not need the file */
+  };
+
+struct prefetch_item
+  {
+    char const *name;        /* File name relative to the directory */
+    enum prefetch_state state;
+    bool wanted;             /* The main thread is waiting for this item */
+    char *data;              /* File contents, or NULL if not read */
+    struct stat stat;        /* File status when DATA was read */
+  };
+
+struct prefetch_dir
+  {
+    struct prefetch_dir *prev; /* Directory being dumped by our caller */
+    int fd;                  /* Private descriptor of the directory */
+    struct prefetch_item *items; /* Files queued so far */
+    size_t nitems;           /* Number of elements in ITEMS */
+    size_t nalloc;           /* Number of allocated elements */
+    size_t next_queued;      /* Index of the next item for the workers */
+    size_t current;          /* Index past the item being dumped */
+  };
+
+/* The lock protects everything below, as well as the items of all
+   directories.  The condition is broadcast on every change of state.  */
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+
+/* Innermost directory being dumped.  Workers prefer its entries, since
+   the main thread needs them first.  */
+static struct prefetch_dir *prefetch_top;
+
+/* Total size of the DATA buffers in all items.  */
+static size_t prefetch_memory;
+
+/* Worker threads.  */
+static pthread_t *prefetch_threads;
+static int prefetch_nthreads;
+static bool prefetch_stop;
+
+/* Release the data held by ITEM.  The lock must be held.  */
+static void
+prefetch_item_free (struct prefetch_item *item)
+{
+  if (item->data)
+    {
+      free (item->data);
+      item->data = NULL;
+      prefetch_memory -= item->stat.st_size;
+      pthread_cond_broadcast (&prefetch_cond);
+    }
+}
+
+/* Reserve SIZE bytes for item I of DIR, waiting until enough memory is
+   released.  Give up if the main thread comes to need the item in the
+   meantime, since that memory may well be held by items it will only
+   consume later on.  The lock must not be held.  */
+static bool
+prefetch_reserve (struct prefetch_dir *dir, size_t i, size_t size)
+{
+  bool ok;
+
+  pthread_mutex_lock (&prefetch_lock);
+  while (! dir->items[i].wanted
+	 && PREFETCH_MEMORY_MAX - prefetch_memory < size)
+    pthread_cond_wait (&prefetch_cond, &prefetch_lock);
+  ok = ! dir->items[i].wanted;
+  if (ok)
+    prefetch_memory += size;
+  pthread_mutex_unlock (&prefetch_lock);
+  return ok;
+}
+
+static void
+prefetch_release (size_t size)
+{
+  pthread_mutex_lock (&prefetch_lock);
+  prefetch_memory -= size;
+  pthread_cond_broadcast (&prefetch_cond);
+  pthread_mutex_unlock (&prefetch_lock);
+}
+
+/* Read NAME, an entry of the directory DIR open on DIRFD and item I of
+   DIR, and store its status in *ST.  Return its contents, or NULL if
+   it is not worth reading or cannot be read.  */
+static char *
+prefetch_read (struct prefetch_dir *dir, size_t i, int dirfd,
+	       char const *name, struct stat *st)
+{
+  struct stat st1;
+  size_t size;
+  char *data;
+  int fd;
+
+  /* Look before opening, so that only regular files get opened: opening
+     e.g. a FIFO or a tape device may have side effects.  */
+  if (fstatat (dirfd, name, &st1, fstatat_flags) != 0
+      || ! S_ISREG (st1.st_mode)
+      || st1.st_size <= 0 || PREFETCH_FILE_MAX < st1.st_size
+      || (sparse_option && ST_IS_SPARSE (st1)))
+    return NULL;
+
+  size = st1.st_size;
+  if (! prefetch_reserve (dir, i, size))
+    return NULL;
+
+  data = malloc (size);
+  fd = data ? openat (dirfd, name, open_read_flags) : -1;
+  if (0 <= fd)
+    {
+      /* Make sure the file did not change while it was being read.  */
+      bool ok = (fstat (fd, st) == 0
+		 && S_ISREG (st->st_mode) && st->st_size == size
+		 && full_read (fd, data, size) == size
+		 && fstat (fd, &st1) == 0
+		 && st1.st_size == size
+		 && ! timespec_cmp (get_stat_mtime (st), get_stat_mtime (&st1))
+		 && ! timespec_cmp (get_stat_ctime (st), get_stat_ctime (&st1)));
+      if (close (fd) == 0 && ok)
+	return data;
+    }
+
+  free (data);
+  prefetch_release (size);
+  return NULL;
+}
+
+static void *
+prefetch_worker (MAYBE_UNUSED void *arg)
+{
+  pthread_mutex_lock (&prefetch_lock);
+  while (! prefetch_stop)
+    {
+      struct prefetch_dir *dir;
+      struct prefetch_item *item;
+      struct stat st;
+      char const *name;
+      char *data;
+      size_t i;
+      int dirfd;
+
+      for (dir = prefetch_top; dir; dir = dir->prev)
+	if (dir->next_queued < dir->nitems)
+	  break;
+      if (! dir)
+	{
+	  pthread_cond_wait (&prefetch_cond, &prefetch_lock);
+	  continue;
+	}
+
+      /* Skip the entries that the main thread has already reached.  */
+      if (dir->next_queued < dir->current)
+	dir->next_queued = dir->current;
+      if (dir->next_queued == dir->nitems)
+	continue;
+      i = dir->next_queued++;
+      item = &dir->items[i];
+      if (item->state != prefetch_queued)
+	continue;
+      item->state = prefetch_busy;
+      name = item->name;
+      dirfd = dir->fd;
+      pthread_mutex_unlock (&prefetch_lock);
+
+      data = prefetch_read (dir, i, dirfd, name, &st);
+
+      pthread_mutex_lock (&prefetch_lock);
+      /* DIR->items may have been reallocated in the meantime.  */
+      item = &dir->items[i];
+      item->data = data;
+      item->stat = st;
+      item->state = prefetch_done;
+      pthread_cond_broadcast (&prefetch_cond);
+    }
+  pthread_mutex_unlock (&prefetch_lock);
+  return NULL;
+}
+
+/* Start the worker threads, unless already done.  Return true if at
+   least one of them is running.  */
+static bool
+prefetch_start (void)
+{
+  if (! prefetch_threads)
+    {
+      prefetch_threads = xcalloc (read_threads_option,
+				  sizeof *prefetch_threads);
+      while (prefetch_nthreads < read_threads_option
+	     && pthread_create (&prefetch_threads[prefetch_nthreads], NULL,
+				prefetch_worker, NULL) == 0)
+	prefetch_nthreads++;
+      if (prefetch_nthreads == 0)
+	read_threads_option = 0;
+    }
+  return prefetch_nthreads != 0;
+}
+
+/* Begin dumping the directory ST.  Return a handle to be used for
+   queuing its entries, or NULL if reading ahead is not in effect.  */
+struct prefetch_dir *
+prefetch_dir_open (struct tar_stat_info const *st)
+{
+  struct prefetch_dir *dir;
+  int fd;
+
+  /* The workers read the files before dump_file0 stats them, which
+     may update their access times.  Do not read ahead if those times
+     are stored in the archive, unless --atime-preserve=system opens
+     the files with O_NOATIME, nor if --atime-preserve=replace is to
+     restore them.  */
+  if (read_threads_option == 0
+      || atime_preserve_option == replace_atime_preserve
+      || (atime_preserve_option != system_atime_preserve
+	  && archive_stores_atime ())
+      || st->fd <= 0)
+    return NULL;
+
+  fd = fcntl (st->fd, F_DUPFD_CLOEXEC, 0);
+  if (fd < 0)
+    return NULL;
+  if (! prefetch_start ())
+    {
+      close (fd);
+      return NULL;
+    }
+
+  dir = xzalloc (sizeof *dir);
+  dir->fd = fd;
+  pthread_mutex_lock (&prefetch_lock);
+  dir->prev = prefetch_top;
+  prefetch_top = dir;
+  pthread_mutex_unlock (&prefetch_lock);
+  return dir;
+}
+
+/* Queue NAME, an entry of DIR, for reading ahead.  NAME must remain
+   valid until DIR is closed.  */
+void
+prefetch_dir_add (struct prefetch_dir *dir, char const *name)
+{
+  pthread_mutex_lock (&prefetch_lock);
+  if (dir->nitems == dir->nalloc)
+    dir->items = x2nrealloc (dir->items, &dir->nalloc, sizeof *dir->items);
+  dir->items[dir->nitems++] = (struct prefetch_item) { .name = name };
+  pthread_cond_broadcast (&prefetch_cond);
+  pthread_mutex_unlock (&prefetch_lock);
+}
+
+/* Return the name of the next entry of DIR to dump, in the order they
+   were queued, or NULL if there are no more entries.  Release the data
+   of the previous entry.  */
+char const *
+prefetch_dir_next (struct prefetch_dir *dir)
+{
+  char const *name = NULL;
+
+  pthread_mutex_lock (&prefetch_lock);
+  if (dir->current)
+    {
+      struct prefetch_item *item = &dir->items[dir->current - 1];
+      if (item->state == prefetch_queued)
+	item->state = prefetch_cancelled;
+      item->wanted = true;
+      prefetch_item_free (item);
+    }
+  if (dir->current < dir->nitems)
+    name = dir->items[dir->current++].name;
+  pthread_mutex_unlock (&prefetch_lock);
+  return name;
+}
+
+/* Finish dumping DIR, which must be the innermost directory, and free
+   it.  */
+void
+prefetch_dir_close (struct prefetch_dir *dir)
+{
+  size_t i;
+  bool busy;
+
+  pthread_mutex_lock (&prefetch_lock);
+  for (i = 0; i < dir->nitems; i++)
+    {
+      struct prefetch_item *item = &dir->items[i];
+      if (item->state == prefetch_queued)
+	item->state = prefetch_cancelled;
+      item->wanted = true;
+    }
+  pthread_cond_broadcast (&prefetch_cond);
+
+  do
+    {
+      busy = false;
+      for (i = 0; i < dir->nitems; i++)
+	{
+	  struct prefetch_item *item = &dir->items[i];
+	  if (item->state == prefetch_busy)
+	    busy = true;
+	  else
+	    prefetch_item_free (item);
+	}
+      if (busy)
+	pthread_cond_wait (&prefetch_cond, &prefetch_lock);
+    }
+  while (busy);
+
+  prefetch_top = dir->prev;
+  pthread_mutex_unlock (&prefetch_lock);
+
+  close (dir->fd);
+  free (dir->items);
+  free (dir);
+}
+
+/* Return the contents of the file with status ST if it is the entry
+   currently being dumped from the innermost directory and it has been
+   read ahead, or NULL otherwise.  The contents, ST->st_size bytes long,
+   remain valid until the next call to prefetch_dir_next.  */
+char const *
+prefetch_file_data (struct stat const *st)
+{
+  struct prefetch_dir *dir = prefetch_top;
+  struct prefetch_item *item;
+  char const *data = NULL;
+
+  if (! dir || ! dir->current)
+    return NULL;
+
+  pthread_mutex_lock (&prefetch_lock);
+  item = &dir->items[dir->current - 1];
+  if (item->state == prefetch_queued)
+    /* Reading it now would take as long as reading it ourselves.  */
+    item->state = prefetch_cancelled;
+  else
+    {
+      item->wanted = true;
+      pthread_cond_broadcast (&prefetch_cond);
+      while (item->state == prefetch_busy)
+	pthread_cond_wait (&prefetch_cond, &prefetch_lock);
+
+      if (item->data
+	  && item->stat.st_dev == st->st_dev
+	  && item->stat.st_ino == st->st_ino
+	  && item->stat.st_size == st->st_size
+	  && ! timespec_cmp (get_stat_mtime (&item->stat),
+			     get_stat_mtime (st))
+	  && ! timespec_cmp (get_stat_ctime (&item->stat),
+			     get_stat_ctime (st)))
+	data = item->data;
+      else
+	prefetch_item_free (item);
+    }
+  pthread_mutex_unlock (&prefetch_lock);
+  return data;
+}
+
+/* Stop the worker threads.  */
+void
+prefetch_finish (void)
+{
+  int i;
+
+  if (! prefetch_threads)
+    return;
+
+  pthread_mutex_lock (&prefetch_lock);
+  prefetch_stop = true;
+  pthread_cond_broadcast (&prefetch_cond);
+  pthread_mutex_unlock (&prefetch_lock);
+
+  for (i = 0; i < prefetch_nthreads; i++)
+    pthread_join (prefetch_threads[i], NULL);
+  free (prefetch_threads);
+  prefetch_threads = NULL;
+  prefetch_nthreads = 0;
+  prefetch_stop = false;
+}
@@ -53,6 +53,11 @@ struct tar_sparse_file
 				       Otherwise unused */
   off_t dumped_size;                /* Number of bytes actually written
 				       to the archive */
+  bool fresh;                       /* When extracting: fd was empty, so
+				       blocks of zeros need not be written */
+  bool seek_data;                   /* When comparing: holes of fd can be
+				       found with SEEK_DATA */
+  off_t size;                       /* When comparing: size of fd */
   struct tar_stat_info *stat_info;  /* Information about the file */
   struct tar_sparse_optab const *optab; /* Operation table */
   void *closure;                    /* Any additional data optab calls might
@@ -185,18 +190,6 @@ lseek_or_error (struct tar_sparse_file *file, off_t offset)
   return true;
 }
 
-/* Takes a blockful of data and basically cruises through it to see if
-   it's made *entirely* of zeros, returning a 0 the instant it finds
-   something that is a nonzero, i.e., useful data.  */
-static bool
-zero_block_p (char const *buffer, size_t size)
-{
-  while (size--)
-    if (*buffer++)
-      return false;
-  return true;
-}
-
 static void
 sparse_add_map (struct tar_stat_info *st, struct sp_array const *sp)
 {
@@ -500,7 +493,21 @@ sparse_extract_region (struct tar_sparse_file *file, size_t i)
 	}
       set_next_block_after (blk);
       file->dumped_size += BLOCKSIZE;
-      count = blocking_write (file->fd, blk->buffer, wrbytes);
+      if (file->fresh && zero_block_p (blk->buffer, wrbytes))
+	{
+	  /* The file already reads as zeros there.  */
+	  if (lseek (file->fd, wrbytes, SEEK_CUR) < 0)
+	    {
+	      seek_diag_details (file->stat_info->orig_file_name,
+				 (file->stat_info->sparse_map[i].offset
+				  + file->stat_info->sparse_map[i].numbytes
+				  - write_size + wrbytes));
+	      return false;
+	    }
+	  count = wrbytes;
+	}
+      else
+	count = blocking_write (file->fd, blk->buffer, wrbytes);
       write_size -= count;
       mv_size_left (file->stat_info->archive_file_size - file->dumped_size);
       file->offset += count;
@@ -515,6 +522,35 @@ sparse_extract_region (struct tar_sparse_file *file, size_t i)
 }
 
 
+/* Prepare FILE, which is about to be extracted, for writing its data
+   regions.  If it is an empty regular file, give it its final size, so
+   that the parts that are not written are holes, and allocate space
+   for the data regions, so that they are laid out as if written in
+   full even though their blocks of zeros are skipped.  */
+static void
+sparse_extract_prepare (struct tar_sparse_file *file)
+{
+  struct tar_stat_info *st = file->stat_info;
+  struct stat stat_data;
+  MAYBE_UNUSED size_t i;
+
+  if (! (file->seekable
+	 && fstat (file->fd, &stat_data) == 0
+	 && S_ISREG (stat_data.st_mode)
+	 && stat_data.st_size == 0
+	 && ftruncate (file->fd, st->stat.st_size) == 0))
+    return;
+  file->fresh = true;
+
+#if HAVE_FALLOCATE
+  for (i = 0; i < st->sparse_map_avail; i++)
+    if (st->sparse_map[i].numbytes != 0
+	&& fallocate (file->fd, 0, st->sparse_map[i].offset,
+		      st->sparse_map[i].numbytes) != 0)
+      break;
+#endif
+}
+
 
 /* Interface functions */
 enum dump_status
@@ -592,6 +628,8 @@ sparse_extract_file (int fd, struct tar_stat_info *st, off_t *size)
   file.offset = 0;
 
   rc = tar_sparse_decode_header (&file);
+  if (rc)
+    sparse_extract_prepare (&file);
   for (i = 0; rc && i < file.stat_info->sparse_map_avail; i++)
     rc = tar_sparse_extract_region (&file, i);
   *size = file.stat_info->archive_file_size - file.dumped_size;
@@ -616,8 +654,9 @@ sparse_skim_file (struct tar_stat_info *st, bool must_copy)
 }
 
 
+/* Check that FILE holds zeros from BEG to END by reading them.  */
 static bool
-check_sparse_region (struct tar_sparse_file *file, off_t beg, off_t end)
+check_zero_region (struct tar_sparse_file *file, off_t beg, off_t end)
 {
   if (!lseek_or_error (file, beg))
     return false;
@@ -662,6 +701,47 @@ check_sparse_region (struct tar_sparse_file *file, off_t beg, off_t end)
   return true;
 }
 
+/* Check that FILE has a hole from BEG to END.  Only the parts of it
+   that SEEK_DATA finds are read, since holes read as zeros.  */
+static bool
+check_sparse_region (struct tar_sparse_file *file, off_t beg, off_t end)
+{
+#ifdef SEEK_HOLE
+  while (file->seek_data && beg < end)
+    {
+      off_t data = lseek (file->fd, beg, SEEK_DATA);
+      off_t hole;
+
+      if (data < 0)
+	{
+	  if (errno != ENXIO)
+	    break;
+	  /* No data from BEG on.  */
+	  if (file->size < end)
+	    {
+	      report_difference (file->stat_info, _("Size differs"));
+	      return false;
+	    }
+	  return true;
+	}
+      if (end <= data)
+	return true;
+
+      hole = lseek (file->fd, data, SEEK_HOLE);
+      if (hole < 0)
+	break;
+      if (end < hole)
+	hole = end;
+      if (!check_zero_region (file, data, hole))
+	return false;
+      beg = hole;
+    }
+  if (beg < end)
+    file->seek_data = false;
+#endif
+  return check_zero_region (file, beg, end);
+}
+
 static bool
 check_data_region (struct tar_sparse_file *file, size_t i)
 {
@@ -724,6 +804,7 @@ sparse_diff_file (int fd, struct tar_stat_info *st)
 {
   bool rc = true;
   struct tar_sparse_file file;
+  struct stat stat_data;
   size_t i;
   off_t offset = 0;
 
@@ -733,6 +814,11 @@ sparse_diff_file (int fd, struct tar_stat_info *st)
   file.stat_info = st;
   file.fd = fd;
   file.seekable = true; /* File *must* be seekable for compare to work */
+  if (fstat (fd, &stat_data) == 0 && S_ISREG (stat_data.st_mode))
+    {
+      file.seek_data = true;
+      file.size = stat_data.st_size;
+    }
 
   rc = tar_sparse_decode_header (&file);
   mv_begin_read (st);
@@ -1153,6 +1239,8 @@ pax_dump_header_0 (struct tar_sparse_file *file)
     {
       free (file->stat_info->file_name);
       file->stat_info->file_name = save_file_name;
+      if (toc_file_name)
+	toc_set_name (save_file_name);
     }
   return true;
 }
@@ -1216,6 +1304,8 @@ pax_dump_header_1 (struct tar_sparse_file *file)
   finish_header (file->stat_info, blk, block_ordinal);
   free (file->stat_info->file_name);
   file->stat_info->file_name = save_file_name;
+  if (toc_file_name)
+    toc_set_name (save_file_name);
 
   blk = find_next_block ();
   q = blk->buffer;
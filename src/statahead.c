@@ -0,0 +1,280 @@
+/* Stat and open directory entries ahead with io_uring.
+
+   Copyright 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU tar.
+
+   GNU tar is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU tar is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* When archiving, dump_file0 stats every entry of a directory, and
+   opens and stats again those whose contents it dumps, one system call
+   at a time.  With --io-uring, dump_dir0 queues the entries of each
+   directory here, in the order in which they will be dumped.  When
+   dump_file0 reaches an entry, the entries of the next window are
+   statted with a single system call, the regular files among them
+   opened with another, and those statted through their descriptors
+   with a third.  dump_file0 then takes the results in turn, instead of
+   making the system calls itself.  The order of the members is not
+   affected.
+
+   To bound the number of file descriptors, only regular files are
+   opened ahead, and the descriptors of a directory's entries not yet
+   dumped are closed when dumping one of its subdirectories begins.  */
+
+#include <system.h>
+#include "common.h"
+
+/* Number of entries statted together.  */
+enum { STAT_AHEAD_WINDOW = 128 };
+
+struct stat_ahead_item
+  {
+    int err;                  /* Error statting by name, or 0 */
+    struct stat stat;         /* Status by name */
+    int fd;                   /* Descriptor opened ahead, or 0 */
+    struct stat fdstat;       /* Status of FD */
+  };
+
+struct stat_ahead_dir
+  {
+    struct stat_ahead_dir *prev; /* Directory being dumped by our caller */
+    struct tar_stat_info const *st; /* The directory */
+    int fd;                   /* Duplicate of its descriptor */
+    char const **names;       /* Entries queued so far */
+    size_t nnames, nalloc;
+    size_t next;              /* Index of the next entry to return */
+    size_t current;           /* Index of the next entry to dump */
+    size_t base;              /* Index of the first entry of ITEMS */
+    size_t ready;             /* Index past the last entry of ITEMS */
+    struct stat_ahead_item items[STAT_AHEAD_WINDOW];
+  };
+
+/* The ring, shared by all directories, or NULL if not yet open.  */
+static struct uring *stat_ahead_ring;
+
+/* Innermost directory being dumped.  */
+static struct stat_ahead_dir *stat_ahead_top;
+
+/* Close the descriptors opened ahead for the entries of DIR with
+   indexes from FROM to just before TO.  */
+static void
+stat_ahead_release (struct stat_ahead_dir *dir, size_t from, size_t to)
+{
+  for (size_t i = max (from, dir->base); i < min (to, dir->ready); i++)
+    {
+      struct stat_ahead_item *item = &dir->items[i - dir->base];
+      if (0 < item->fd)
+	{
+	  close (item->fd);
+	  item->fd = 0;
+	}
+    }
+}
+
+/* Stat, open and stat again the entries of DIR in the window starting
+   at the current entry.  */
+static void
+stat_ahead_window (struct stat_ahead_dir *dir)
+{
+  struct uring *ring = stat_ahead_ring;
+  size_t i, n, nopen, tag;
+  int res;
+
+  stat_ahead_release (dir, dir->base, dir->ready);
+  dir->base = dir->current;
+  dir->ready = min (dir->nnames, dir->base + STAT_AHEAD_WINDOW);
+  n = dir->ready - dir->base;
+
+  /* Stat the entries by name.  */
+  for (i = 0; i < n; i++)
+    {
+      dir->items[i].fd = 0;
+      uring_fstatat (ring, dir->fd, dir->names[dir->base + i],
+		     &dir->items[i].stat, fstatat_flags, i);
+    }
+  for (i = 0; i < n; i++)
+    {
+      res = uring_wait (ring, &tag);
+      dir->items[tag].err = res < 0 ? - res : 0;
+    }
+
+  /* Open the regular files whose contents will be dumped.  A file
+     that cannot be opened here is left to dump_file0, which knows how
+     to recover from running out of file descriptors.  */
+  for (i = nopen = 0; i < n; i++)
+    {
+      struct stat_ahead_item *item = &dir->items[i];
+      if (! item->err && S_ISREG (item->stat.st_mode)
+	  && file_dumpable_p (&item->stat))
+	{
+	  uring_openat (ring, dir->fd, dir->names[dir->base + i],
+			open_read_flags, i);
+	  nopen++;
+	}
+    }
+  for (i = 0; i < nopen; i++)
+    {
+      res = uring_wait (ring, &tag);
+      if (0 < res)
+	dir->items[tag].fd = res;
+      else if (res == 0)
+	/* dump_file0 takes descriptor 0 as no descriptor at all.  */
+	close (res);
+    }
+
+  /* Stat the files opened, as dump_file0 would after opening them.  */
+  for (i = nopen = 0; i < n; i++)
+    if (0 < dir->items[i].fd)
+      {
+	uring_fstatat (ring, dir->items[i].fd, "", &dir->items[i].fdstat,
+		       AT_EMPTY_PATH, i);
+	nopen++;
+      }
+  for (i = 0; i < nopen; i++)
+    {
+      res = uring_wait (ring, &tag);
+      if (res < 0)
+	{
+	  close (dir->items[tag].fd);
+	  dir->items[tag].fd = 0;
+	}
+    }
+}
+
+/* Begin dumping the directory ST.  Return a handle to be used for
+   queuing its entries, or NULL if statting ahead is not in effect.  */
+struct stat_ahead_dir *
+stat_ahead_dir_open (struct tar_stat_info const *st)
+{
+  struct stat_ahead_dir *dir;
+  int fd;
+
+  if (! io_uring_option || st->fd <= 0)
+    return NULL;
+  if (! stat_ahead_ring)
+    {
+      stat_ahead_ring = uring_open (STAT_AHEAD_WINDOW);
+      if (! stat_ahead_ring)
+	{
+	  io_uring_option = false;
+	  return NULL;
+	}
+    }
+
+  /* ST->fd may be closed temporarily to conserve file descriptors.  */
+  fd = fcntl (st->fd, F_DUPFD_CLOEXEC, 0);
+  if (fd < 0)
+    return NULL;
+
+  if (stat_ahead_top)
+    stat_ahead_release (stat_ahead_top, stat_ahead_top->current, SIZE_MAX);
+  dir = xzalloc (sizeof *dir);
+  dir->st = st;
+  dir->fd = fd;
+  dir->prev = stat_ahead_top;
+  stat_ahead_top = dir;
+  return dir;
+}
+
+/* Queue NAME, an entry of DIR, for statting ahead.  Entries must be
+   queued in the order in which they are dumped, and NAME must remain
+   valid until DIR is closed.  */
+void
+stat_ahead_dir_add (struct stat_ahead_dir *dir, char const *name)
+{
+  if (dir->nnames == dir->nalloc)
+    dir->names = x2nrealloc (dir->names, &dir->nalloc, sizeof *dir->names);
+  dir->names[dir->nnames++] = name;
+}
+
+/* Return the next entry of DIR to dump, in the order they were queued,
+   or NULL if there are no more entries.  */
+char const *
+stat_ahead_dir_next (struct stat_ahead_dir *dir)
+{
+  return dir->next < dir->nnames ? dir->names[dir->next++] : NULL;
+}
+
+/* Finish dumping DIR, which must be the innermost directory, and free
+   it.  */
+void
+stat_ahead_dir_close (struct stat_ahead_dir *dir)
+{
+  stat_ahead_release (dir, dir->base, dir->ready);
+  stat_ahead_top = dir->prev;
+  close (dir->fd);
+  free (dir->names);
+  free (dir);
+}
+
+/* If NAME is an entry of PARENT, the innermost directory, that has
+   been queued and not yet taken, take its status and return true.  If
+   the file has been opened ahead, store its descriptor in *FD and its
+   status in *ST.  Otherwise, store 0 in *FD and the status of NAME in
+   *ST, or if NAME could not be statted, store -1 in *FD and set errno.
+   Return false if NAME has not been queued.  */
+bool
+stat_ahead_file (struct tar_stat_info const *parent, char const *name,
+		 struct stat *st, int *fd)
+{
+  struct stat_ahead_dir *dir = stat_ahead_top;
+  struct stat_ahead_item *item;
+  size_t i;
+
+  if (! dir || dir->st != parent)
+    return false;
+
+  /* Entries may be skipped, for instance if the user does not confirm
+     them with --interactive.  */
+  for (i = dir->current; i < dir->nnames; i++)
+    if (strcmp (dir->names[i], name) == 0)
+      break;
+  if (i == dir->nnames)
+    return false;
+  stat_ahead_release (dir, dir->current, i);
+  dir->current = i;
+  if (dir->ready <= i)
+    stat_ahead_window (dir);
+  dir->current = i + 1;
+
+  item = &dir->items[i - dir->base];
+  if (item->err)
+    {
+      *fd = -1;
+      errno = item->err;
+    }
+  else if (0 < item->fd)
+    {
+      *fd = item->fd;
+      *st = item->fdstat;
+      item->fd = 0;
+    }
+  else
+    {
+      *fd = 0;
+      *st = item->stat;
+    }
+  return true;
+}
+
+/* Close the ring.  */
+void
+stat_ahead_finish (void)
+{
+  if (stat_ahead_ring)
+    {
+      uring_close (stat_ahead_ring);
+      stat_ahead_ring = NULL;
+    }
+}
@@ -272,12 +272,15 @@ tar_set_quoting_style (char *arg)
 enum
 {
   ACLS_OPTION = CHAR_MAX + 1,
+  ASYNC_WRITE_OPTION,
   ATIME_PRESERVE_OPTION,
   BACKUP_OPTION,
+  BUILTIN_COMPRESSION_OPTION,
   CHECK_DEVICE_OPTION,
   CHECKPOINT_OPTION,
   CHECKPOINT_ACTION_OPTION,
   CLAMP_MTIME_OPTION,
+  COMPRESS_THREADS_OPTION,
   DELAY_DIRECTORY_RESTORE_OPTION,
   HARD_DEREFERENCE_OPTION,
   DELETE_OPTION,
@@ -288,6 +291,7 @@ enum
   IGNORE_COMMAND_ERROR_OPTION,
   IGNORE_FAILED_READ_OPTION,
   INDEX_FILE_OPTION,
+  IO_URING_OPTION,
   KEEP_DIRECTORY_SYMLINK_OPTION,
   KEEP_NEWER_FILES_OPTION,
   LEVEL_OPTION,
@@ -322,6 +326,8 @@ enum
   POSIX_OPTION,
   QUOTE_CHARS_OPTION,
   QUOTING_STYLE_OPTION,
+  READ_AHEAD_OPTION,
+  READ_THREADS_OPTION,
   RECORD_SIZE_OPTION,
   RECURSIVE_UNLINK_OPTION,
   REMOVE_FILES_OPTION,
@@ -329,24 +335,30 @@ enum
   RMT_COMMAND_OPTION,
   RSH_COMMAND_OPTION,
   SAME_OWNER_OPTION,
+  SEEKABLE_COMPRESSION_OPTION,
   SELINUX_CONTEXT_OPTION,
   SHOW_DEFAULTS_OPTION,
   SHOW_OMITTED_DIRS_OPTION,
   SHOW_SNAPSHOT_FIELD_RANGES_OPTION,
   SHOW_TRANSFORMED_NAMES_OPTION,
   SKIP_OLD_FILES_OPTION,
+  SNAPSHOT_FORMAT_OPTION,
   SORT_OPTION,
   HOLE_DETECTION_OPTION,
   SPARSE_VERSION_OPTION,
   STRIP_COMPONENTS_OPTION,
   SUFFIX_OPTION,
   TEST_LABEL_OPTION,
+  TOC_FILE_OPTION,
   TOTALS_OPTION,
   TO_COMMAND_OPTION,
   TRANSFORM_OPTION,
+  USE_TOC_OPTION,
   UTC_OPTION,
   VOLNO_FILE_OPTION,
+  WALK_THREADS_OPTION,
   WARNING_OPTION,
+  WRITE_THREADS_OPTION,
   XATTR_OPTION,
   XATTR_EXCLUDE,
   XATTR_INCLUDE,
@@ -487,6 +499,9 @@ static struct argp_option options[] = {
    N_("handle new GNU-format incremental backup"), GRID_MODIFIER },
   {"level", LEVEL_OPTION, N_("NUMBER"), 0,
    N_("dump level for created listed-incremental archive"), GRID_MODIFIER },
+  {"snapshot-format", SNAPSHOT_FORMAT_OPTION, N_("VERSION"), 0,
+   N_("write the listed-incremental snapshot in format VERSION (2, text,"
+      " or 3, binary)"), GRID_MODIFIER },
   {"ignore-failed-read", IGNORE_FAILED_READ_OPTION, 0, 0,
    N_("do not exit with nonzero on unreadable files"), GRID_MODIFIER },
   {"occurrence", OCCURRENCE_OPTION, N_("NUMBER"), OPTION_ARG_OPTIONAL,
@@ -499,12 +514,30 @@ static struct argp_option options[] = {
    N_("archive is seekable"), GRID_MODIFIER },
   {"no-seek", NO_SEEK_OPTION, NULL, 0,
    N_("archive is not seekable"), GRID_MODIFIER },
+  {"toc-file", TOC_FILE_OPTION, N_("FILE"), 0,
+   N_("write a table of contents of the archive to FILE, or read it"
+      " from FILE with --use-toc"), GRID_MODIFIER },
+  {"use-toc", USE_TOC_OPTION, NULL, 0,
+   N_("use the table of contents given with --toc-file to locate"
+      " the members to process"), GRID_MODIFIER },
   {"no-check-device", NO_CHECK_DEVICE_OPTION, NULL, 0,
    N_("do not check device numbers when creating incremental archives"),
    GRID_MODIFIER },
   {"check-device", CHECK_DEVICE_OPTION, NULL, 0,
    N_("check device numbers when creating incremental archives (default)"),
    GRID_MODIFIER },
+  {"read-threads", READ_THREADS_OPTION, N_("NUMBER"), 0,
+   N_("use NUMBER threads to read ahead files being archived"),
+   GRID_MODIFIER },
+  {"walk-threads", WALK_THREADS_OPTION, N_("NUMBER"), 0,
+   N_("use NUMBER threads to read ahead directories being archived"),
+   GRID_MODIFIER },
+  {"write-threads", WRITE_THREADS_OPTION, N_("NUMBER"), 0,
+   N_("use NUMBER threads to write small files being extracted"),
+   GRID_MODIFIER },
+  {"io-uring", IO_URING_OPTION, NULL, 0,
+   N_("batch system calls on files with io_uring, if available"),
+   GRID_MODIFIER },
 
   {NULL, 0, NULL, 0,
    N_("Overwrite control:"), GRH_OVERWRITE },
@@ -685,6 +718,12 @@ static struct argp_option options[] = {
    N_("ignore zeroed blocks in archive (means EOF)"), GRID_BLOCKING },
   {"read-full-records", 'B', 0, 0,
    N_("reblock as we read (for 4.2BSD pipes)"), GRID_BLOCKING },
+  {"async-write", ASYNC_WRITE_OPTION, N_("NUMBER"), OPTION_ARG_OPTIONAL,
+   N_("write the archive from a separate thread, buffering up to NUMBER"
+      " records (default 2)"), GRID_BLOCKING },
+  {"read-ahead", READ_AHEAD_OPTION, N_("NUMBER"), OPTION_ARG_OPTIONAL,
+   N_("read up to NUMBER records ahead from the archive in a separate"
+      " thread (default 4)"), GRID_BLOCKING },
 
   {NULL, 0, NULL, 0,
    N_("Archive format selection:"), GRH_FORMAT },
@@ -727,6 +766,16 @@ static struct argp_option options[] = {
    GRID_COMPRESS },
   {"use-compress-program", 'I', N_("PROG"), 0,
    N_("filter through PROG (must accept -d)"), GRID_COMPRESS },
+  {"builtin-compression", BUILTIN_COMPRESSION_OPTION, 0, 0,
+   N_("use built-in gzip, xz and zstd codecs instead of running"
+      " the compression program, where available"), GRID_COMPRESS },
+  {"compress-threads", COMPRESS_THREADS_OPTION, N_("NUMBER"), 0,
+   N_("compress the archive with NUMBER threads; implies"
+      " --builtin-compression"), GRID_COMPRESS },
+  {"seekable-compression", SEEKABLE_COMPRESSION_OPTION, 0, 0,
+   N_("index a gzip or zstd compressed archive so that its members can"
+      " be reached without decompressing the preceding ones; implies"
+      " --builtin-compression"), GRID_COMPRESS },
   /* Note: docstrings for the options below are generated by tar_help_filter */
   {"bzip2", 'j', 0, 0, NULL, GRID_COMPRESS },
   {"gzip", 'z', 0, 0, NULL, GRID_COMPRESS },
@@ -1313,6 +1362,32 @@ parse_owner_group (char *arg, uintmax_t field_max, char const **name_option)
   return u;
 }
 
+/* Return the number of threads given by ARG, the argument of one of
+   the --*-threads options.  */
+static int
+parse_thread_count (char const *arg)
+{
+  uintmax_t u;
+  if (! (xstrtoumax (arg, 0, 10, &u, "") == LONGINT_OK
+	 && u <= INT_MAX))
+    USAGE_ERROR ((0, 0, "%s: %s", quotearg_colon (arg),
+		  _("Invalid number of threads")));
+  return u;
+}
+
+/* Return the number of records given by ARG, the argument of
+   --async-write or --read-ahead.  */
+static size_t
+parse_record_count (char const *arg)
+{
+  uintmax_t u;
+  if (! (xstrtoumax (arg, 0, 10, &u, "") == LONGINT_OK
+	 && u <= SIZE_MAX / sizeof (void *)))
+    USAGE_ERROR ((0, 0, "%s: %s", quotearg_colon (arg),
+		  _("Invalid number of records")));
+  return u;
+}
+
 #define TAR_SIZE_SUFFIXES "bBcGgkKMmPTtw"
 
 static char const *const sort_mode_arg[] = {
@@ -1416,6 +1491,20 @@ parse_opt (int key, char *arg, struct argp_state *state)
       args->compress_autodetect = false;
       break;
 
+    case BUILTIN_COMPRESSION_OPTION:
+      builtin_compression_option = true;
+      break;
+
+    case COMPRESS_THREADS_OPTION:
+      compress_threads_option = parse_thread_count (arg);
+      builtin_compression_option = true;
+      break;
+
+    case SEEKABLE_COMPRESSION_OPTION:
+      seekable_compression_option = true;
+      builtin_compression_option = true;
+      break;
+
     case 'b':
       {
 	uintmax_t u;
@@ -1627,6 +1716,17 @@ parse_opt (int key, char *arg, struct argp_state *state)
       }
       break;
 
+    case SNAPSHOT_FORMAT_OPTION:
+      {
+	uintmax_t u;
+	if (! (xstrtoumax (arg, 0, 10, &u, "") == LONGINT_OK
+	       && (u == 2 || u == 3)))
+	  USAGE_ERROR ((0, 0, "%s: %s", quotearg_colon (arg),
+			_("Invalid snapshot format version")));
+	snapshot_format_option = u;
+      }
+      break;
+
     case LZIP_OPTION:
       set_use_compress_program_option (LZIP_PROGRAM, args->loc);
       break;
@@ -1664,6 +1764,14 @@ parse_opt (int key, char *arg, struct argp_state *state)
       seek_option = 0;
       break;
 
+    case TOC_FILE_OPTION:
+      toc_file_name = arg;
+      break;
+
+    case USE_TOC_OPTION:
+      use_toc_option = true;
+      break;
+
     case 'N':
       after_date_option = true;
       FALLTHROUGH;
@@ -1815,6 +1923,13 @@ parse_opt (int key, char *arg, struct argp_state *state)
       set_use_compress_program_option (ZSTD_PROGRAM, args->loc);
       break;
 
+    case ASYNC_WRITE_OPTION:
+      if (arg)
+	async_write_option = parse_record_count (arg);
+      else
+	async_write_option = 2;
+      break;
+
     case ATIME_PRESERVE_OPTION:
       atime_preserve_option =
 	(arg
@@ -2077,6 +2192,29 @@ parse_opt (int key, char *arg, struct argp_state *state)
       }
       break;
 
+    case READ_AHEAD_OPTION:
+      if (arg)
+	read_ahead_option = parse_record_count (arg);
+      else
+	read_ahead_option = 4;
+      break;
+
+    case READ_THREADS_OPTION:
+      read_threads_option = parse_thread_count (arg);
+      break;
+
+    case IO_URING_OPTION:
+      io_uring_option = true;
+      break;
+
+    case WALK_THREADS_OPTION:
+      walk_threads_option = parse_thread_count (arg);
+      break;
+
+    case WRITE_THREADS_OPTION:
+      write_threads_option = parse_thread_count (arg);
+      break;
+
     case SHOW_OMITTED_DIRS_OPTION:
       show_omitted_dirs_option = true;
       break;
@@ -2324,7 +2462,7 @@ decode_options (int argc, char **argv)
   archive_format = DEFAULT_FORMAT;
   blocking_factor = DEFAULT_BLOCKING;
   record_size = DEFAULT_BLOCKING * BLOCKSIZE;
-  excluded = new_exclude ();
+  excluded = exclmatch_new ();
   hole_detection = HOLE_DETECTION_DEFAULT;
 
   newer_mtime_option.tv_sec = TYPE_MINIMUM (time_t);
@@ -2597,6 +2735,21 @@ decode_options (int argc, char **argv)
       && !IS_SUBCOMMAND_CLASS (SUBCL_READ))
     USAGE_ERROR ((0, 0, _("--xattrs can be used only on POSIX archives")));
 
+  if (toc_file_name && multi_volume_option)
+    USAGE_ERROR ((0, 0, _("Cannot use --toc-file with multi-volume archives")));
+
+  if (use_toc_option)
+    {
+      if (!toc_file_name)
+	USAGE_ERROR ((0, 0, _("--use-toc requires --toc-file")));
+      if (!IS_SUBCOMMAND_CLASS (SUBCL_READ))
+	option_conflict_error ("--use-toc",
+			       subcommand_string (subcommand_option));
+    }
+  else if (toc_file_name && subcommand_option != CREATE_SUBCOMMAND)
+    USAGE_ERROR ((0, 0, _("--toc-file can be used only with --create,"
+			  " or with --use-toc")));
+
   if (starting_file_option && !IS_SUBCOMMAND_CLASS (SUBCL_READ))
     {
       if (option_set_in_cl (OC_STARTING_FILE))
@@ -0,0 +1,357 @@
+/* Archive table of contents.
+
+   Copyright 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU tar.
+
+   GNU tar is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU tar is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* With --toc-file, the members written by --create are recorded in a
+   table of contents, which --use-toc later uses to go straight to the
+   members named on the command line instead of reading every header
+   of the archive.
+
+   A table of contents file consists of:
+
+     - the magic string TOC_MAGIC;
+     - the number of entries N, as a 64-bit big-endian integer;
+     - N 64-bit big-endian offsets of the entries in the file, in the
+       order of the member names (as compared by strcmp), and of their
+       block ordinals for equal names;
+     - the entries, each one holding the block ordinal of the first
+       header of the member (including any long name or extended
+       header) and its size as 64-bit big-endian integers, its type
+       flag, and its name, without trailing slashes, terminated by a
+       null byte.
+
+   The names are those stored in the archive, which are the ones that
+   name_match compares when reading it.  */
+
+#include <system.h>
+#include "common.h"
+
+static char const TOC_MAGIC[8] = "GNUtoc01";
+
+/* Size of the fixed part of an entry.  */
+enum { TOC_ENTRY_SIZE = 8 + 8 + 1 };
+
+/* A member recorded while creating the archive.  */
+struct toc_member
+{
+  char *name;                   /* member name */
+  off_t ordinal;                /* block ordinal of its first header */
+  off_t size;                   /* member size */
+  char type;                    /* type flag */
+};
+
+static struct toc_member *toc_members;
+static size_t toc_nmembers;
+static size_t toc_members_alloc;
+
+/* A member to visit when reading the archive.  */
+struct toc_pick
+{
+  off_t ordinal;                /* block ordinal of its first header */
+  char const *name;             /* member name, in toc_data */
+};
+
+static char *toc_data;          /* contents of the table of contents */
+static size_t toc_data_size;    /* its size */
+static size_t toc_count;        /* number of entries */
+
+static struct toc_pick *toc_picks;
+static size_t toc_npicks;
+static size_t toc_picks_alloc;
+static size_t toc_next;         /* next pick to visit */
+static char const *toc_expected; /* name of the member just reached, or
+				    NULL */
+
+static void
+put_be64 (char *p, uintmax_t v)
+{
+  for (int i = 7; 0 <= i; i--, v >>= 8)
+    p[i] = v & 0xff;
+}
+
+static uintmax_t
+get_be64 (char const *p)
+{
+  uintmax_t v = 0;
+  for (int i = 0; i < 8; i++)
+    v = (v << 8) | (unsigned char) p[i];
+  return v;
+}
+
+/* Record the member named NAME whose first header is at block ORDINAL,
+   with size SIZE and type flag TYPE.  */
+void
+toc_add (char const *name, off_t ordinal, off_t size, char type)
+{
+  struct toc_member *m;
+
+  if (toc_nmembers == toc_members_alloc)
+    toc_members = x2nrealloc (toc_members, &toc_members_alloc,
+			      sizeof *toc_members);
+  m = &toc_members[toc_nmembers++];
+  m->name = xstrdup (name);
+  strip_trailing_slashes (m->name);
+  m->ordinal = ordinal;
+  m->size = size;
+  m->type = type;
+}
+
+/* Change the name of the member recorded last to NAME.  This is for
+   members whose header holds a substitute name, such as POSIX sparse
+   files.  */
+void
+toc_set_name (char const *name)
+{
+  struct toc_member *m = &toc_members[toc_nmembers - 1];
+
+  assign_string (&m->name, name);
+  strip_trailing_slashes (m->name);
+}
+
+static int
+compare_toc_members (void const *a, void const *b)
+{
+  struct toc_member const *ma = a;
+  struct toc_member const *mb = b;
+  int c = strcmp (ma->name, mb->name);
+
+  return (c ? c
+	  : (ma->ordinal > mb->ordinal) - (ma->ordinal < mb->ordinal));
+}
+
+/* Write the table of contents of the archive just created to
+   toc_file_name.  */
+void
+toc_write (void)
+{
+  FILE *fp = fopen (toc_file_name, "wb");
+  char buf[TOC_ENTRY_SIZE];
+  uintmax_t offset;
+  size_t i;
+
+  if (!fp)
+    open_fatal (toc_file_name);
+
+  qsort (toc_members, toc_nmembers, sizeof *toc_members,
+	 compare_toc_members);
+
+  fwrite (TOC_MAGIC, sizeof TOC_MAGIC, 1, fp);
+  put_be64 (buf, toc_nmembers);
+  fwrite (buf, 8, 1, fp);
+  offset = sizeof TOC_MAGIC + 8 + 8 * (uintmax_t) toc_nmembers;
+  for (i = 0; i < toc_nmembers; i++)
+    {
+      put_be64 (buf, offset);
+      fwrite (buf, 8, 1, fp);
+      offset += TOC_ENTRY_SIZE + strlen (toc_members[i].name) + 1;
+    }
+  for (i = 0; i < toc_nmembers; i++)
+    {
+      struct toc_member *m = &toc_members[i];
+
+      put_be64 (buf, m->ordinal);
+      put_be64 (buf + 8, m->size);
+      buf[16] = m->type;
+      fwrite (buf, TOC_ENTRY_SIZE, 1, fp);
+      fwrite (m->name, strlen (m->name) + 1, 1, fp);
+      free (m->name);
+    }
+
+  if (ferror (fp))
+    write_error (toc_file_name);
+  if (fclose (fp) != 0)
+    close_error (toc_file_name);
+
+  free (toc_members);
+  toc_members = NULL;
+  toc_nmembers = toc_members_alloc = 0;
+}
+
+static _Noreturn void
+toc_invalid (void)
+{
+  FATAL_ERROR ((0, 0, _("%s: Invalid table of contents"),
+		quotearg_colon (toc_file_name)));
+}
+
+/* Return the address of the I-th entry of the table of contents.  */
+static char const *
+toc_entry (size_t i)
+{
+  uintmax_t offset = get_be64 (toc_data + sizeof TOC_MAGIC + 8 + 8 * i);
+
+  if (toc_data_size - TOC_ENTRY_SIZE <= offset
+      || !memchr (toc_data + offset + TOC_ENTRY_SIZE, 0,
+		  toc_data_size - TOC_ENTRY_SIZE - offset))
+    toc_invalid ();
+  return toc_data + offset;
+}
+
+static char const *
+toc_entry_name (char const *entry)
+{
+  return entry + TOC_ENTRY_SIZE;
+}
+
+/* Read the table of contents from toc_file_name.  */
+static void
+toc_load (void)
+{
+  int fd = open (toc_file_name, O_RDONLY | O_BINARY);
+  struct stat st;
+  uintmax_t count;
+
+  if (fd < 0)
+    open_fatal (toc_file_name);
+  if (fstat (fd, &st) != 0)
+    stat_fatal (toc_file_name);
+  if (! (sizeof TOC_MAGIC + 8 <= st.st_size && st.st_size <= SIZE_MAX))
+    toc_invalid ();
+  toc_data_size = st.st_size;
+  toc_data = xmalloc (toc_data_size);
+  if (full_read (fd, toc_data, toc_data_size) != toc_data_size)
+    read_fatal (toc_file_name);
+  if (close (fd) != 0)
+    close_error (toc_file_name);
+
+  if (memcmp (toc_data, TOC_MAGIC, sizeof TOC_MAGIC) != 0)
+    toc_invalid ();
+  count = get_be64 (toc_data + sizeof TOC_MAGIC);
+  if ((toc_data_size - sizeof TOC_MAGIC - 8) / 8 < count)
+    toc_invalid ();
+  toc_count = count;
+}
+
+/* Select the members of the archive that NAME, a name from the name
+   list with the given MATCHING_FLAGS, matches.  NAME must match
+   literally and be anchored, so that it is a prefix of the names it
+   matches.  */
+void
+toc_select (char const *name, int matching_flags)
+{
+  size_t len = strlen (name);
+  size_t lo = 0, hi = toc_count;
+
+  /* Find the first entry whose name is not less than NAME.  */
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (strcmp (toc_entry_name (toc_entry (mid)), name) < 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  for (; lo < toc_count; lo++)
+    {
+      char const *entry = toc_entry (lo);
+      char const *entry_name = toc_entry_name (entry);
+
+      if (strncmp (entry_name, name, len) != 0)
+	break;
+      if (exclude_fnmatch (name, entry_name, matching_flags))
+	{
+	  struct toc_pick *pick;
+
+	  if (toc_npicks == toc_picks_alloc)
+	    toc_picks = x2nrealloc (toc_picks, &toc_picks_alloc,
+				    sizeof *toc_picks);
+	  pick = &toc_picks[toc_npicks++];
+	  pick->ordinal = get_be64 (entry);
+	  pick->name = entry_name;
+	}
+    }
+}
+
+static int
+compare_toc_picks (void const *a, void const *b)
+{
+  struct toc_pick const *pa = a;
+  struct toc_pick const *pb = b;
+
+  return (pa->ordinal > pb->ordinal) - (pa->ordinal < pb->ordinal);
+}
+
+/* Prepare to read the archive using the table of contents.  Return
+   true if it is used, false if the name list does not allow it.  */
+bool
+toc_start (void)
+{
+  size_t i, n;
+
+  toc_load ();
+  if (!namelist_select_toc ())
+    {
+      toc_finish ();
+      return false;
+    }
+
+  qsort (toc_picks, toc_npicks, sizeof *toc_picks, compare_toc_picks);
+  for (i = n = 0; i < toc_npicks; i++)
+    if (n == 0 || toc_picks[n - 1].ordinal != toc_picks[i].ordinal)
+      toc_picks[n++] = toc_picks[i];
+  toc_npicks = n;
+  toc_next = 0;
+  return true;
+}
+
+/* Skip to the next selected member of the archive.  Return false if
+   there is none.  */
+bool
+toc_skip (void)
+{
+  off_t ordinal = current_block_ordinal ();
+  struct toc_pick const *pick;
+
+  while (toc_next < toc_npicks && toc_picks[toc_next].ordinal < ordinal)
+    toc_next++;
+  if (toc_next == toc_npicks)
+    return false;
+
+  pick = &toc_picks[toc_next++];
+  if (ordinal < pick->ordinal)
+    skim_file ((pick->ordinal - ordinal) * BLOCKSIZE, false);
+  toc_expected = pick->name;
+  return true;
+}
+
+/* Check that FILE_NAME, the name of the member just read, is the one
+   that the table of contents gives at its position.  FILE_NAME is null
+   if no valid header was found there.  */
+void
+toc_check (char const *file_name)
+{
+  if (toc_expected && (!file_name || strcmp (file_name, toc_expected) != 0))
+    FATAL_ERROR ((0, 0,
+		  _("%s: Table of contents does not match the archive"),
+		  quotearg_colon (toc_file_name)));
+  toc_expected = NULL;
+}
+
+/* Free the table of contents.  */
+void
+toc_finish (void)
+{
+  free (toc_data);
+  toc_data = NULL;
+  toc_data_size = toc_count = 0;
+  free (toc_picks);
+  toc_picks = NULL;
+  toc_npicks = toc_picks_alloc = toc_next = 0;
+  toc_expected = NULL;
+}
@@ -36,9 +36,21 @@ struct deferred_unlink
   ((p)->is_dir \
    && ((p)->file_name[0] == 0 || strcmp ((p)->file_name, ".") == 0))
 
-/* The unlink queue */
+/* The unlink queue, in the order in which entries were added, and so
+   by increasing records_written.  Entries that are due for removal are
+   at its head.  */
 static struct deferred_unlink *dunlink_head, *dunlink_tail;
 
+/* Directories that could not be removed yet, because they were not
+   empty, in the order in which they were added.  They are tried again
+   in the final flush.  */
+static struct deferred_unlink *dunlink_kept_head, *dunlink_kept_tail;
+
+/* Entries for working directories given with -C (see IS_CWD), ordered
+   by decreasing dir_idx.  They are removed in the final flush, after
+   everything else.  */
+static struct deferred_unlink *dunlink_cwd;
+
 /* Number of entries in the queue */
 static size_t dunlink_count;
 
@@ -64,22 +76,17 @@ dunlink_alloc (void)
   return p;
 }
 
+/* Append P to the list whose head and tail are *PHEAD and *PTAIL.  */
 static void
-dunlink_insert (struct deferred_unlink *anchor, struct deferred_unlink *p)
+dunlink_append (struct deferred_unlink **phead, struct deferred_unlink **ptail,
+		struct deferred_unlink *p)
 {
-  if (anchor)
-    {
-      p->next = anchor->next;
-      anchor->next = p;
-    }
-  else 
-    {
-      p->next = dunlink_head;
-      dunlink_head = p;
-    }
-  if (!p->next)
-    dunlink_tail = p;
-  dunlink_count++;
+  p->next = NULL;
+  if (*ptail)
+    (*ptail)->next = p;
+  else
+    *phead = p;
+  *ptail = p;
 }
 
 static void
@@ -88,83 +95,94 @@ dunlink_reclaim (struct deferred_unlink *p)
   free (p->file_name);
   p->next = dunlink_avail;
   dunlink_avail = p;
+  dunlink_count--;
 }
 
+/* Remove the file of entry P, which is not for a working directory.
+   If it is a directory that is not empty, keep P for the final
+   flush.  */
 static void
-flush_deferred_unlinks (bool force)
+dunlink_remove (struct deferred_unlink *p)
 {
-  struct deferred_unlink *p, *prev = NULL;
-  int saved_chdir = chdir_current;
-  
-  for (p = dunlink_head; p; )
+  chdir_do (p->dir_idx);
+  if (p->is_dir)
     {
-      struct deferred_unlink *next = p->next;
-
-      if (force
-	  || records_written > p->records_written + deferred_unlink_delay)
+      if (unlinkat (chdir_fd, p->file_name, AT_REMOVEDIR) != 0)
 	{
-	  chdir_do (p->dir_idx);
-	  if (p->is_dir)
+	  switch (errno)
 	    {
-	      const char *fname;
-
-	      if (p->dir_idx && IS_CWD (p))
-		{
-		  prev = p;
-		  p = next;
-		  continue;
-		}
-	      else
-		fname = p->file_name;
-
-	      if (unlinkat (chdir_fd, fname, AT_REMOVEDIR) != 0)
-		{
-		  switch (errno)
-		    {
-		    case ENOENT:
-		      /* nothing to worry about */
-		      break;
-		    case EEXIST:
-		      /* OpenSolaris >=10 sets EEXIST instead of ENOTEMPTY
-			 if trying to remove a non-empty directory */
+	    case ENOENT:
+	      /* nothing to worry about */
+	      break;
+	    case EEXIST:
+	      /* OpenSolaris >=10 sets EEXIST instead of ENOTEMPTY
+		 if trying to remove a non-empty directory */
 #if defined ENOTEMPTY && ENOTEMPTY != EEXIST
-		    case ENOTEMPTY:
+	    case ENOTEMPTY:
 #endif
-		      /* Keep the record in list, in the hope we'll
-			 be able to remove it later */
-		      prev = p;
-		      p = next;
-		      continue;
-
-		    default:
-		      rmdir_error (fname);
-		    }
-		}
-	    }
-	  else
-	    {
-	      if (unlinkat (chdir_fd, p->file_name, 0) != 0 && errno != ENOENT)
-		unlink_error (p->file_name);
+	      /* Keep the record, in the hope we'll be able to remove
+		 it later */
+	      dunlink_append (&dunlink_kept_head, &dunlink_kept_tail, p);
+	      return;
+
+	    default:
+	      rmdir_error (p->file_name);
 	    }
-	  dunlink_reclaim (p);
-	  dunlink_count--;
-	  p = next;
-	  if (prev)
-	    prev->next = p;
-	  else
-	    dunlink_head = p;
 	}
-      else
+    }
+  else
+    {
+      if (unlinkat (chdir_fd, p->file_name, 0) != 0 && errno != ENOENT)
+	unlink_error (p->file_name);
+    }
+  dunlink_reclaim (p);
+}
+
+/* Remove the files of the entries that are due, or of all entries if
+   FORCE.  Only the entries that are due are visited, and consecutive
+   entries in the same directory use the same descriptor of that
+   directory.  */
+static void
+flush_deferred_unlinks (bool force)
+{
+  struct deferred_unlink *p, *list;
+  int saved_chdir = chdir_current;
+
+  if (force)
+    {
+      /* Try again the directories that were not empty.  They were
+	 added before any entry still in the queue.  */
+      list = dunlink_kept_head;
+      dunlink_kept_head = dunlink_kept_tail = NULL;
+      while ((p = list))
 	{
-	  prev = p;
-	  p = next;
+	  list = p->next;
+	  dunlink_remove (p);
 	}
     }
-  if (!dunlink_head)
-    dunlink_tail = NULL;
-  else if (force)
+
+  while ((p = dunlink_head)
+	 && (force
+	     || records_written > p->records_written + deferred_unlink_delay))
+    {
+      dunlink_head = p->next;
+      if (!dunlink_head)
+	dunlink_tail = NULL;
+      dunlink_remove (p);
+    }
+
+  if (force)
     {
-      for (p = dunlink_head; p; )
+      /* Whatever remains is removed now, or never: the directories
+	 that are still not empty, and then the working directories.  */
+      list = dunlink_kept_head;
+      if (dunlink_kept_tail)
+	dunlink_kept_tail->next = dunlink_cwd;
+      else
+	list = dunlink_cwd;
+      dunlink_kept_head = dunlink_kept_tail = dunlink_cwd = NULL;
+
+      for (p = list; p; )
 	{
 	  struct deferred_unlink *next = p->next;
 	  const char *fname;
@@ -184,12 +202,10 @@ flush_deferred_unlinks (bool force)
 		rmdir_error (fname);
 	    }
 	  dunlink_reclaim (p);
-	  dunlink_count--;
 	  p = next;
 	}
-      dunlink_head = dunlink_tail = NULL;
-    }	  
-	    
+    }
+
   chdir_do (saved_chdir);
 }
 
@@ -222,18 +238,17 @@ queue_deferred_unlink (const char *name, bool is_dir)
   normalize_filename_x (p->file_name);
   p->is_dir = is_dir;
   p->records_written = records_written;
+  dunlink_count++;
 
   if (IS_CWD (p))
     {
-      struct deferred_unlink *q, *prev;
-      for (q = dunlink_head, prev = NULL; q; prev = q, q = q->next)
-	if (IS_CWD (q) && q->dir_idx < p->dir_idx)
-	  break;
-      if (q)
-	dunlink_insert (prev, p);
-      else
-	dunlink_insert (dunlink_tail, p);
+      struct deferred_unlink **q;
+      for (q = &dunlink_cwd; *q && p->dir_idx <= (*q)->dir_idx;
+	   q = &(*q)->next)
+	continue;
+      p->next = *q;
+      *q = p;
     }
   else
-    dunlink_insert (dunlink_tail, p);
+    dunlink_append (&dunlink_head, &dunlink_tail, p);
 }
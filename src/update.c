@@ -230,6 +230,9 @@ update_archive (void)
       }
   }
 
+  prefetch_finish ();
+  stat_ahead_finish ();
+  walk_finish ();
   write_eot ();
   close_archive ();
   finish_deferred_unlinks ();
@@ -0,0 +1,366 @@
+/* Batched system calls with Linux io_uring.
+
+   Copyright 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU tar.
+
+   GNU tar is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU tar is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* With --io-uring, operations on many small files are queued in a
+   ring shared with the kernel and submitted with a single system call,
+   instead of one system call each.  This module is a minimal interface
+   to the ring, using the system calls directly so that tar does not
+   depend on liburing.  Where io_uring is not available, because the
+   kernel or its headers are too old or because it is disabled,
+   uring_open returns NULL and callers use the usual system calls.
+
+   Operations are identified by a tag chosen by the caller.  Their
+   results are those of the corresponding system calls, except that
+   errors are returned as negated errno values.  */
+
+#include <system.h>
+#include "common.h"
+
+#if HAVE_LINUX_IO_URING_H
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+#endif
+
+#if (HAVE_LINUX_IO_URING_H && defined __NR_io_uring_setup \
+     && defined IORING_FEAT_RW_CUR_POS && defined STATX_BASIC_STATS)
+
+/* An operation in flight.  */
+struct uring_op
+  {
+    size_t tag;               /* Tag chosen by the caller */
+    struct stat *st;          /* Where to store the result of a statx */
+    struct statx stx;         /* Buffer for the statx */
+  };
+
+struct uring
+  {
+    int fd;                   /* Ring file descriptor */
+    unsigned entries;         /* Maximum number of operations in flight */
+    unsigned queued;          /* Operations queued, not yet submitted */
+    unsigned inflight;        /* Operations queued, not yet completed */
+
+    /* Operations, indexed by the user data of their queue entries, and
+       the indexes of those not in use.  */
+    struct uring_op *ops;
+    unsigned *free_ops;
+
+    /* Submission queue.  SQ_TAIL is our copy of *SQ_KTAIL.  */
+    unsigned *sq_khead, *sq_ktail, *sq_array;
+    unsigned sq_mask, sq_tail;
+    struct io_uring_sqe *sqes;
+
+    /* Completion queue.  */
+    unsigned *cq_khead, *cq_ktail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* Mappings, for uring_close.  */
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+  };
+
+/* Return a ring with room for ENTRIES operations at a time, or NULL
+   if io_uring cannot be used.  */
+struct uring *
+uring_open (unsigned entries)
+{
+  struct io_uring_params p;
+  struct uring *ring;
+  int fd;
+
+  memset (&p, 0, sizeof p);
+  fd = syscall (__NR_io_uring_setup, entries, &p);
+  if (fd < 0)
+    return NULL;
+
+  /* The operations used here appeared in Linux 5.6, along with this
+     feature.  */
+  if (! (p.features & IORING_FEAT_RW_CUR_POS))
+    {
+      close (fd);
+      return NULL;
+    }
+
+  ring = xzalloc (sizeof *ring);
+  ring->fd = fd;
+  ring->entries = min (p.sq_entries, p.cq_entries);
+  ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+  ring->cq_ring_size = (p.cq_off.cqes
+			+ p.cq_entries * sizeof (struct io_uring_cqe));
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    ring->sq_ring_size = ring->cq_ring_size
+      = max (ring->sq_ring_size, ring->cq_ring_size);
+  ring->sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+
+  ring->sq_ring = mmap (NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED)
+    goto fail;
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    ring->cq_ring = ring->sq_ring;
+  else
+    {
+      ring->cq_ring = mmap (NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (ring->cq_ring == MAP_FAILED)
+	{
+	  munmap (ring->sq_ring, ring->sq_ring_size);
+	  goto fail;
+	}
+    }
+  ring->sqes = mmap (NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    {
+      if (ring->cq_ring != ring->sq_ring)
+	munmap (ring->cq_ring, ring->cq_ring_size);
+      munmap (ring->sq_ring, ring->sq_ring_size);
+      goto fail;
+    }
+
+  ring->sq_khead = (unsigned *) ((char *) ring->sq_ring + p.sq_off.head);
+  ring->sq_ktail = (unsigned *) ((char *) ring->sq_ring + p.sq_off.tail);
+  ring->sq_array = (unsigned *) ((char *) ring->sq_ring + p.sq_off.array);
+  ring->sq_mask = *(unsigned *) ((char *) ring->sq_ring + p.sq_off.ring_mask);
+  ring->sq_tail = *ring->sq_ktail;
+  ring->cq_khead = (unsigned *) ((char *) ring->cq_ring + p.cq_off.head);
+  ring->cq_ktail = (unsigned *) ((char *) ring->cq_ring + p.cq_off.tail);
+  ring->cq_mask = *(unsigned *) ((char *) ring->cq_ring + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ring
+					+ p.cq_off.cqes);
+
+  ring->ops = xcalloc (ring->entries, sizeof *ring->ops);
+  ring->free_ops = xnmalloc (ring->entries, sizeof *ring->free_ops);
+  for (unsigned i = 0; i < ring->entries; i++)
+    ring->free_ops[i] = i;
+  return ring;
+
+ fail:
+  close (fd);
+  free (ring);
+  return NULL;
+}
+
+/* Free RING.  No operations may be in flight.  */
+void
+uring_close (struct uring *ring)
+{
+  munmap (ring->sqes, ring->sqes_size);
+  if (ring->cq_ring != ring->sq_ring)
+    munmap (ring->cq_ring, ring->cq_ring_size);
+  munmap (ring->sq_ring, ring->sq_ring_size);
+  close (ring->fd);
+  free (ring->ops);
+  free (ring->free_ops);
+  free (ring);
+}
+
+/* Return a cleared submission queue entry for an operation with
+   opcode OP on FD, identified by TAG, and store its bookkeeping in
+   *POP.  No more operations may be in flight than RING was opened
+   for.  */
+static struct io_uring_sqe *
+uring_sqe (struct uring *ring, int op, int fd, size_t tag,
+	   struct uring_op **pop)
+{
+  unsigned i = ring->sq_tail & ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[i];
+  unsigned slot = ring->free_ops[ring->entries - ring->inflight - 1];
+
+  *pop = &ring->ops[slot];
+  (*pop)->tag = tag;
+  (*pop)->st = NULL;
+  memset (sqe, 0, sizeof *sqe);
+  sqe->opcode = op;
+  sqe->fd = fd;
+  sqe->user_data = slot;
+  ring->sq_array[i] = i;
+  ring->sq_tail++;
+  ring->queued++;
+  ring->inflight++;
+  return sqe;
+}
+
+/* Queue a write of SIZE bytes from BUF to FD, at its current offset.  */
+void
+uring_write (struct uring *ring, int fd, void const *buf, unsigned size,
+	     size_t tag)
+{
+  struct uring_op *op;
+  struct io_uring_sqe *sqe = uring_sqe (ring, IORING_OP_WRITE, fd, tag, &op);
+  sqe->addr = (uintptr_t) buf;
+  sqe->len = size;
+  sqe->off = -1;
+}
+
+/* Queue the closing of FD.  */
+void
+uring_close_fd (struct uring *ring, int fd, size_t tag)
+{
+  struct uring_op *op;
+  uring_sqe (ring, IORING_OP_CLOSE, fd, tag, &op);
+}
+
+/* Queue an openat of NAME in DIRFD with FLAGS.  NAME must remain valid
+   until the operation completes.  */
+void
+uring_openat (struct uring *ring, int dirfd, char const *name, int flags,
+	      size_t tag)
+{
+  struct uring_op *op;
+  struct io_uring_sqe *sqe = uring_sqe (ring, IORING_OP_OPENAT, dirfd, tag,
+					&op);
+  sqe->addr = (uintptr_t) name;
+  sqe->open_flags = flags;
+}
+
+/* Queue an fstatat of NAME in DIRFD with FLAGS, storing the status in
+   *ST when it completes.  With AT_EMPTY_PATH in FLAGS and an empty
+   NAME, this is an fstat of DIRFD.  NAME and ST must remain valid until
+   the operation completes.  */
+void
+uring_fstatat (struct uring *ring, int dirfd, char const *name,
+	       struct stat *st, int flags, size_t tag)
+{
+  struct uring_op *op;
+  struct io_uring_sqe *sqe = uring_sqe (ring, IORING_OP_STATX, dirfd, tag,
+					&op);
+  op->st = st;
+  sqe->addr = (uintptr_t) name;
+  sqe->len = STATX_BASIC_STATS;
+  sqe->off = (uintptr_t) &op->stx;
+  sqe->statx_flags = flags | AT_STATX_SYNC_AS_STAT;
+}
+
+/* Convert the result of a statx to the result of a stat.  */
+static void
+statx_to_stat (struct statx const *stx, struct stat *st)
+{
+  memset (st, 0, sizeof *st);
+  st->st_dev = makedev (stx->stx_dev_major, stx->stx_dev_minor);
+  st->st_ino = stx->stx_ino;
+  st->st_mode = stx->stx_mode;
+  st->st_nlink = stx->stx_nlink;
+  st->st_uid = stx->stx_uid;
+  st->st_gid = stx->stx_gid;
+  st->st_rdev = makedev (stx->stx_rdev_major, stx->stx_rdev_minor);
+  st->st_size = stx->stx_size;
+  st->st_blksize = stx->stx_blksize;
+  st->st_blocks = stx->stx_blocks;
+  st->st_atim.tv_sec = stx->stx_atime.tv_sec;
+  st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+  st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+  st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+  st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+  st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+/* Submit the operations queued on RING, and wait until one of them
+   completes, unless none is in flight.  Store its tag in *TAG and
+   return its result.  Return 0 without storing anything if no
+   operation is in flight.  */
+int
+uring_wait (struct uring *ring, size_t *tag)
+{
+  unsigned head = *ring->cq_khead;
+  struct io_uring_cqe *cqe;
+  struct uring_op *op;
+  unsigned slot;
+  int res;
+
+  if (! ring->inflight)
+    return 0;
+
+  __atomic_store_n (ring->sq_ktail, ring->sq_tail, __ATOMIC_RELEASE);
+  while (ring->queued
+	 || head == __atomic_load_n (ring->cq_ktail, __ATOMIC_ACQUIRE))
+    {
+      int n = syscall (__NR_io_uring_enter, ring->fd, ring->queued, 1,
+		       IORING_ENTER_GETEVENTS, NULL, 0);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  FATAL_ERROR ((0, errno, _("Cannot submit to io_uring")));
+	}
+      ring->queued -= min (n, ring->queued);
+    }
+
+  cqe = &ring->cqes[head & ring->cq_mask];
+  slot = cqe->user_data;
+  res = cqe->res;
+  __atomic_store_n (ring->cq_khead, head + 1, __ATOMIC_RELEASE);
+
+  op = &ring->ops[slot];
+  *tag = op->tag;
+  if (op->st && res == 0)
+    statx_to_stat (&op->stx, op->st);
+  ring->inflight--;
+  ring->free_ops[ring->entries - ring->inflight - 1] = slot;
+  return res;
+}
+
+#else
+
+struct uring *
+uring_open (MAYBE_UNUSED unsigned entries)
+{
+  return NULL;
+}
+
+void
+uring_close (MAYBE_UNUSED struct uring *ring)
+{
+}
+
+void
+uring_write (MAYBE_UNUSED struct uring *ring, MAYBE_UNUSED int fd,
+	     MAYBE_UNUSED void const *buf, MAYBE_UNUSED unsigned size,
+	     MAYBE_UNUSED size_t tag)
+{
+}
+
+void
+uring_close_fd (MAYBE_UNUSED struct uring *ring, MAYBE_UNUSED int fd,
+		MAYBE_UNUSED size_t tag)
+{
+}
+
+void
+uring_openat (MAYBE_UNUSED struct uring *ring, MAYBE_UNUSED int dirfd,
+	      MAYBE_UNUSED char const *name, MAYBE_UNUSED int flags,
+	      MAYBE_UNUSED size_t tag)
+{
+}
+
+void
+uring_fstatat (MAYBE_UNUSED struct uring *ring, MAYBE_UNUSED int dirfd,
+	       MAYBE_UNUSED char const *name, MAYBE_UNUSED struct stat *st,
+	       MAYBE_UNUSED int flags, MAYBE_UNUSED size_t tag)
+{
+}
+
+int
+uring_wait (MAYBE_UNUSED struct uring *ring, MAYBE_UNUSED size_t *tag)
+{
+  return 0;
+}
+
+#endif
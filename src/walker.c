@@ -0,0 +1,623 @@
+/* Read the directories being archived ahead, from worker threads.
+
+   Copyright 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU tar.
+
+   GNU tar is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU tar is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* When creating an archive, the main thread walks the file hierarchy
+   depth first, reading each directory only when it comes to dump it,
+   so that on a network file system every directory costs several
+   round trips, one after the other.  With --walk-threads=N, N worker
+   threads walk the subdirectories of the directories being dumped
+   ahead of the main thread, concurrently.  A worker reads a directory,
+   sorted as --sort says, stats its entries, checks it for exclusion
+   tags and queues its subdirectories, which any worker may then take.
+   Subdirectories are queued so that workers take them in about the
+   order in which the main thread will need them.
+
+   The main thread still does all the work that affects the archive:
+   it stats and opens every directory itself, matches the exclusion
+   patterns and exclusion tags, and dumps the entries in the usual
+   order.  When it comes to a directory that has been read ahead, it
+   takes the entries read, provided that the directory looks the same
+   now as it did when it was read.  Otherwise it reads the directory
+   as usual.  Directories are not read ahead when that could change
+   access times stored in the archive.  The archive is thus the same
+   as without this option.
+
+   Worker threads never report errors and never call functions that
+   are not thread safe (e.g. exclude or regex matching), so they may
+   read directories that turn out to be excluded.  Everything read
+   ahead below a directory is discarded once the main thread has
+   finished dumping it.  */
+
+#include <system.h>
+#include "common.h"
+#include <hash.h>
+#include <pthread.h>
+
+/* Maximum number of directories queued or read ahead, but not yet
+   reached by the main thread.  */
+enum { WALK_DIRS_MAX = 1024 };
+
+/* Maximum total size of the entries read ahead but not yet taken.  */
+enum { WALK_MEMORY_MAX = 32 * 1024 * 1024 };
+
+enum walk_state
+  {
+    walk_queued,             /* To be read by a worker */
+    walk_busy,               /* A worker is reading it */
+    walk_done                /* Finished; ENTRIES are its entries, if any */
+  };
+
+struct walk_dir
+  {
+    struct walk_dir *parent;   /* Directory containing it, or NULL */
+    struct walk_dir *root;     /* Top of its tree, which holds FD */
+    struct walk_dir *children; /* Subdirectories queued so far */
+    struct walk_dir *sibling;  /* Next subdirectory of PARENT */
+    struct walk_dir *prev, *next; /* Neighbors in the queue */
+    bool queued;               /* It is in the queue */
+    char *name;                /* Name relative to ROOT, or NULL for ROOT */
+    int fd;                    /* For ROOT, a private descriptor */
+    enum walk_state state;
+    struct stat stat;          /* Status when queued, then when read */
+    char *entries;             /* As from get_directory_entries, or NULL */
+    size_t size;               /* Size of ENTRIES */
+    size_t memory;             /* Part of walk_memory due to ENTRIES */
+    bool counted;              /* It counts in walk_count */
+    bool expand;               /* Its subdirectories are yet to be queued */
+    bool expanding;            /* A worker is queuing them */
+    bool taken;                /* The main thread has come to it */
+    bool closed;               /* The main thread is done with it */
+    bool dead;                 /* Discarded; free it once unused */
+    int pins;                  /* Number of workers using it */
+  };
+
+/* The lock protects everything below, as well as all directories.
+   The condition is broadcast on every change of state.  */
+static pthread_mutex_t walk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t walk_cond = PTHREAD_COND_INITIALIZER;
+
+/* Directories for the workers to take, the first one first.  */
+static struct walk_dir *walk_queue;
+
+/* Directories queued or read ahead and not yet taken, indexed by their
+   device and inode numbers.  */
+static Hash_table *walk_table;
+
+/* Number of directories in WALK_TABLE, and total size of their
+   entries.  */
+static size_t walk_count;
+static size_t walk_memory;
+
+/* Worker threads.  */
+static pthread_t *walk_threads;
+static int walk_nthreads;
+static bool walk_stop;
+
+static size_t
+walk_hash (void const *entry, size_t n_buckets)
+{
+  struct walk_dir const *dir = entry;
+  return (dir->stat.st_dev + dir->stat.st_ino) % n_buckets;
+}
+
+static bool
+walk_compare (void const *entry1, void const *entry2)
+{
+  struct walk_dir const *dir1 = entry1;
+  struct walk_dir const *dir2 = entry2;
+  return (dir1->stat.st_dev == dir2->stat.st_dev
+	  && dir1->stat.st_ino == dir2->stat.st_ino);
+}
+
+/* Insert DIR into the queue just after AFTER, or first if AFTER is
+   NULL.  The lock must be held.  */
+static void
+walk_enqueue (struct walk_dir *dir, struct walk_dir *after)
+{
+  if (after)
+    {
+      dir->prev = after;
+      dir->next = after->next;
+      after->next = dir;
+    }
+  else
+    {
+      dir->prev = NULL;
+      dir->next = walk_queue;
+      walk_queue = dir;
+    }
+  if (dir->next)
+    dir->next->prev = dir;
+  dir->queued = true;
+  pthread_cond_broadcast (&walk_cond);
+}
+
+/* Remove DIR from the queue.  The lock must be held.  */
+static void
+walk_dequeue (struct walk_dir *dir)
+{
+  if (dir->prev)
+    dir->prev->next = dir->next;
+  else
+    walk_queue = dir->next;
+  if (dir->next)
+    dir->next->prev = dir->prev;
+  dir->queued = false;
+}
+
+/* DIR is taken or discarded: it no longer counts against the limits.
+   The lock must be held.  */
+static void
+walk_settle (struct walk_dir *dir)
+{
+  if (dir->counted)
+    {
+      hash_remove (walk_table, dir);
+      walk_count--;
+      walk_memory -= dir->memory;
+      dir->memory = 0;
+      dir->counted = false;
+      pthread_cond_broadcast (&walk_cond);
+    }
+}
+
+static void
+walk_free (struct walk_dir *dir)
+{
+  if (dir == dir->root)
+    close (dir->fd);
+  free (dir->name);
+  free (dir->entries);
+  free (dir);
+}
+
+/* Discard the subdirectories of DIR.  If KILL, discard DIR as well.
+   The lock must be held.  */
+static void
+walk_discard (struct walk_dir *dir, bool kill)
+{
+  struct walk_dir *child = dir->children;
+
+  while (child)
+    {
+      struct walk_dir *sibling = child->sibling;
+      walk_discard (child, true);
+      child = sibling;
+    }
+  dir->children = NULL;
+
+  if (kill)
+    {
+      dir->dead = true;
+      walk_settle (dir);
+      if (dir->queued)
+	walk_dequeue (dir);
+      if (dir->pins == 0)
+	walk_free (dir);
+    }
+}
+
+/* A worker is done with DIR.  The lock must be held.  */
+static void
+walk_unpin (struct walk_dir *dir)
+{
+  if (--dir->pins == 0 && dir->dead)
+    walk_free (dir);
+}
+
+/* Read the directory open on FD, which was queued with the status
+   EXPECTED.  Store its status in *ST and the size of its entries in
+   *SIZE, and return the entries, or NULL if they cannot be read or the
+   directory changed while being read.  */
+static char *
+walk_read (int fd, struct stat const *expected, struct stat *st,
+	   size_t *size)
+{
+  struct stat st1;
+  char *entries = NULL;
+  char const *entry;
+  DIR *dirstream;
+  int dirfd;
+
+  if (fstat (fd, st) != 0
+      || st->st_dev != expected->st_dev || st->st_ino != expected->st_ino)
+    return NULL;
+
+  /* Read through a duplicate, so that FD stays usable for statting
+     the entries.  */
+  dirfd = fcntl (fd, F_DUPFD_CLOEXEC, 0);
+  if (dirfd < 0)
+    return NULL;
+  dirstream = fdopendir (dirfd);
+  if (! dirstream)
+    {
+      close (dirfd);
+      return NULL;
+    }
+  entries = streamsavedir (dirstream, savedir_sort_order);
+  closedir (dirstream);
+
+  if (entries
+      && ! (fstat (fd, &st1) == 0
+	    && ! timespec_cmp (get_stat_mtime (st), get_stat_mtime (&st1))
+	    && ! timespec_cmp (get_stat_ctime (st), get_stat_ctime (&st1))))
+    {
+      free (entries);
+      return NULL;
+    }
+
+  if (entries)
+    {
+      for (entry = entries; *entry; entry += strlen (entry) + 1)
+	continue;
+      *size = entry + 1 - entries;
+    }
+  return entries;
+}
+
+/* Queue the subdirectories among ENTRIES, the entries of DIR open on
+   FD, in their order, to be taken before any directory queued before.
+   The lock must be held; it is released while statting the entries,
+   and while waiting for the main thread to catch up.  */
+static void
+walk_expand (struct walk_dir *dir, int fd, char const *entries)
+{
+  struct subdir { char const *name; struct stat stat; } *subdirs = NULL;
+  size_t nsubdirs = 0, nalloc = 0;
+  struct walk_dir *prev = NULL;
+  char const *entry;
+  size_t i;
+
+  pthread_mutex_unlock (&walk_lock);
+  for (entry = entries; *entry; entry += strlen (entry) + 1)
+    {
+      struct stat st;
+
+      if (fstatat (fd, entry, &st, fstatat_flags) != 0
+	  || ! S_ISDIR (st.st_mode)
+	  || (one_file_system_option && st.st_dev != dir->stat.st_dev))
+	continue;
+      if (nsubdirs == nalloc)
+	{
+	  struct subdir *p;
+	  nalloc = nalloc ? 2 * nalloc : 16;
+	  p = realloc (subdirs, nalloc * sizeof *subdirs);
+	  if (! p)
+	    break;
+	  subdirs = p;
+	}
+      subdirs[nsubdirs].name = entry;
+      subdirs[nsubdirs].stat = st;
+      nsubdirs++;
+    }
+  pthread_mutex_lock (&walk_lock);
+
+  for (i = 0; i < nsubdirs; i++)
+    {
+      struct walk_dir *child;
+      char const *name = subdirs[i].name;
+      size_t len;
+
+      while (WALK_DIRS_MAX <= walk_count && ! dir->closed && ! dir->dead)
+	pthread_cond_wait (&walk_cond, &walk_lock);
+      if (dir->closed || dir->dead)
+	break;
+
+      child = calloc (1, sizeof *child);
+      len = dir->name ? strlen (dir->name) + 1 : 0;
+      if (child)
+	child->name = malloc (len + strlen (name) + 1);
+      if (! (child && child->name))
+	{
+	  free (child);
+	  break;
+	}
+      if (dir->name)
+	{
+	  strcpy (child->name, dir->name);
+	  child->name[len - 1] = '/';
+	}
+      strcpy (child->name + len, name);
+      child->stat = subdirs[i].stat;
+
+      /* A directory reachable by several names is read ahead once.  */
+      if (hash_insert_if_absent (walk_table, child, NULL) != 1)
+	{
+	  walk_free (child);
+	  continue;
+	}
+
+      child->parent = dir;
+      child->root = dir->root;
+      child->state = walk_queued;
+      child->expand = true;
+      child->counted = true;
+      walk_count++;
+      child->sibling = dir->children;
+      dir->children = child;
+
+      /* Put the child just after its preceding sibling, unless a worker
+	 already took that one.  */
+      walk_enqueue (child, prev && prev->queued ? prev : NULL);
+      prev = child;
+    }
+
+  free (subdirs);
+}
+
+/* Read DIR, unless the main thread has done so, and queue its
+   subdirectories.  The lock must be held; it is released while DIR is
+   being read.  */
+static void
+walk_process (struct walk_dir *dir)
+{
+  struct walk_dir *root = dir->root;
+  bool read = dir->state == walk_queued;
+  enum exclusion_tag_type tag;
+  char *entries = NULL;
+  struct stat st;
+  size_t size;
+  int fd;
+
+  if (read)
+    {
+      /* Give up if the main thread comes to need DIR in the meantime,
+	 since that memory may well be held by directories it will only
+	 reach later on.  */
+      while (WALK_MEMORY_MAX <= walk_memory && ! dir->taken && ! dir->dead)
+	pthread_cond_wait (&walk_cond, &walk_lock);
+      if (dir->taken || dir->dead)
+	return;
+      dir->state = walk_busy;
+    }
+  pthread_mutex_unlock (&walk_lock);
+
+  fd = (dir == root ? root->fd
+	: openat (root->fd, dir->name, open_read_flags | O_DIRECTORY));
+  tag = fd < 0 ? exclusion_tag_none : exclusion_tag_at (fd);
+  if (read && 0 <= fd && tag != exclusion_tag_all)
+    entries = walk_read (fd, &dir->stat, &st, &size);
+
+  pthread_mutex_lock (&walk_lock);
+  if (read)
+    {
+      if (entries)
+	{
+	  dir->entries = entries;
+	  dir->size = size;
+	  dir->stat = st;
+	  if (dir->counted)
+	    {
+	      dir->memory = size;
+	      walk_memory += size;
+	    }
+	}
+      dir->state = walk_done;
+      pthread_cond_broadcast (&walk_cond);
+    }
+
+  if (tag != exclusion_tag_none)
+    dir->expand = false;
+  else if (dir->expand && dir->entries && 0 <= fd
+	   && ! dir->closed && ! dir->dead)
+    {
+      dir->expand = false;
+      dir->expanding = true;
+      walk_expand (dir, fd, dir->entries);
+      dir->expanding = false;
+      if (dir->taken)
+	{
+	  /* The main thread made its own copy.  */
+	  free (dir->entries);
+	  dir->entries = NULL;
+	}
+    }
+
+  if (0 <= fd && dir != root)
+    close (fd);
+}
+
+static void *
+walk_worker (MAYBE_UNUSED void *arg)
+{
+  pthread_mutex_lock (&walk_lock);
+  while (! walk_stop)
+    {
+      struct walk_dir *dir = walk_queue;
+      struct walk_dir *root;
+
+      if (! dir)
+	{
+	  pthread_cond_wait (&walk_cond, &walk_lock);
+	  continue;
+	}
+      walk_dequeue (dir);
+      root = dir->root;
+      dir->pins++;
+      root->pins++;
+      walk_process (dir);
+      walk_unpin (dir);
+      walk_unpin (root);
+    }
+  pthread_mutex_unlock (&walk_lock);
+  return NULL;
+}
+
+/* Start the worker threads, unless already done.  Return true if at
+   least one of them is running.  */
+static bool
+walk_start (void)
+{
+  if (! walk_threads)
+    {
+      walk_table = hash_initialize (0, 0, walk_hash, walk_compare, NULL);
+      if (! walk_table)
+	xalloc_die ();
+      walk_threads = xcalloc (walk_threads_option, sizeof *walk_threads);
+      while (walk_nthreads < walk_threads_option
+	     && pthread_create (&walk_threads[walk_nthreads], NULL,
+				walk_worker, NULL) == 0)
+	walk_nthreads++;
+      if (walk_nthreads == 0)
+	walk_threads_option = 0;
+    }
+  return walk_nthreads != 0;
+}
+
+/* Begin dumping the directory ST.  Return a handle for it, or NULL if
+   walking ahead is not in effect.  If its entries have been read
+   ahead, store them in *ENTRIES, which the caller is to free.
+   Otherwise leave *ENTRIES alone; the caller is then to read them and
+   pass them to walk_dir_expand.  */
+struct walk_dir *
+walk_dir_open (struct tar_stat_info const *st, char **entries)
+{
+  struct walk_dir key, *dir;
+  int fd;
+
+  /* The workers read the subdirectories before dump_file0 stats
+     them, which may update their access times.  Only walk ahead if
+     those times are not stored in the archive or --atime-preserve=system
+     keeps them, and --atime-preserve=replace is not to restore them.
+     In incremental mode, the directories are read while collecting the
+     names instead.  */
+  if (walk_threads_option == 0
+      || atime_preserve_option == replace_atime_preserve
+      || (atime_preserve_option != system_atime_preserve
+	  && archive_stores_atime ())
+      || incremental_option
+      || st->fd <= 0
+      || ! walk_start ())
+    return NULL;
+
+  key.stat.st_dev = st->stat.st_dev;
+  key.stat.st_ino = st->stat.st_ino;
+  pthread_mutex_lock (&walk_lock);
+  dir = hash_lookup (walk_table, &key);
+  if (dir)
+    {
+      dir->taken = true;
+      walk_settle (dir);
+      if (dir->queued)
+	walk_dequeue (dir);
+      while (dir->state == walk_busy)
+	pthread_cond_wait (&walk_cond, &walk_lock);
+
+      if (dir->state == walk_done && dir->entries
+	  && dir->stat.st_dev == st->stat.st_dev
+	  && dir->stat.st_ino == st->stat.st_ino
+	  && ! timespec_cmp (get_stat_mtime (&dir->stat),
+			     get_stat_mtime (&st->stat))
+	  && ! timespec_cmp (get_stat_ctime (&dir->stat),
+			     get_stat_ctime (&st->stat)))
+	{
+	  if (dir->expanding)
+	    *entries = xmemdup (dir->entries, dir->size);
+	  else
+	    {
+	      *entries = dir->entries;
+	      dir->entries = NULL;
+	    }
+	}
+    }
+  else
+    {
+      fd = fcntl (st->fd, F_DUPFD_CLOEXEC, 0);
+      if (0 <= fd)
+	{
+	  dir = xzalloc (sizeof *dir);
+	  dir->root = dir;
+	  dir->fd = fd;
+	  dir->state = walk_done;
+	  dir->stat = st->stat;
+	  dir->expand = true;
+	  dir->taken = true;
+	}
+    }
+  pthread_mutex_unlock (&walk_lock);
+  return dir;
+}
+
+/* Have the subdirectories of DIR walked ahead, given ENTRIES, the
+   entries of DIR read by the main thread.  */
+void
+walk_dir_expand (struct walk_dir *dir, char const *entries)
+{
+  char const *entry;
+
+  pthread_mutex_lock (&walk_lock);
+  if (dir->expand && ! dir->queued)
+    {
+      for (entry = entries; *entry; entry += strlen (entry) + 1)
+	continue;
+      free (dir->entries);
+      dir->size = entry + 1 - entries;
+      dir->entries = xmemdup (entries, dir->size);
+      dir->state = walk_done;
+      walk_enqueue (dir, NULL);
+    }
+  pthread_mutex_unlock (&walk_lock);
+}
+
+/* Finish dumping DIR, and discard whatever was read ahead below it.  */
+void
+walk_dir_close (struct walk_dir *dir)
+{
+  pthread_mutex_lock (&walk_lock);
+  dir->closed = true;
+  if (dir == dir->root)
+    walk_discard (dir, true);
+  else
+    {
+      walk_discard (dir, false);
+      if (dir->queued)
+	walk_dequeue (dir);
+      if (! dir->expanding)
+	{
+	  free (dir->entries);
+	  dir->entries = NULL;
+	}
+    }
+  pthread_cond_broadcast (&walk_cond);
+  pthread_mutex_unlock (&walk_lock);
+}
+
+/* Stop the worker threads.  */
+void
+walk_finish (void)
+{
+  int i;
+
+  if (! walk_threads)
+    return;
+
+  pthread_mutex_lock (&walk_lock);
+  walk_stop = true;
+  pthread_cond_broadcast (&walk_cond);
+  pthread_mutex_unlock (&walk_lock);
+
+  for (i = 0; i < walk_nthreads; i++)
+    pthread_join (walk_threads[i], NULL);
+  free (walk_threads);
+  walk_threads = NULL;
+  walk_nthreads = 0;
+  walk_stop = false;
+  hash_free (walk_table);
+  walk_table = NULL;
+}
@@ -0,0 +1,437 @@
+/* Write extracted files from worker threads.
+
+   Copyright 2024 Free Software Foundation, Inc.
+
+   This file is part of GNU tar.
+
+   GNU tar is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   GNU tar is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* When extracting, the main thread creates every file in turn, writes
+   its data and restores its attributes, so that on a network file
+   system each small file costs several round trips.  With
+   --write-threads=N, the main thread still reads the archive, creates
+   the files and does everything else that depends on the order of the
+   members: directories, links, placeholders, removals and backups.
+   For small regular files, it then reads the member data into memory
+   and queues the open file, and one of N worker threads writes the
+   data, sets the times, owner and mode through the file descriptor,
+   and closes it.
+
+   Workers only use the descriptor they are given, so they do not
+   depend on the working directory, and a later member that replaces
+   the file name does not affect them: the extracted files are the same
+   as without this option.  Workers never report errors themselves.
+   The main thread reports them in the order of the members, as it
+   reaps the files written.  */
+
+#include <system.h>
+#include "common.h"
+#include <pthread.h>
+
+/* Maximum total size of the data queued but not yet written.  */
+enum { WRITE_MEMORY_MAX = 32 * 1024 * 1024 };
+
+/* Maximum number of files queued per thread.  This bounds the number
+   of open file descriptors.  */
+enum { WRITE_QUEUE_PER_THREAD = 16 };
+
+struct write_item
+  {
+    struct write_item *next;  /* Next file in the order of the members */
+    struct write_job job;     /* The file to write */
+    bool done;                /* A worker has finished with it */
+
+    /* Outcome, for the main thread to report.  */
+    size_t written;           /* Number of bytes written */
+    int write_errno;          /* Errors of each step, or 0 */
+    int utime_errno;
+    int chown_errno;
+    int stat_errno;
+    int chmod_errno;
+    mode_t chmod_mode;        /* Mode that could not be set */
+    int close_errno;
+  };
+
+/* The lock protects everything below.  Workers wait on WRITE_WORK_COND
+   for files to write, and the main thread on WRITE_DONE_COND for files
+   written.  */
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t write_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t write_done_cond = PTHREAD_COND_INITIALIZER;
+
+/* Files queued, in the order of the members.  */
+static struct write_item *write_head;
+static struct write_item **write_tail = &write_head;
+
+/* Next file for the workers to take.  */
+static struct write_item *write_next;
+
+/* Number of files queued and total size of their data.  */
+static size_t write_count;
+static size_t write_memory;
+
+/* Worker threads.  */
+static pthread_t *write_threads;
+static int write_nthreads;
+static bool write_stop;
+
+/* Maximum number of files written in one batch with io_uring.  */
+enum { WRITE_BATCH_MAX = 256 };
+
+/* With --io-uring, files are not handed to threads, but collected in
+   a batch by the main thread.  Their data are written, and then the
+   files closed, with one system call for the whole batch.  */
+static struct uring *write_ring;
+static struct write_item *write_batch[WRITE_BATCH_MAX];
+static int write_batch_count;
+static size_t write_batch_memory;
+
+/* Restore the attributes of ITEM, whose data is written, as set_stat
+   would.  */
+static void
+write_item_attrs (struct write_item *item)
+{
+  struct write_job *job = &item->job;
+  mode_t current_mode = job->current_mode;
+  mode_t current_mode_mask = job->current_mode_mask;
+
+  if (job->set_times && futimens (job->fd, job->ts) != 0)
+    item->utime_errno = errno;
+
+  if (job->set_owner)
+    {
+      if (fchown (job->fd, job->uid, job->gid) == 0)
+	{
+	  /* Changing the owner can clear st_mode bits in some cases.  */
+	  if ((current_mode | ~ current_mode_mask) & S_IXUGO)
+	    current_mode_mask &= ~ (current_mode & (S_ISUID | S_ISGID));
+	}
+      else
+	item->chown_errno = errno;
+    }
+
+  if (((current_mode ^ job->mode) | ~ current_mode_mask) & job->mode_mask)
+    {
+      mode_t mode;
+      struct stat st;
+
+      if (MODE_ALL & ~ job->mode_mask & ~ current_mode_mask)
+	{
+	  if (fstat (job->fd, &st) == 0)
+	    current_mode = st.st_mode;
+	  else
+	    item->stat_errno = errno;
+	}
+
+      if (! item->stat_errno)
+	{
+	  current_mode &= MODE_ALL;
+	  mode = (current_mode & ~ job->mode_mask) | (job->mode & job->mode_mask);
+	  if (current_mode != mode && fchmod (job->fd, mode) != 0)
+	    {
+	      item->chmod_errno = errno;
+	      item->chmod_mode = mode;
+	    }
+	}
+    }
+}
+
+/* Write the data of ITEM, restore its attributes and close it.  */
+static void
+write_item_run (struct write_item *item)
+{
+  struct write_job *job = &item->job;
+
+  item->written = full_write (job->fd, job->data, job->size);
+  if (item->written != job->size)
+    item->write_errno = errno;
+  write_item_attrs (item);
+  if (close (job->fd) != 0)
+    item->close_errno = errno;
+}
+
+static void *
+write_worker (MAYBE_UNUSED void *arg)
+{
+  pthread_mutex_lock (&write_lock);
+  while (! write_stop)
+    {
+      struct write_item *item;
+
+      if (! write_next)
+	{
+	  pthread_cond_wait (&write_work_cond, &write_lock);
+	  continue;
+	}
+      item = write_next;
+      write_next = item->next;
+      pthread_mutex_unlock (&write_lock);
+
+      write_item_run (item);
+
+      pthread_mutex_lock (&write_lock);
+      item->done = true;
+      pthread_cond_signal (&write_done_cond);
+    }
+  pthread_mutex_unlock (&write_lock);
+  return NULL;
+}
+
+/* Start the worker threads, unless already done.  Return true if at
+   least one of them is running.  */
+static bool
+write_threads_start (void)
+{
+  if (! write_threads)
+    {
+      write_threads = xcalloc (write_threads_option, sizeof *write_threads);
+      while (write_nthreads < write_threads_option
+	     && pthread_create (&write_threads[write_nthreads], NULL,
+				write_worker, NULL) == 0)
+	write_nthreads++;
+      if (write_nthreads == 0)
+	write_threads_option = 0;
+    }
+  return write_nthreads != 0;
+}
+
+/* Report the outcome of ITEM and free it.  */
+static void
+write_item_finish (struct write_item *item)
+{
+  struct write_job *job = &item->job;
+  char const *file_name = job->file_name;
+
+  if (item->write_errno)
+    {
+      errno = item->write_errno;
+      write_error_details (file_name, item->written, job->size);
+    }
+  if (item->utime_errno)
+    {
+      errno = item->utime_errno;
+      utime_error (file_name);
+    }
+  else if (job->set_times)
+    {
+      if (job->ts[0].tv_nsec != UTIME_OMIT)
+	check_time (file_name, job->ts[0]);
+      check_time (file_name, job->ts[1]);
+    }
+  if (item->chown_errno)
+    {
+      errno = item->chown_errno;
+      chown_error_details (file_name, job->uid, job->gid);
+    }
+  if (item->stat_errno)
+    {
+      errno = item->stat_errno;
+      stat_error (file_name);
+    }
+  if (item->chmod_errno)
+    {
+      errno = item->chmod_errno;
+      chmod_error_details (file_name, item->chmod_mode);
+    }
+  if (item->close_errno)
+    {
+      errno = item->close_errno;
+      close_error (file_name);
+    }
+
+  free (job->file_name);
+  free (job->data);
+  free (item);
+}
+
+/* Report the files written so far, in the order of the members.  If
+   WAIT, wait until all of them are written.  The lock must be held.  */
+static void
+write_threads_reap (bool wait)
+{
+  while (write_head && (write_head->done || wait))
+    {
+      struct write_item *item = write_head;
+
+      if (! item->done)
+	{
+	  pthread_cond_wait (&write_done_cond, &write_lock);
+	  continue;
+	}
+      write_head = item->next;
+      if (! write_head)
+	write_tail = &write_head;
+      write_count--;
+      write_memory -= item->job.size;
+
+      /* Reporting may take a while; let the workers go on.  */
+      pthread_mutex_unlock (&write_lock);
+      write_item_finish (item);
+      pthread_mutex_lock (&write_lock);
+    }
+}
+
+/* Open the ring for writing batches, unless already done.  Return
+   true if it is open.  */
+static bool
+write_ring_start (void)
+{
+  if (! write_ring)
+    {
+      write_ring = uring_open (WRITE_BATCH_MAX);
+      if (! write_ring)
+	io_uring_option = false;
+    }
+  return !! write_ring;
+}
+
+/* Write the files of the current batch, restore their attributes,
+   close them and report them, in the order of the members.  */
+static void
+write_batch_flush (void)
+{
+  int count = write_batch_count;
+  int i, n;
+  size_t tag;
+
+  /* Start a new batch now, in case a fatal error brings us back here.  */
+  write_batch_count = 0;
+  write_batch_memory = 0;
+
+  /* Write the data.  */
+  for (i = n = 0; i < count; i++)
+    {
+      struct write_item *item = write_batch[i];
+      if (item->job.size)
+	{
+	  uring_write (write_ring, item->job.fd, item->job.data,
+		       item->job.size, i);
+	  n++;
+	}
+    }
+  for (; n; n--)
+    {
+      int res = uring_wait (write_ring, &tag);
+      struct write_item *item = write_batch[tag];
+      struct write_job *job = &item->job;
+
+      if (res < 0)
+	item->write_errno = -res;
+      else
+	{
+	  /* Finish a short write as full_write would.  */
+	  item->written = res;
+	  if (item->written < job->size)
+	    {
+	      item->written += full_write (job->fd, job->data + item->written,
+					   job->size - item->written);
+	      if (item->written != job->size)
+		item->write_errno = errno;
+	    }
+	}
+    }
+
+  /* There are no io_uring operations for these.  */
+  for (i = 0; i < count; i++)
+    write_item_attrs (write_batch[i]);
+
+  /* Close the files.  */
+  for (i = 0; i < count; i++)
+    uring_close_fd (write_ring, write_batch[i]->job.fd, i);
+  for (n = count; n; n--)
+    {
+      int res = uring_wait (write_ring, &tag);
+      if (res < 0)
+	write_batch[tag]->close_errno = -res;
+    }
+
+  for (i = 0; i < count; i++)
+    write_item_finish (write_batch[i]);
+}
+
+/* Queue JOB for writing by a worker thread, or in the current batch
+   with --io-uring, which takes over its descriptor, file name and
+   data.  If neither is available, write it now.  */
+void
+write_threads_submit (struct write_job const *job)
+{
+  struct write_item *item = xzalloc (sizeof *item);
+
+  item->job = *job;
+  if (io_uring_option && write_ring_start ())
+    {
+      if (WRITE_MEMORY_MAX - write_batch_memory < job->size)
+	write_batch_flush ();
+      write_batch[write_batch_count++] = item;
+      write_batch_memory += job->size;
+      if (write_batch_count == WRITE_BATCH_MAX)
+	write_batch_flush ();
+      return;
+    }
+  if (! write_threads_start ())
+    {
+      write_item_run (item);
+      write_item_finish (item);
+      return;
+    }
+
+  pthread_mutex_lock (&write_lock);
+  write_threads_reap (false);
+  while (write_head
+	 && (write_nthreads * WRITE_QUEUE_PER_THREAD <= write_count
+	     || WRITE_MEMORY_MAX - write_memory < job->size))
+    {
+      pthread_cond_wait (&write_done_cond, &write_lock);
+      write_threads_reap (false);
+    }
+  *write_tail = item;
+  write_tail = &item->next;
+  if (! write_next)
+    write_next = item;
+  write_count++;
+  write_memory += job->size;
+  pthread_cond_signal (&write_work_cond);
+  pthread_mutex_unlock (&write_lock);
+}
+
+/* Wait until all the files queued are written, report them and stop
+   the worker threads.  */
+void
+write_threads_finish (void)
+{
+  int i;
+
+  if (write_ring)
+    {
+      write_batch_flush ();
+      uring_close (write_ring);
+      write_ring = NULL;
+    }
+
+  if (! write_threads)
+    return;
+
+  pthread_mutex_lock (&write_lock);
+  write_threads_reap (true);
+  write_stop = true;
+  pthread_cond_broadcast (&write_work_cond);
+  pthread_mutex_unlock (&write_lock);
+
+  for (i = 0; i < write_nthreads; i++)
+    pthread_join (write_threads[i], NULL);
+  free (write_threads);
+  write_threads = NULL;
+  write_nthreads = 0;
+  write_stop = false;
+}
@@ -23,6 +23,7 @@
 #include <system.h>
 
 #include <fnmatch.h>
+#include <hash.h>
 #include <quotearg.h>
 
 #include "common.h"
@@ -33,6 +34,91 @@
 #define XATTRS_PREFIX "SCHILY.xattr."
 #define XATTRS_PREFIX_LEN (sizeof XATTRS_PREFIX - 1)
 
+/* An O_PATH descriptor of the file whose attributes were last got,
+   and the name of that file under /proc/self/fd.  Getting attributes
+   through that name avoids the *at emulation of lib/xattr-at.c and
+   lib/selinux-at.c, which saves, changes and restores the working
+   directory for each call.  The descriptor is kept for the next call
+   about the same file, since attributes are got by three functions
+   in turn.  */
+static struct
+{
+  int fd;
+  dev_t dev;
+  ino_t ino;
+  char name[sizeof "/proc/self/fd/" + INT_BUFSIZE_BOUND (int)];
+} xattrs_handle = { -1 };
+
+/* Whether names under /proc/self/fd cannot be used.  */
+static bool xattrs_handle_broken;
+
+/* Return a name that designates the file FILE_NAME, relative to
+   PARENTFD, whose status is ST, and that can be passed to functions
+   that follow symbolic links, or NULL if the *at functions are to be
+   used instead.  */
+MAYBE_UNUSED static char const *
+xattrs__handle_name (int parentfd, char const *file_name,
+		     struct stat const *st)
+{
+#ifdef O_PATH
+  int fd;
+  struct stat hst;
+
+  /* The *at functions need no emulation in this case.  */
+  if (parentfd == AT_FDCWD || IS_ABSOLUTE_FILE_NAME (file_name)
+      || xattrs_handle_broken)
+    return NULL;
+
+  /* While the descriptor is open, no other file can have its inode
+     number.  */
+  if (0 <= xattrs_handle.fd
+      && xattrs_handle.dev == st->st_dev && xattrs_handle.ino == st->st_ino)
+    return xattrs_handle.name;
+
+  if (0 <= xattrs_handle.fd)
+    {
+      close (xattrs_handle.fd);
+      xattrs_handle.fd = -1;
+    }
+
+  fd = openat (parentfd, file_name, O_PATH | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+  if (fstat (fd, &hst) != 0
+      || hst.st_dev != st->st_dev || hst.st_ino != st->st_ino)
+    {
+      close (fd);
+      return NULL;
+    }
+  sprintf (xattrs_handle.name, "/proc/self/fd/%d", fd);
+
+  /* Check once that the name leads to the file, which it does not if
+     /proc is not mounted.  */
+  {
+    static bool checked;
+    struct stat pst;
+    if (! checked)
+      {
+	checked = true;
+	if (! (stat (xattrs_handle.name, &pst) == 0
+	       && pst.st_dev == hst.st_dev && pst.st_ino == hst.st_ino))
+	  {
+	    xattrs_handle_broken = true;
+	    close (fd);
+	    return NULL;
+	  }
+      }
+  }
+
+  xattrs_handle.fd = fd;
+  xattrs_handle.dev = hst.st_dev;
+  xattrs_handle.ino = hst.st_ino;
+  return xattrs_handle.name;
+#else
+  return NULL;
+#endif
+}
+
 void
 xheader_xattr_init (struct tar_stat_info *st)
 {
@@ -350,17 +436,22 @@ xattrs_acls_cleanup (char *val, size_t *plen)
   *p++ = 0;
 }
 
+/* Get the ACL of type TYPE of FILE_NAME, relative to PARENTFD, or of
+   HANDLE_NAME if not null (see xattrs__handle_name).  */
 static void
-acls_get_text (int parentfd, const char *file_name, acl_type_t type,
-	       char **ret_ptr, size_t * ret_len)
+acls_get_text (int parentfd, const char *file_name, char const *handle_name,
+	       acl_type_t type, char **ret_ptr, size_t * ret_len)
 {
   char *val = NULL;
   acl_t acl;
 
-  if (!(acl = acl_get_file_at (parentfd, file_name, type)))
+  if (!(acl = (handle_name
+	       ? acl_get_file (handle_name, type)
+	       : acl_get_file_at (parentfd, file_name, type))))
     {
       if (errno != ENOTSUP)
-        call_arg_warn ("acl_get_file_at", file_name);
+        call_arg_warn (handle_name ? "acl_get_file" : "acl_get_file_at",
+		       file_name);
       return;
     }
 
@@ -395,17 +486,21 @@ acls_get_text (int parentfd, const char *file_name, acl_type_t type,
 
 static void
 xattrs__acls_get_a (int parentfd, const char *file_name,
+		    char const *handle_name,
                     char **ret_ptr, size_t *ret_len)
 {
-  acls_get_text (parentfd, file_name, ACL_TYPE_ACCESS, ret_ptr, ret_len);
+  acls_get_text (parentfd, file_name, handle_name, ACL_TYPE_ACCESS,
+		 ret_ptr, ret_len);
 }
 
 /* "system.posix_acl_default" */
 static void
 xattrs__acls_get_d (int parentfd, char const *file_name,
+		    char const *handle_name,
                     char **ret_ptr, size_t * ret_len)
 {
-  acls_get_text (parentfd, file_name, ACL_TYPE_DEFAULT, ret_ptr, ret_len);
+  acls_get_text (parentfd, file_name, handle_name, ACL_TYPE_DEFAULT,
+		 ret_ptr, ret_len);
 }
 #endif /* HAVE_POSIX_ACLS */
 
@@ -459,19 +554,24 @@ xattrs_acls_get (MAYBE_UNUSED int parentfd, MAYBE_UNUSED char const *file_name,
         WARN ((0, 0, _("POSIX ACL support is not available")));
       done = 1;
 #else
-      int err = file_has_acl_at (parentfd, file_name, &st->stat);
+      char const *handle_name = xattrs__handle_name (parentfd, file_name,
+						       &st->stat);
+      int err = (handle_name
+		 ? file_has_acl (handle_name, &st->stat)
+		 : file_has_acl_at (parentfd, file_name, &st->stat));
       if (err == 0)
         return;
       if (err == -1)
         {
-          call_arg_warn ("file_has_acl_at", file_name);
+          call_arg_warn (handle_name ? "file_has_acl" : "file_has_acl_at",
+			 file_name);
           return;
         }
 
-      xattrs__acls_get_a (parentfd, file_name,
+      xattrs__acls_get_a (parentfd, file_name, handle_name,
                           &st->acls_a_ptr, &st->acls_a_len);
       if (!xisfile)
-	xattrs__acls_get_d (parentfd, file_name,
+	xattrs__acls_get_d (parentfd, file_name, handle_name,
                             &st->acls_d_ptr, &st->acls_d_len);
 #endif
     }
@@ -537,6 +637,104 @@ xattrs_clear_setup (void)
 
 static bool xattrs_masked_out (const char *kw, bool archiving);
 
+#ifdef HAVE_XATTRS
+/* A list of attribute names, as returned by listxattr, and what was
+   found about them.  The files of a tree usually have few different
+   lists of attribute names, so these are kept in a table, which saves
+   matching each name against the masks for each file, and getting
+   each value in a buffer too small for it first.  */
+struct xattrs_names
+{
+  char *list;                  /* Names, each followed by a null byte */
+  size_t len;                  /* Length of LIST */
+  size_t count;                /* Number of names */
+  bool *masked;                /* Whether each name is masked out */
+  size_t value_size;           /* Size of the largest value got */
+};
+
+/* Maximum number of entries in xattrs_names_table.  Lists of names met
+   after that are not kept.  */
+enum { XATTRS_NAMES_MAX = 1024 };
+
+static Hash_table *xattrs_names_table;
+
+static size_t
+xattrs_names_hash (void const *entry, size_t n_buckets)
+{
+  struct xattrs_names const *names = entry;
+  size_t h = 0;
+  size_t i;
+
+  for (i = 0; i < names->len; i++)
+    h = h * 31 + (unsigned char) names->list[i];
+  return h % n_buckets;
+}
+
+static bool
+xattrs_names_compare (void const *entry1, void const *entry2)
+{
+  struct xattrs_names const *names1 = entry1;
+  struct xattrs_names const *names2 = entry2;
+  return (names1->len == names2->len
+	  && memcmp (names1->list, names2->list, names1->len) == 0);
+}
+
+static void
+xattrs_names_free (void *entry)
+{
+  struct xattrs_names *names = entry;
+  free (names->list);
+  free (names->masked);
+  free (names);
+}
+
+/* Return the entry for the list of LEN bytes of names LIST.  */
+static struct xattrs_names *
+xattrs_names_get (char const *list, size_t len)
+{
+  static struct xattrs_names *unkept;
+  struct xattrs_names key, *names;
+  char const *p;
+  size_t i;
+
+  key.list = (char *) list;
+  key.len = len;
+  if (xattrs_names_table
+      && (names = hash_lookup (xattrs_names_table, &key)))
+    return names;
+
+  if (unkept)
+    {
+      xattrs_names_free (unkept);
+      unkept = NULL;
+    }
+
+  names = xmalloc (sizeof *names);
+  names->list = xmemdup (list, len);
+  names->len = len;
+  for (names->count = 0, p = list; p < list + len; p += strlen (p) + 1)
+    names->count++;
+  names->masked = xnmalloc (names->count, sizeof names->masked[0]);
+  for (i = 0, p = list; p < list + len; p += strlen (p) + 1, i++)
+    names->masked[i] = xattrs_masked_out (p, true);
+  names->value_size = 0;
+
+  if (! (xattrs_names_table
+	 || (xattrs_names_table = hash_initialize (0, 0, xattrs_names_hash,
+						   xattrs_names_compare,
+						   xattrs_names_free))))
+    xalloc_die ();
+  if (hash_get_n_entries (xattrs_names_table) < XATTRS_NAMES_MAX)
+    {
+      if (! hash_insert (xattrs_names_table, names))
+	xalloc_die ();
+    }
+  else
+    unkept = names;
+  return names;
+}
+#endif
+
 /* get xattrs from file given by FILE_NAME or FD (when non-zero)
    xattrs are checked against the user supplied include/exclude mask
    if no mask is given this includes all the user.*, security.*, system.*,
@@ -556,39 +754,55 @@ xattrs_xattrs_get (int parentfd, char const *file_name,
       static size_t xsz = 1024;
       static char *xatrs = NULL;
       ssize_t xret = -1;
+      char const *handle_name = (fd ? NULL
+				 : xattrs__handle_name (parentfd, file_name,
+							&st->stat));
 
       if (!xatrs)
 	xatrs = x2nrealloc (xatrs, &xsz, 1);
 
-      while (((fd == 0) ?
-              ((xret =
-                llistxattrat (parentfd, file_name, xatrs, xsz)) == -1) :
-	      ((xret = flistxattr (fd, xatrs, xsz)) == -1))
+      while (((xret = (fd ? flistxattr (fd, xatrs, xsz)
+		       : handle_name ? listxattr (handle_name, xatrs, xsz)
+		       : llistxattrat (parentfd, file_name, xatrs, xsz)))
+	      == -1)
              && (errno == ERANGE))
         {
 	  xatrs = x2nrealloc (xatrs, &xsz, 1);
         }
 
       if (xret == -1)
-        call_arg_warn ((fd == 0) ? "llistxattrat" : "flistxattr", file_name);
-      else
+        call_arg_warn (fd ? "flistxattr"
+		       : handle_name ? "listxattr" : "llistxattrat",
+		       file_name);
+      else if (xret > 0)
         {
           const char *attr = xatrs;
+	  struct xattrs_names *names = xattrs_names_get (xatrs, xret);
           static size_t asz = 1024;
           static char *val = NULL;
+	  size_t i;
 
-          if (!val)
-            val = x2nrealloc (val, &asz, 1);
+          if (!val || asz < names->value_size)
+	    {
+	      if (asz < names->value_size)
+		asz = names->value_size;
+	      val = xrealloc (val, asz);
+	    }
 
-          while (xret > 0)
+          for (i = 0; i < names->count; i++, attr += strlen (attr) + 1)
             {
-              size_t len = strlen (attr);
               ssize_t aret = 0;
 
-              while (((fd == 0)
-                      ? ((aret = lgetxattrat (parentfd, file_name, attr,
-                                              val, asz)) == -1)
-                      : ((aret = fgetxattr (fd, attr, val, asz)) == -1))
+	      /* Masked out names need not be got.  */
+	      if (names->masked[i])
+		continue;
+
+              while (((aret = (fd ? fgetxattr (fd, attr, val, asz)
+			       : handle_name
+			       ? getxattr (handle_name, attr, val, asz)
+			       : lgetxattrat (parentfd, file_name, attr,
+					      val, asz)))
+		      == -1)
                      && (errno == ERANGE))
                 {
 		  val = x2nrealloc (val, &asz, 1);
@@ -596,15 +810,14 @@ xattrs_xattrs_get (int parentfd, char const *file_name,
 
               if (aret != -1)
                 {
-                  if (!xattrs_masked_out (attr, true))
-                    xheader_xattr_add (st, attr, val, aret);
+		  if (names->value_size < (size_t) aret)
+		    names->value_size = aret;
+		  xheader_xattr_add (st, attr, val, aret);
                 }
               else if (errno != ENOATTR)
-                call_arg_warn ((fd == 0) ? "lgetxattrat"
-                               : "fgetxattr", file_name);
-
-              attr += len + 1;
-              xret -= len + 1;
+                call_arg_warn (fd ? "fgetxattr"
+			       : handle_name ? "getxattr" : "lgetxattrat",
+			       file_name);
             }
         }
 #endif
@@ -652,12 +865,17 @@ xattrs_selinux_get (MAYBE_UNUSED int parentfd, MAYBE_UNUSED char const *file_nam
         WARN ((0, 0, _("SELinux support is not available")));
       done = 1;
 #else
-      int result = fd ?
-	            fgetfilecon (fd, &st->cntx_name)
-                    : lgetfileconat (parentfd, file_name, &st->cntx_name);
+      char const *handle_name = (fd ? NULL
+				 : xattrs__handle_name (parentfd, file_name,
+							&st->stat));
+      int result = (fd ? fgetfilecon (fd, &st->cntx_name)
+		    : handle_name ? getfilecon (handle_name, &st->cntx_name)
+		    : lgetfileconat (parentfd, file_name, &st->cntx_name));
 
       if (result == -1 && errno != ENODATA && errno != ENOTSUP)
-        call_arg_warn (fd ? "fgetfilecon" : "lgetfileconat", file_name);
+        call_arg_warn (fd ? "fgetfilecon"
+		       : handle_name ? "getfilecon" : "lgetfileconat",
+		       file_name);
 #endif
     }
 }
@@ -0,0 +1,241 @@
+/* Benchmark for GNU tar - listing speed and extraction of delayed links.
+
+   Copyright 2024 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; either version 3, or (at your option) any later
+   version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+   Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+   Usage: benchlist [--links] COUNT TAR
+
+   Pipe a synthetic ustar archive of COUNT empty members into "TAR -tf -"
+   and report how many headers per second it listed.
+
+   With --links, pipe instead an archive of COUNT hard links into
+   "TAR -xf - -C DIR", where DIR is a fresh temporary directory, and
+   report how many links per second it extracted.  The links are
+   grouped by 1000 in directories, each of which also holds a symbolic
+   link pointing outside of it.  That symbolic link is extracted as a
+   placeholder, so each hard link to it is a delayed link as well.
+
+   The archive is generated on the fly, so that its size does not
+   matter.  */
+
+#include <config.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <timespec.h>
+
+enum { BLOCKSIZE = 512, BLOCKING = 20 };
+
+/* Number of members per directory.  */
+enum { GROUP = 1000 };
+
+/* Offsets of the ustar header fields that are set.  */
+enum
+  {
+    NAME = 0,
+    MODE = 100,
+    UID = 108,
+    GID = 116,
+    SIZE = 124,
+    MTIME = 136,
+    CHKSUM = 148,
+    TYPEFLAG = 156,
+    LINKNAME = 157,
+    MAGIC = 257,
+    VERSION = 263,
+    UNAME = 265,
+    GNAME = 297
+  };
+
+static void
+make_header (char *blk, char type, char const *name, char const *linkname)
+{
+  unsigned sum = 0;
+  int i;
+
+  memset (blk, 0, BLOCKSIZE);
+  strcpy (blk + NAME, name);
+  strcpy (blk + MODE, type == '5' ? "0000755" : "0000644");
+  strcpy (blk + UID, "0000000");
+  strcpy (blk + GID, "0000000");
+  strcpy (blk + SIZE, "00000000000");
+  strcpy (blk + MTIME, "14675234600");
+  memset (blk + CHKSUM, ' ', 8);
+  blk[TYPEFLAG] = type;
+  if (linkname)
+    strcpy (blk + LINKNAME, linkname);
+  memcpy (blk + MAGIC, "ustar", 6);
+  memcpy (blk + VERSION, "00", 2);
+  strcpy (blk + UNAME, "root");
+  strcpy (blk + GNAME, "root");
+  for (i = 0; i < BLOCKSIZE; i++)
+    sum += (unsigned char) blk[i];
+  sprintf (blk + CHKSUM, "%06o", sum);
+}
+
+static void
+write_all (int fd, char const *buf, size_t size)
+{
+  while (size)
+    {
+      ssize_t n = write (fd, buf, size);
+      if (n < 0)
+	{
+	  perror ("benchlist: write");
+	  exit (EXIT_FAILURE);
+	}
+      buf += n;
+      size -= n;
+    }
+}
+
+static char record[BLOCKSIZE * BLOCKING];
+static size_t fill;
+
+/* Append a header to the archive being written to FD.  */
+static void
+put_header (int fd, char type, char const *name, char const *linkname)
+{
+  make_header (record + fill, type, name, linkname);
+  fill += BLOCKSIZE;
+  if (fill == sizeof record)
+    {
+      write_all (fd, record, fill);
+      fill = 0;
+    }
+}
+
+/* Run "rm -rf DIR".  */
+static void
+remove_dir (char const *dir)
+{
+  pid_t pid = fork ();
+  if (pid == 0)
+    {
+      execlp ("rm", "rm", "-rf", dir, (char *) NULL);
+      _exit (127);
+    }
+  if (pid > 0)
+    waitpid (pid, NULL, 0);
+}
+
+int
+main (int argc, char **argv)
+{
+  char dir[] = "benchlist.XXXXXX";
+  char name[100], target[100];
+  unsigned long count, n;
+  int fd[2];
+  int status;
+  pid_t pid;
+  struct timespec start, end;
+  double elapsed;
+  int links = argc == 4 && strcmp (argv[1], "--links") == 0;
+
+  if (argc != 3 + links)
+    {
+      fprintf (stderr, "usage: benchlist [--links] COUNT TAR\n");
+      return EXIT_FAILURE;
+    }
+  argv += links;
+  count = strtoul (argv[1], NULL, 10);
+
+  if (links && !mkdtemp (dir))
+    {
+      perror ("benchlist: mkdtemp");
+      return EXIT_FAILURE;
+    }
+  if (pipe (fd))
+    {
+      perror ("benchlist: pipe");
+      return EXIT_FAILURE;
+    }
+  gettime (&start);
+  pid = fork ();
+  if (pid < 0)
+    {
+      perror ("benchlist: fork");
+      return EXIT_FAILURE;
+    }
+  if (pid == 0)
+    {
+      dup2 (fd[0], 0);
+      close (fd[0]);
+      close (fd[1]);
+      if (links)
+	execl (argv[2], argv[2], "-xf", "-", "-C", dir, (char *) NULL);
+      else
+	{
+	  int null = open ("/dev/null", O_WRONLY);
+	  dup2 (null, 1);
+	  execl (argv[2], argv[2], "-tf", "-", (char *) NULL);
+	}
+      perror (argv[2]);
+      _exit (127);
+    }
+  close (fd[0]);
+
+  for (n = 0; n < count; n++)
+    {
+      if (!links)
+	{
+	  sprintf (name, "dir%04lu/file%08lu", n / GROUP, n);
+	  put_header (fd[1], '0', name, NULL);
+	  continue;
+	}
+      if (n % GROUP == 0)
+	{
+	  sprintf (name, "dir%04lu/", n / GROUP);
+	  put_header (fd[1], '5', name, NULL);
+	  sprintf (target, "dir%04lu/sym", n / GROUP);
+	  put_header (fd[1], '2', target, "../outside");
+	}
+      sprintf (name, "dir%04lu/link%08lu", n / GROUP, n);
+      put_header (fd[1], '1', name, target);
+    }
+  /* End-of-archive marker, padded to a full record.  */
+  memset (record + fill, 0, sizeof record - fill);
+  write_all (fd[1], record, sizeof record);
+  if (fill + 2 * BLOCKSIZE > sizeof record)
+    {
+      memset (record, 0, sizeof record);
+      write_all (fd[1], record, sizeof record);
+    }
+  close (fd[1]);
+
+  if (waitpid (pid, &status, 0) != pid)
+    {
+      perror ("benchlist: waitpid");
+      return EXIT_FAILURE;
+    }
+  gettime (&end);
+  if (links)
+    remove_dir (dir);
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    {
+      fprintf (stderr, "benchlist: %s failed\n", argv[2]);
+      return EXIT_FAILURE;
+    }
+
+  elapsed = timespectod (timespec_sub (end, start));
+  printf ("%lu %s in %.3f s: %.0f %s/s\n",
+	  count, links ? "links" : "headers", elapsed,
+	  elapsed > 0 ? count / elapsed : 0, links ? "links" : "headers");
+  return EXIT_SUCCESS;
+}